@@ -0,0 +1,312 @@
+/* for O_DIRECT and statx */
+#define _GNU_SOURCE
+
+#include "blockdev.h"
+#include "config.h"
+#include "lockstat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Alignment of the staging buffer (enough for O_DIRECT on any device) */
+#define BLOCKDEV_BUFFER_ALIGN (4096)
+
+struct blockdev {
+    blockdev_ops_t const *ops;
+    int fd;
+    size_t block_count;
+    /* O_DIRECT requires buffers aligned to this (1 otherwise) */
+    size_t mem_align;
+
+    /* Modified blocks are copied to a slot of the staging buffer and
+     * written together once it fills up (or is flushed); slot_of holds the
+     * slot of each staged block (-1 if none), so that a block modified
+     * again before it is written only takes one slot */
+    pthread_mutex_t mutex;
+    char *batch;
+    size_t batch_blocks[BLOCKDEV_BATCH_BLOCKS];
+    size_t staged;
+    int *slot_of;
+    /* Set when a batch fails to be written, and reported by the next
+     * flush */
+    bool failed;
+};
+
+static int file_read_blocks(blockdev_t *dev, size_t first, size_t count,
+                            void *buffer) {
+    size_t len = count * BLOCK_SIZE, done = 0;
+    while (done < len) {
+        ssize_t n = pread(dev->fd, (char *)buffer + done, len - done,
+                          (off_t)(first * BLOCK_SIZE + done));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int file_write_blocks(blockdev_t *dev, size_t first, size_t count,
+                             void const *const *buffers) {
+    struct iovec iov[BLOCKDEV_BATCH_BLOCKS];
+    size_t done = 0;
+    while (done < count) {
+        size_t n = count - done < BLOCKDEV_BATCH_BLOCKS
+                       ? count - done
+                       : BLOCKDEV_BATCH_BLOCKS;
+        for (size_t i = 0; i < n; i++) {
+            iov[i].iov_base = (void *)buffers[done + i];
+            iov[i].iov_len = BLOCK_SIZE;
+        }
+        ssize_t written = pwritev(dev->fd, iov, (int)n,
+                                  (off_t)((first + done) * BLOCK_SIZE));
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        /* Short writes are retried from the first block not written */
+        if (written < BLOCK_SIZE) {
+            return -1;
+        }
+        done += (size_t)written / BLOCK_SIZE;
+    }
+    return 0;
+}
+
+static int file_flush(blockdev_t *dev) { return fdatasync(dev->fd); }
+
+/*
+ * O_DIRECT reads go through an aligned buffer when the destination is not
+ * aligned (the data region's blocks always are)
+ */
+static int direct_read_blocks(blockdev_t *dev, size_t first, size_t count,
+                              void *buffer) {
+    if ((uintptr_t)buffer % dev->mem_align == 0) {
+        return file_read_blocks(dev, first, count, buffer);
+    }
+    void *aligned = aligned_alloc(BLOCKDEV_BUFFER_ALIGN, count * BLOCK_SIZE);
+    if (aligned == NULL) {
+        return -1;
+    }
+    int result = file_read_blocks(dev, first, count, aligned);
+    if (result == 0) {
+        memcpy(buffer, aligned, count * BLOCK_SIZE);
+    }
+    free(aligned);
+    return result;
+}
+
+static blockdev_ops_t const file_ops = {
+    .read_blocks = file_read_blocks,
+    .write_blocks = file_write_blocks,
+    .flush = file_flush,
+};
+
+/* Writes always come from the (aligned) staging buffer */
+static blockdev_ops_t const direct_ops = {
+    .read_blocks = direct_read_blocks,
+    .write_blocks = file_write_blocks,
+    .flush = file_flush,
+};
+
+/*
+ * Returns the alignment O_DIRECT requires for the offsets and buffers of a
+ * file, 0 if it cannot be used with blocks of BLOCK_SIZE
+ */
+static size_t direct_alignment(int fd) {
+    size_t align = 512;
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN)) {
+        if (stx.stx_dio_offset_align == 0) {
+            /* The file system does not support O_DIRECT */
+            return 0;
+        }
+        align = stx.stx_dio_offset_align > stx.stx_dio_mem_align
+                    ? stx.stx_dio_offset_align
+                    : stx.stx_dio_mem_align;
+    }
+#else
+    (void)fd;
+#endif
+    return align <= BLOCK_SIZE ? align : 0;
+}
+
+/*
+ * Creates a device of the given size on a file, which is truncated
+ * Input:
+ *  - type: BLOCKDEV_FILE or BLOCKDEV_DIRECT
+ *  - path: the file
+ *  - block_count: size of the device, in blocks
+ * Returns: the device if successful, NULL otherwise
+ */
+blockdev_t *blockdev_open(blockdev_type_t type, char const *path,
+                          size_t block_count) {
+    if ((type != BLOCKDEV_FILE && type != BLOCKDEV_DIRECT) || path == NULL) {
+        return NULL;
+    }
+    blockdev_t *dev = calloc(1, sizeof(blockdev_t));
+    if (dev == NULL) {
+        return NULL;
+    }
+    dev->block_count = block_count;
+    dev->ops = type == BLOCKDEV_DIRECT ? &direct_ops : &file_ops;
+    dev->mem_align = 1;
+    dev->batch = aligned_alloc(BLOCKDEV_BUFFER_ALIGN,
+                               BLOCKDEV_BATCH_BLOCKS * BLOCK_SIZE);
+    dev->slot_of = malloc(block_count * sizeof(int));
+    int flags = O_RDWR | O_CREAT | O_TRUNC;
+    if (type == BLOCKDEV_DIRECT) {
+        flags |= O_DIRECT;
+    }
+    dev->fd = dev->batch == NULL || dev->slot_of == NULL
+                  ? -1
+                  : open(path, flags, 0644);
+    if (dev->fd != -1 && type == BLOCKDEV_DIRECT) {
+        dev->mem_align = direct_alignment(dev->fd);
+    }
+    if (dev->fd == -1 || dev->mem_align == 0 ||
+        ftruncate(dev->fd, (off_t)(block_count * BLOCK_SIZE)) == -1) {
+        if (dev->fd != -1) {
+            close(dev->fd);
+        }
+        free(dev->batch);
+        free(dev->slot_of);
+        free(dev);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < block_count; i++) {
+        dev->slot_of[i] = -1;
+    }
+    pthread_mutex_init(&dev->mutex, NULL);
+    lockstat_register(&dev->mutex, sizeof(dev->mutex), LOCK_BLOCKDEV);
+    return dev;
+}
+
+/*
+ * Writes the staged blocks, in runs of consecutive blocks
+ * (dev->mutex must be held)
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int blockdev_submit(blockdev_t *dev) {
+    size_t order[BLOCKDEV_BATCH_BLOCKS];
+    void const *buffers[BLOCKDEV_BATCH_BLOCKS];
+    for (size_t i = 0; i < dev->staged; i++) {
+        order[i] = i;
+    }
+    /* Few enough to sort by insertion */
+    for (size_t i = 1; i < dev->staged; i++) {
+        size_t slot = order[i], j = i;
+        for (; j > 0 && dev->batch_blocks[order[j - 1]] >
+                            dev->batch_blocks[slot];
+             j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = slot;
+    }
+
+    int result = 0;
+    size_t run = 0;
+    for (size_t i = 0; i < dev->staged; i++) {
+        size_t slot = order[i];
+        buffers[i] = dev->batch + slot * BLOCK_SIZE;
+        dev->slot_of[dev->batch_blocks[slot]] = -1;
+        bool last = i + 1 == dev->staged ||
+                    dev->batch_blocks[order[i + 1]] !=
+                        dev->batch_blocks[slot] + 1;
+        if (last) {
+            if (dev->ops->write_blocks(dev, dev->batch_blocks[order[run]],
+                                       i + 1 - run, buffers + run) == -1) {
+                result = -1;
+            }
+            run = i + 1;
+        }
+    }
+    dev->staged = 0;
+    if (result == -1) {
+        dev->failed = true;
+    }
+    return result;
+}
+
+/*
+ * Reads consecutive blocks from the device
+ * Returns: 0 if successful, -1 otherwise
+ */
+int blockdev_read(blockdev_t *dev, size_t first, size_t count,
+                  void *buffer) {
+    if (first >= dev->block_count || count > dev->block_count - first) {
+        return -1;
+    }
+    return dev->ops->read_blocks(dev, first, count, buffer);
+}
+
+/*
+ * Stages a modified block to be written to the device (with the next
+ * batch); the block is copied, so the caller must hold whatever lock keeps
+ * it from being modified meanwhile
+ * Returns: 0 if successful, -1 otherwise
+ */
+int blockdev_stage(blockdev_t *dev, size_t block, void const *data) {
+    if (block >= dev->block_count) {
+        return -1;
+    }
+    int result = 0;
+    pthread_mutex_lock(&dev->mutex);
+    int slot = dev->slot_of[block];
+    if (slot == -1) {
+        if (dev->staged == BLOCKDEV_BATCH_BLOCKS) {
+            result = blockdev_submit(dev);
+        }
+        slot = (int)dev->staged++;
+        dev->slot_of[block] = slot;
+        dev->batch_blocks[slot] = block;
+    }
+    memcpy(dev->batch + (size_t)slot * BLOCK_SIZE, data, BLOCK_SIZE);
+    pthread_mutex_unlock(&dev->mutex);
+    return result;
+}
+
+/*
+ * Writes the staged blocks and waits until every block written is stable
+ * Returns: 0 if successful, -1 otherwise (also if an earlier batch failed)
+ */
+int blockdev_flush(blockdev_t *dev) {
+    pthread_mutex_lock(&dev->mutex);
+    int result = blockdev_submit(dev);
+    if (dev->ops->flush(dev) == -1 || dev->failed) {
+        result = -1;
+    }
+    dev->failed = false;
+    pthread_mutex_unlock(&dev->mutex);
+    return result;
+}
+
+/*
+ * Writes the staged blocks (without waiting for them to be stable) and
+ * closes the device
+ */
+void blockdev_close(blockdev_t *dev) {
+    pthread_mutex_lock(&dev->mutex);
+    blockdev_submit(dev);
+    pthread_mutex_unlock(&dev->mutex);
+
+    lockstat_unregister(&dev->mutex, sizeof(dev->mutex));
+    pthread_mutex_destroy(&dev->mutex);
+    close(dev->fd);
+    free(dev->batch);
+    free(dev->slot_of);
+    free(dev);
+}
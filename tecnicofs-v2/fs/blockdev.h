@@ -0,0 +1,48 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include <stddef.h>
+
+/*
+ * Block devices: where the data blocks of a FS instance are stored
+ *
+ * With BLOCKDEV_RAM (the default), the blocks live only in the in-memory
+ * data region, as they always did. With the other backends, the data region
+ * caches the blocks of a file: modified blocks are staged and written in
+ * batches, and blocks evicted from the cache are read back from the file.
+ * The file holds a new, empty volume each time (the FS metadata stays in
+ * memory), so a volume cannot be reopened.
+ */
+typedef enum {
+    BLOCKDEV_RAM,    /* blocks only in memory */
+    BLOCKDEV_FILE,   /* a file, through the page cache (pread/pwrite) */
+    BLOCKDEV_DIRECT, /* a file, bypassing the page cache (O_DIRECT) */
+} blockdev_type_t;
+
+typedef struct blockdev blockdev_t;
+
+/*
+ * Operations of a backend; block numbers are relative to the device, and
+ * each call reads or writes count consecutive blocks
+ * Return 0 if successful, -1 otherwise
+ */
+typedef struct {
+    /* Reads into a single buffer */
+    int (*read_blocks)(blockdev_t *dev, size_t first, size_t count,
+                       void *buffer);
+    /* Writes from one buffer per block */
+    int (*write_blocks)(blockdev_t *dev, size_t first, size_t count,
+                        void const *const *buffers);
+    /* Waits until the blocks written are stable */
+    int (*flush)(blockdev_t *dev);
+} blockdev_ops_t;
+
+blockdev_t *blockdev_open(blockdev_type_t type, char const *path,
+                          size_t block_count);
+void blockdev_close(blockdev_t *dev);
+int blockdev_read(blockdev_t *dev, size_t first, size_t count,
+                  void *buffer);
+int blockdev_stage(blockdev_t *dev, size_t block, void const *data);
+int blockdev_flush(blockdev_t *dev);
+
+#endif // BLOCKDEV_H
@@ -0,0 +1,504 @@
+#include "compress.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * LZ codec
+ *
+ * A small LZ77 codec in the style of LZ4. The compressed stream is a list of
+ * sequences, each made of:
+ *  - a token byte: literal length (high nibble) and match length - 4 (low
+ *    nibble); a nibble of 15 is followed by extra length bytes (a run of 255s
+ *    ended by a smaller byte)
+ *  - the literals
+ *  - the match offset (2 bytes, little endian)
+ * The last sequence has only literals and ends the stream.
+ */
+
+#define LZ_MIN_MATCH (4)
+#define LZ_HASH_BITS (12)
+#define LZ_MAX_OFFSET (65535)
+
+static uint32_t lz_read32(uint8_t const *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static size_t lz_hash(uint32_t v) {
+    return (size_t)((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+static uint8_t *lz_put_length(uint8_t *op, uint8_t const *oend, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op == oend) {
+            return NULL;
+        }
+        *op++ = 255;
+    }
+    if (op == oend) {
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static int lz_get_length(uint8_t const **ip, uint8_t const *iend,
+                         size_t *len) {
+    uint8_t byte;
+    do {
+        if (*ip == iend) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+/*
+ * Appends a sequence to the compressed stream
+ * (match_len is 0 for the last sequence, which has no match)
+ * Returns: the new end of the stream, NULL if it does not fit
+ */
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t const *oend,
+                                uint8_t const *literals, size_t lit_len,
+                                size_t offset, size_t match_len) {
+    size_t lit_nibble = lit_len < 15 ? lit_len : 15;
+    size_t match_nibble = 0;
+    if (match_len > 0) {
+        match_nibble = match_len - LZ_MIN_MATCH;
+        if (match_nibble > 15) {
+            match_nibble = 15;
+        }
+    }
+
+    if (op == oend) {
+        return NULL;
+    }
+    *op++ = (uint8_t)(lit_nibble << 4 | match_nibble);
+    if (lit_nibble == 15 &&
+        (op = lz_put_length(op, oend, lit_len - 15)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(oend - op) < lit_len) {
+        return NULL;
+    }
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+
+    if (match_len == 0) {
+        return op;
+    }
+    if (oend - op < 2) {
+        return NULL;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    if (match_nibble == 15) {
+        op = lz_put_length(op, oend, match_len - LZ_MIN_MATCH - 15);
+    }
+    return op;
+}
+
+/*
+ * Compresses a buffer
+ * Input:
+ *  - src, src_len: data to compress
+ *  - dst, dst_cap: destination buffer and its capacity
+ * Returns: size of the compressed data, 0 if it does not fit in dst
+ */
+size_t lz_compress(void const *src, size_t src_len, void *dst,
+                   size_t dst_cap) {
+    uint8_t const *base = src;
+    uint8_t const *ip = base, *anchor = base, *iend = base + src_len;
+    uint8_t *op = dst;
+    uint8_t const *oend = op + dst_cap;
+    int table[1 << LZ_HASH_BITS];
+
+    for (size_t i = 0; i < 1 << LZ_HASH_BITS; i++) {
+        table[i] = -1;
+    }
+
+    while (iend - ip >= LZ_MIN_MATCH) {
+        uint32_t seq = lz_read32(ip);
+        size_t h = lz_hash(seq);
+        int candidate = table[h];
+        table[h] = (int)(ip - base);
+
+        if (candidate == -1 || ip - (base + candidate) > LZ_MAX_OFFSET ||
+            lz_read32(base + candidate) != seq) {
+            ip++;
+            continue;
+        }
+
+        uint8_t const *match = base + candidate;
+        size_t match_len = LZ_MIN_MATCH;
+        while (ip + match_len < iend && match[match_len] == ip[match_len]) {
+            match_len++;
+        }
+        op = lz_put_sequence(op, oend, anchor, (size_t)(ip - anchor),
+                             (size_t)(ip - match), match_len);
+        if (op == NULL) {
+            return 0;
+        }
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = lz_put_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0);
+    if (op == NULL) {
+        return 0;
+    }
+    return (size_t)(op - (uint8_t *)dst);
+}
+
+/*
+ * Decompresses a buffer
+ * Input:
+ *  - src, src_len: compressed data
+ *  - dst, dst_cap: destination buffer and its capacity
+ * Returns: size of the decompressed data, -1 if the input is corrupted
+ */
+ssize_t lz_decompress(void const *src, size_t src_len, void *dst,
+                      size_t dst_cap) {
+    uint8_t const *ip = src, *iend = ip + src_len;
+    uint8_t *ostart = dst, *op = ostart;
+    uint8_t const *oend = ostart + dst_cap;
+
+    while (ip < iend) {
+        size_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && lz_get_length(&ip, iend, &lit_len) == -1) {
+            return -1;
+        }
+        if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len) {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == iend) {
+            return (ssize_t)(op - ostart);
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && lz_get_length(&ip, iend, &match_len) == -1) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - ostart) ||
+            (size_t)(oend - op) < match_len) {
+            return -1;
+        }
+        // the match may overlap the bytes being written, so copy bytewise
+        uint8_t const *match = op - offset;
+        for (size_t i = 0; i < match_len; i++) {
+            op[i] = match[i];
+        }
+        op += match_len;
+    }
+    return -1;
+}
+
+/*
+ * Compressed files
+ *
+ * The file is split in clusters of COMPRESS_CLUSTER_BLOCKS logical blocks,
+ * each using the same number of slots in the i-node's block map. A cluster
+ * is stored in the first slots as a 4-byte length followed by the compressed
+ * data, leaving the remaining slots unmapped. When compression does not save
+ * at least one block the cluster is stored raw, using all of its slots.
+ */
+
+typedef struct {
+    bool valid;
+    int inumber;
+    size_t cluster;
+    char data[CLUSTER_SIZE];
+} cluster_cache_entry_t;
+
+/* Cache of decompressed clusters (one per FS instance) */
+struct cluster_cache {
+    cluster_cache_entry_t entries[COMPRESS_CACHE_SIZE];
+    size_t next;
+    pthread_mutex_t mutex;
+};
+
+/*
+ * Creates the cluster cache of a FS instance
+ * Returns: 0 if successful, -1 otherwise
+ */
+int compressed_cache_init(tfs_ctx *fs) {
+    fs->cluster_cache = calloc(1, sizeof(struct cluster_cache));
+    if (fs->cluster_cache == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&fs->cluster_cache->mutex, NULL);
+    lockstat_register(&fs->cluster_cache->mutex, sizeof(pthread_mutex_t),
+                      LOCK_CLUSTER_CACHE);
+    return 0;
+}
+
+void compressed_cache_destroy(tfs_ctx *fs) {
+    if (fs->cluster_cache != NULL) {
+        lockstat_unregister(fs->cluster_cache, sizeof(struct cluster_cache));
+        pthread_mutex_destroy(&fs->cluster_cache->mutex);
+        free(fs->cluster_cache);
+        fs->cluster_cache = NULL;
+    }
+}
+
+/*
+ * Copies part of a cached cluster
+ * Returns: true if the cluster was cached, false otherwise
+ */
+static bool cluster_cache_read(tfs_ctx *fs, int inumber, size_t cluster,
+                               size_t offset, void *buffer, size_t len) {
+    pthread_mutex_lock(&fs->cluster_cache->mutex);
+    for (size_t i = 0; i < COMPRESS_CACHE_SIZE; i++) {
+        cluster_cache_entry_t *entry = &fs->cluster_cache->entries[i];
+        if (entry->valid && entry->inumber == inumber &&
+            entry->cluster == cluster) {
+            memcpy(buffer, entry->data + offset, len);
+            pthread_mutex_unlock(&fs->cluster_cache->mutex);
+            return true;
+        }
+    }
+    pthread_mutex_unlock(&fs->cluster_cache->mutex);
+    return false;
+}
+
+/*
+ * Stores a cluster in the cache, replacing its previous contents or, if
+ * it was not cached, the oldest entry
+ */
+static void cluster_cache_put(tfs_ctx *fs, int inumber, size_t cluster,
+                              void const *data) {
+    pthread_mutex_lock(&fs->cluster_cache->mutex);
+    cluster_cache_entry_t *entry = NULL;
+    for (size_t i = 0; i < COMPRESS_CACHE_SIZE; i++) {
+        if (fs->cluster_cache->entries[i].valid &&
+            fs->cluster_cache->entries[i].inumber == inumber &&
+            fs->cluster_cache->entries[i].cluster == cluster) {
+            entry = &fs->cluster_cache->entries[i];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        entry = &fs->cluster_cache->entries[fs->cluster_cache->next];
+        fs->cluster_cache->next =
+            (fs->cluster_cache->next + 1) % COMPRESS_CACHE_SIZE;
+    }
+    entry->valid = true;
+    entry->inumber = inumber;
+    entry->cluster = cluster;
+    memcpy(entry->data, data, CLUSTER_SIZE);
+    pthread_mutex_unlock(&fs->cluster_cache->mutex);
+}
+
+/*
+ * Drops all cached clusters of a file
+ * (must be called when the file is truncated or its i-node is reused)
+ */
+void compressed_cache_invalidate(tfs_ctx *fs, int inumber) {
+    pthread_mutex_lock(&fs->cluster_cache->mutex);
+    for (size_t i = 0; i < COMPRESS_CACHE_SIZE; i++) {
+        if (fs->cluster_cache->entries[i].inumber == inumber) {
+            fs->cluster_cache->entries[i].valid = false;
+        }
+    }
+    pthread_mutex_unlock(&fs->cluster_cache->mutex);
+}
+
+/*
+ * Reads and decompresses a cluster (a cluster that was never written reads
+ * as zeros)
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int cluster_load(tfs_ctx *fs, inode_t *inode, size_t cluster,
+                        char *data) {
+    char stream[CLUSTER_SIZE];
+    size_t n_blocks = 0;
+
+    for (; n_blocks < COMPRESS_CLUSTER_BLOCKS; n_blocks++) {
+        int b = inode_block_get(
+            fs, inode, cluster * COMPRESS_CLUSTER_BLOCKS + n_blocks, false);
+        if (b == -1) {
+            break;
+        }
+        void *block = data_block_get(fs, b);
+        if (block == NULL || data_block_verify(fs, b) == -1) {
+            return -1;
+        }
+        memcpy(stream + n_blocks * BLOCK_SIZE, block, BLOCK_SIZE);
+    }
+
+    if (n_blocks == 0) {
+        memset(data, 0, CLUSTER_SIZE);
+        return 0;
+    }
+    if (n_blocks == COMPRESS_CLUSTER_BLOCKS) {
+        memcpy(data, stream, CLUSTER_SIZE);
+        return 0;
+    }
+
+    uint32_t len;
+    memcpy(&len, stream, sizeof(len));
+    if (len > n_blocks * BLOCK_SIZE - sizeof(len) ||
+        lz_decompress(stream + sizeof(len), len, data, CLUSTER_SIZE) !=
+            CLUSTER_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Compresses and writes a cluster to newly allocated blocks, then frees the
+ * blocks holding its previous contents
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int cluster_store(tfs_ctx *fs, inode_t *inode, size_t cluster,
+                         char const *data) {
+    char stream[CLUSTER_SIZE];
+    char const *src = data;
+    size_t len = CLUSTER_SIZE;
+    size_t n_blocks = COMPRESS_CLUSTER_BLOCKS;
+    size_t first = cluster * COMPRESS_CLUSTER_BLOCKS;
+    size_t last = first + COMPRESS_CLUSTER_BLOCKS - 1;
+    int blocks[COMPRESS_CLUSTER_BLOCKS];
+
+    /* Only keeps the compressed form if it saves at least one block */
+    uint32_t header = (uint32_t)lz_compress(
+        data, CLUSTER_SIZE, stream + sizeof(header),
+        CLUSTER_SIZE - BLOCK_SIZE - sizeof(header));
+    if (header > 0) {
+        memcpy(stream, &header, sizeof(header));
+        src = stream;
+        len = header + sizeof(header);
+        n_blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+
+    /* Makes sure the indirect block exists, so that updating the block map
+     * below cannot fail halfway */
+    if (last >= DIRECT_BLOCKS &&
+        inode_block_set(fs, inode, last,
+                        inode_block_get(fs, inode, last, false)) == -1) {
+        return -1;
+    }
+
+    if (data_blocks_alloc_batch(fs, blocks, n_blocks) == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i < n_blocks; i++) {
+        void *block = data_block_get(fs, blocks[i]);
+        size_t n = len - i * BLOCK_SIZE;
+        memcpy(block, src + i * BLOCK_SIZE, n < BLOCK_SIZE ? n : BLOCK_SIZE);
+        data_block_seal(fs, blocks[i]);
+    }
+
+    int old_blocks[COMPRESS_CLUSTER_BLOCKS];
+    size_t n_old = 0;
+    for (size_t i = 0; i < COMPRESS_CLUSTER_BLOCKS; i++) {
+        int old = inode_block_get(fs, inode, first + i, false);
+        int new = i < n_blocks ? blocks[i] : -1;
+        if (old != -1 || new != -1) {
+            inode_block_set(fs, inode, first + i, new);
+        }
+        if (old != -1) {
+            old_blocks[n_old++] = old;
+        }
+    }
+    return data_blocks_free_batch(fs, old_blocks, n_old);
+}
+
+/*
+ * Writes to a compressed file
+ * The caller must hold the i-node's lock for writing.
+ * Input:
+ *  - inumber, inode: the file
+ *  - offset: position in the file where the write starts
+ *  - buffer, len: the data to write
+ * Returns: the number of bytes written, -1 if nothing could be written
+ */
+ssize_t compressed_write(tfs_ctx *fs, int inumber, inode_t *inode,
+                         size_t offset, void const *buffer, size_t len) {
+    char data[CLUSTER_SIZE];
+    size_t written = 0;
+
+    while (written < len) {
+        size_t cluster = (offset + written) / CLUSTER_SIZE;
+        size_t cluster_offset = (offset + written) % CLUSTER_SIZE;
+        size_t n = CLUSTER_SIZE - cluster_offset;
+        if (n > len - written) {
+            n = len - written;
+        }
+
+        /* Clusters that are fully overwritten need not be loaded */
+        if (n < CLUSTER_SIZE &&
+            !cluster_cache_read(fs, inumber, cluster, 0, data, CLUSTER_SIZE) &&
+            cluster_load(fs, inode, cluster, data) == -1) {
+            break;
+        }
+        memcpy(data + cluster_offset, (char const *)buffer + written, n);
+        if (cluster_store(fs, inode, cluster, data) == -1) {
+            break;
+        }
+        cluster_cache_put(fs, inumber, cluster, data);
+        written += n;
+    }
+
+    if (written == 0 && len > 0) {
+        return -1;
+    }
+    return (ssize_t)written;
+}
+
+/*
+ * Reads from a compressed file
+ * The caller must hold the i-node's lock.
+ * Input:
+ *  - inumber, inode: the file
+ *  - offset: position in the file where the read starts
+ *  - buffer, len: the destination buffer and the number of bytes to read
+ * Returns: the number of bytes read, -1 if nothing could be read
+ */
+ssize_t compressed_read(tfs_ctx *fs, int inumber, inode_t *inode, size_t offset,
+                        void *buffer, size_t len) {
+    char data[CLUSTER_SIZE];
+    size_t read = 0;
+
+    while (read < len) {
+        size_t cluster = (offset + read) / CLUSTER_SIZE;
+        size_t cluster_offset = (offset + read) % CLUSTER_SIZE;
+        size_t n = CLUSTER_SIZE - cluster_offset;
+        if (n > len - read) {
+            n = len - read;
+        }
+
+        if (!cluster_cache_read(fs, inumber, cluster, cluster_offset,
+                                (char *)buffer + read, n)) {
+            if (cluster_load(fs, inode, cluster, data) == -1) {
+                break;
+            }
+            cluster_cache_put(fs, inumber, cluster, data);
+            memcpy((char *)buffer + read, data + cluster_offset, n);
+        }
+        read += n;
+    }
+
+    if (read == 0 && len > 0) {
+        return -1;
+    }
+    return (ssize_t)read;
+}
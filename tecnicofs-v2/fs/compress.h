@@ -0,0 +1,27 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "config.h"
+#include "state.h"
+
+#include <sys/types.h>
+
+#define CLUSTER_SIZE (COMPRESS_CLUSTER_BLOCKS * BLOCK_SIZE)
+
+/* Largest file size (in blocks) of a compressed file */
+#define MAX_COMPRESSED_FILE_BLOCKS                                             \
+    (MAX_FILE_BLOCKS / COMPRESS_CLUSTER_BLOCKS * COMPRESS_CLUSTER_BLOCKS)
+
+size_t lz_compress(void const *src, size_t src_len, void *dst, size_t dst_cap);
+ssize_t lz_decompress(void const *src, size_t src_len, void *dst,
+                      size_t dst_cap);
+
+int compressed_cache_init(tfs_ctx *fs);
+void compressed_cache_destroy(tfs_ctx *fs);
+ssize_t compressed_write(tfs_ctx *fs, int inumber, inode_t *inode,
+                         size_t offset, void const *buffer, size_t len);
+ssize_t compressed_read(tfs_ctx *fs, int inumber, inode_t *inode,
+                        size_t offset, void *buffer, size_t len);
+void compressed_cache_invalidate(tfs_ctx *fs, int inumber);
+
+#endif // COMPRESS_H
@@ -5,12 +5,66 @@
 #define ROOT_DIR_INUM (0)
 
 #define BLOCK_SIZE (1024)
+/* Default capacity of the data region (see tfs_params) */
 #define DATA_BLOCKS (1024)
-#define INODE_TABLE_SIZE (50)
+/* The data region is mapped in chunks of this size (a huge page), as its
+ * blocks are first allocated */
+#define DATA_CHUNK_SIZE (2 * 1024 * 1024)
+#define CHUNK_BLOCKS (DATA_CHUNK_SIZE / BLOCK_SIZE)
+/* Default capacity of the i-node table (see tfs_params) */
+#define INODE_TABLE_SIZE (1 << 20)
+/* The i-node table is allocated in chunks of this many i-nodes, as they are
+ * first created */
+#define INODE_CHUNK_INODES (256)
 #define MAX_OPEN_FILES (20)
 #define MAX_FILE_NAME (40)
 #define DIRECT_BLOCKS (10)
 #define INDIRECT_BLOCKS (BLOCK_SIZE / sizeof(int))
+#define MAX_FILE_BLOCKS (DIRECT_BLOCKS + INDIRECT_BLOCKS)
+
+/* Compressed files are stored in clusters of this many logical blocks */
+#define COMPRESS_CLUSTER_BLOCKS (4)
+/* Number of decompressed clusters kept in memory */
+#define COMPRESS_CACHE_SIZE (8)
+
+/* With VERIFY_SAMPLED, one in this many block reads is verified */
+#define VERIFY_SAMPLE_RATE (16)
+
+/* Blocks copied by tfs_copy_range while holding the i-nodes' locks */
+#define COPY_BATCH_BLOCKS (64)
+
+/* tfs_copy_from_external_fs splits a file among up to this many threads,
+ * giving each at least IMPORT_MIN_BLOCKS blocks */
+#define IMPORT_THREADS (4)
+#define IMPORT_MIN_BLOCKS (32)
+
+/* With the parallel copy mode (see tfs_set_parallel_copy), large reads and
+ * writes split their block copies among up to this many threads, the
+ * caller included */
+#define COPY_POOL_THREADS (8)
+
+/* Modified blocks are written to a block device in batches of up to this
+ * many (see blockdev.c) */
+#define BLOCKDEV_BATCH_BLOCKS (64)
+/* Blocks read back from a block device are loaded in aligned groups of up
+ * to this many (a power of 2), holding one of DATA_LOAD_STRIPES locks,
+ * picked by group */
+#define DATA_LOAD_BLOCKS (16)
+#define DATA_LOAD_STRIPES (16)
+
+/* A write that finds its file's i-node locked publishes itself for the
+ * lock holder to apply, and retries the lock this many times (yielding in
+ * between) before blocking on it; a lock holder applies at most this many
+ * batches of published writes */
+#define WRITE_COMBINE_SPINS (32)
+#define WRITE_COMBINE_ROUNDS (4)
+
+/* Number of reader slots of an RCU domain (see rcu.h); threads beyond
+ * this many share slots */
+#define RCU_SLOTS (16)
+
+/* Size of a CPU cache line; structures shared by threads are aligned to it */
+#define CACHE_LINE_SIZE (64)
 
 #define DELAY (5000)
 
@@ -0,0 +1,163 @@
+#include "copy_pool.h"
+#include "lockstat.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* A job being run (it lives on the stack of the thread that submitted it,
+ * which only returns once all of its parts are done) */
+typedef struct copy_job {
+    struct copy_job *next;
+    copy_part_fn fn;
+    void *arg;
+    size_t parts;
+    size_t claimed; /* parts handed out */
+    size_t done;    /* parts finished */
+} copy_job_t;
+
+struct copy_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;     /* signaled when parts are queued */
+    pthread_cond_t finished; /* signaled when a job is done */
+    /* Jobs with parts left to hand out, in the order they were submitted */
+    copy_job_t *head;
+    copy_job_t *tail;
+    bool stop;
+    size_t worker_count;
+    pthread_t workers[];
+};
+
+/*
+ * Hands out the next part of the first queued job, which leaves the queue
+ * once all of its parts are handed out
+ * (pool->mutex must be held, and some job must be queued)
+ */
+static copy_job_t *claim_part(copy_pool_t *pool, size_t *part) {
+    copy_job_t *job = pool->head;
+    *part = job->claimed++;
+    if (job->claimed == job->parts) {
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+    }
+    return job;
+}
+
+/*
+ * Runs a part of a job, releasing pool->mutex meanwhile
+ * (pool->mutex must be held)
+ */
+static void run_part(copy_pool_t *pool, copy_job_t *job, size_t part) {
+    pthread_mutex_unlock(&pool->mutex);
+    job->fn(job->arg, part);
+    pthread_mutex_lock(&pool->mutex);
+    if (++job->done == job->parts) {
+        pthread_cond_broadcast(&pool->finished);
+    }
+}
+
+static void *worker_run(void *arg) {
+    copy_pool_t *pool = arg;
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->head == NULL && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (pool->head == NULL) {
+            break;
+        }
+        size_t part;
+        copy_job_t *job = claim_part(pool, &part);
+        run_part(pool, job, part);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+/*
+ * Creates a pool and starts its workers (if some cannot be started, the
+ * pool runs with fewer)
+ * Input:
+ *  - workers: number of worker threads
+ * Returns: the pool if successful, NULL otherwise
+ */
+copy_pool_t *copy_pool_create(size_t workers) {
+    copy_pool_t *pool =
+        calloc(1, sizeof(copy_pool_t) + workers * sizeof(pthread_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    lockstat_register(&pool->mutex, sizeof(pool->mutex), LOCK_COPY_POOL);
+
+    for (; pool->worker_count < workers; pool->worker_count++) {
+        if (pthread_create(&pool->workers[pool->worker_count], NULL,
+                           worker_run, pool) != 0) {
+            break;
+        }
+    }
+    return pool;
+}
+
+/*
+ * Stops the workers of a pool (no job may be running) and frees it
+ */
+void copy_pool_destroy(copy_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    for (size_t i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    lockstat_unregister(&pool->mutex, sizeof(pool->mutex));
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->finished);
+    free(pool);
+}
+
+/*
+ * Runs a job, taking part in it (and in the jobs queued before it) until
+ * all of its parts are handed out, then waiting for them to be done
+ * Input:
+ *  - fn: runs a part, given arg and the part's number
+ *  - parts: number of parts
+ */
+void copy_pool_run(copy_pool_t *pool, copy_part_fn fn, void *arg,
+                   size_t parts) {
+    if (parts == 0) {
+        return;
+    }
+    copy_job_t job = {.next = NULL, .fn = fn, .arg = arg, .parts = parts};
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tail == NULL) {
+        pool->head = &job;
+    } else {
+        pool->tail->next = &job;
+    }
+    pool->tail = &job;
+    /* The caller takes at least one part itself */
+    for (size_t i = 1; i < parts && i <= pool->worker_count; i++) {
+        pthread_cond_signal(&pool->work);
+    }
+
+    while (job.claimed < job.parts) {
+        size_t part;
+        copy_job_t *claimed = claim_part(pool, &part);
+        run_part(pool, claimed, part);
+    }
+    while (job.done < job.parts) {
+        pthread_cond_wait(&pool->finished, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
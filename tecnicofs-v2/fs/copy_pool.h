@@ -0,0 +1,25 @@
+#ifndef COPY_POOL_H
+#define COPY_POOL_H
+
+#include <stddef.h>
+
+/*
+ * Pool of worker threads that run the parts of a job (e.g., the block
+ * copies of a large read or write) along with the thread that submits it
+ *
+ * A job is split in parts numbered from 0, which are handed out one at a
+ * time, in the order jobs were submitted, to idle workers and to the
+ * submitting thread; it returns once every part of its job is done.
+ */
+
+typedef struct copy_pool copy_pool_t;
+
+/* Runs one part of a job */
+typedef void (*copy_part_fn)(void *arg, size_t part);
+
+copy_pool_t *copy_pool_create(size_t workers);
+void copy_pool_destroy(copy_pool_t *pool);
+void copy_pool_run(copy_pool_t *pool, copy_part_fn fn, void *arg,
+                   size_t parts);
+
+#endif // COPY_POOL_H
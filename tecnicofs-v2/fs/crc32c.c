@@ -0,0 +1,71 @@
+#include "crc32c.h"
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/* CRC32C (Castagnoli) polynomial, bit-reflected */
+#define CRC32C_POLY (0x82F63B78u)
+
+static uint32_t crc32c_table[256];
+static uint32_t (*crc32c_update)(uint32_t crc, void const *data, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/* Portable version, one byte at a time */
+static uint32_t crc32c_update_sw(uint32_t crc, void const *data, size_t len) {
+    unsigned char const *p = data;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32c_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/* SSE4.2 version, using the crc32 instruction on 8 bytes at a time */
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_update_hw(uint32_t crc, void const *data, size_t len) {
+    unsigned char const *p = data;
+    uint64_t crc64 = crc;
+    for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += sizeof(word);
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static void crc32c_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[i] = crc;
+    }
+
+    crc32c_update = crc32c_update_sw;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_update = crc32c_update_hw;
+    }
+#endif
+}
+
+/*
+ * Computes the CRC32C of a buffer, using the CPU's crc32 instruction when
+ * it is available
+ */
+uint32_t crc32c(void const *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_update(~0u, data, len);
+}
@@ -0,0 +1,9 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(void const *data, size_t len);
+
+#endif // CRC32C_H
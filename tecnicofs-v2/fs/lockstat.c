@@ -0,0 +1,358 @@
+#define LOCKSTAT_IMPL
+#include "lockstat.h"
+#include "config.h"
+
+#ifdef TFS_LOCKSTAT
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Histogram buckets: bucket i counts times in [2^i, 2^(i+1)) ns */
+#define LOCKSTAT_BUCKETS (40)
+/* Registered lock ranges (a few per FS instance) */
+#define LOCKSTAT_RANGES (256)
+/* Locks a thread can hold at once and still have their hold time timed */
+#define LOCKSTAT_MAX_HELD (16)
+
+static char const *const class_names[LOCK_CLASSES] = {
+    [LOCK_INODE] = "inode.rwlock",
+    [LOCK_INODE_TABLE] = "inode_table.mutex",
+    [LOCK_FREEINODE_TS] = "freeinode_ts.mutex",
+    [LOCK_FREE_BLOCKS] = "free_blocks.mutex",
+    [LOCK_OPEN_FILE] = "open_file_entry.mutex",
+    [LOCK_OPEN_FILE_TABLE] = "open_file_table.mutex",
+    [LOCK_FREE_OPEN_FILE_ENTRIES] = "free_open_file_entries.mutex",
+    [LOCK_RECLAIM_QUEUE] = "reclaim_queue.mutex",
+    [LOCK_SCRUBBER] = "scrubber.mutex",
+    [LOCK_DEFRAGMENTER] = "defragmenter.mutex",
+    [LOCK_APPEND] = "append_mutex",
+    [LOCK_CLUSTER_CACHE] = "cluster_cache.mutex",
+    [LOCK_BLOCKDEV] = "blockdev.mutex",
+    [LOCK_DATA_LOAD] = "fs_data.load_mutexes",
+    [LOCK_RCU] = "rcu.mutex",
+    [LOCK_COPY_POOL] = "copy_pool.mutex",
+};
+
+/* Statistics of a lock class (each on its own cache line, as they are
+ * updated by every thread that takes one of its locks) */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t acquires;
+    _Atomic uint64_t contended;
+    _Atomic uint64_t wait_ns;
+    _Atomic uint64_t hold_ns;
+    _Atomic uint64_t wait_hist[LOCKSTAT_BUCKETS];
+    _Atomic uint64_t hold_hist[LOCKSTAT_BUCKETS];
+} lock_stats_t;
+
+/* Memory holding locks of a class (a lock or an array of them); a free
+ * range has end 0 */
+typedef struct {
+    _Atomic uintptr_t start;
+    _Atomic uintptr_t end;
+    _Atomic int class;
+} lock_range_t;
+
+/* A lock held by the current thread */
+typedef struct {
+    void const *lock;
+    lock_class_t class;
+    uint64_t since;
+} held_lock_t;
+
+static lock_stats_t stats[LOCK_CLASSES];
+static lock_range_t ranges[LOCKSTAT_RANGES];
+static _Atomic size_t range_count;
+static pthread_mutex_t ranges_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local held_lock_t held[LOCKSTAT_MAX_HELD];
+static _Thread_local size_t held_count;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static size_t bucket(uint64_t ns) {
+    size_t b = 0;
+    while (ns > 1 && b < LOCKSTAT_BUCKETS - 1) {
+        ns >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/*
+ * Registers the locks in a range of memory as belonging to a class
+ */
+void lockstat_register(void const *start, size_t size, lock_class_t class) {
+    pthread_mutex_lock(&ranges_mutex);
+    size_t count = atomic_load(&range_count);
+    size_t i = 0;
+    while (i < count && atomic_load(&ranges[i].end) != 0) {
+        i++;
+    }
+    if (i < LOCKSTAT_RANGES) {
+        atomic_store(&ranges[i].class, (int)class);
+        atomic_store(&ranges[i].start, (uintptr_t)start);
+        atomic_store(&ranges[i].end, (uintptr_t)start + size);
+        if (i == count) {
+            atomic_store(&range_count, count + 1);
+        }
+    }
+    pthread_mutex_unlock(&ranges_mutex);
+}
+
+/*
+ * Unregisters the ranges of locks inside a range of memory (e.g., of an
+ * FS instance that is destroyed)
+ */
+void lockstat_unregister(void const *start, size_t size) {
+    pthread_mutex_lock(&ranges_mutex);
+    size_t count = atomic_load(&range_count);
+    for (size_t i = 0; i < count; i++) {
+        uintptr_t range_start = atomic_load(&ranges[i].start);
+        if (range_start >= (uintptr_t)start &&
+            range_start < (uintptr_t)start + size) {
+            atomic_store(&ranges[i].end, 0);
+        }
+    }
+    pthread_mutex_unlock(&ranges_mutex);
+}
+
+/*
+ * Returns the class of a lock, LOCK_CLASSES if it is not registered
+ */
+static lock_class_t lock_class(void const *lock) {
+    uintptr_t address = (uintptr_t)lock;
+    size_t count = atomic_load_explicit(&range_count, memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        if (address >= atomic_load_explicit(&ranges[i].start,
+                                             memory_order_relaxed) &&
+            address <
+                atomic_load_explicit(&ranges[i].end, memory_order_relaxed)) {
+            return (lock_class_t)atomic_load_explicit(&ranges[i].class,
+                                                      memory_order_relaxed);
+        }
+    }
+    return LOCK_CLASSES;
+}
+
+static void record_hold(void const *lock, lock_class_t class) {
+    if (held_count < LOCKSTAT_MAX_HELD) {
+        held[held_count++] =
+            (held_lock_t){.lock = lock, .class = class, .since = now_ns()};
+    }
+}
+
+static void record_acquire(void const *lock, lock_class_t class,
+                           bool contended, uint64_t wait) {
+    lock_stats_t *s = &stats[class];
+    atomic_fetch_add_explicit(&s->acquires, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&s->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&s->wait_ns, wait, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&s->wait_hist[bucket(wait)], 1,
+                              memory_order_relaxed);
+    record_hold(lock, class);
+}
+
+static void record_release(void const *lock) {
+    /* Locks are usually released in the reverse order they were taken */
+    for (size_t i = held_count; i-- > 0;) {
+        if (held[i].lock == lock) {
+            uint64_t hold = now_ns() - held[i].since;
+            lock_stats_t *s = &stats[held[i].class];
+            atomic_fetch_add_explicit(&s->hold_ns, hold, memory_order_relaxed);
+            atomic_fetch_add_explicit(&s->hold_hist[bucket(hold)], 1,
+                                      memory_order_relaxed);
+            held[i] = held[--held_count];
+            return;
+        }
+    }
+}
+
+int lockstat_mutex_lock(pthread_mutex_t *mutex) {
+    lock_class_t class = lock_class(mutex);
+    if (class == LOCK_CLASSES) {
+        return pthread_mutex_lock(mutex);
+    }
+
+    int result = pthread_mutex_trylock(mutex);
+    bool contended = result == EBUSY;
+    uint64_t wait = 0;
+    if (contended) {
+        uint64_t start = now_ns();
+        result = pthread_mutex_lock(mutex);
+        wait = now_ns() - start;
+    }
+    if (result == 0) {
+        record_acquire(mutex, class, contended, wait);
+    }
+    return result;
+}
+
+int lockstat_mutex_unlock(pthread_mutex_t *mutex) {
+    record_release(mutex);
+    return pthread_mutex_unlock(mutex);
+}
+
+int lockstat_rwlock_rdlock(pthread_rwlock_t *rwlock) {
+    lock_class_t class = lock_class(rwlock);
+    if (class == LOCK_CLASSES) {
+        return pthread_rwlock_rdlock(rwlock);
+    }
+
+    int result = pthread_rwlock_tryrdlock(rwlock);
+    bool contended = result == EBUSY;
+    uint64_t wait = 0;
+    if (contended) {
+        uint64_t start = now_ns();
+        result = pthread_rwlock_rdlock(rwlock);
+        wait = now_ns() - start;
+    }
+    if (result == 0) {
+        record_acquire(rwlock, class, contended, wait);
+    }
+    return result;
+}
+
+int lockstat_rwlock_wrlock(pthread_rwlock_t *rwlock) {
+    lock_class_t class = lock_class(rwlock);
+    if (class == LOCK_CLASSES) {
+        return pthread_rwlock_wrlock(rwlock);
+    }
+
+    int result = pthread_rwlock_trywrlock(rwlock);
+    bool contended = result == EBUSY;
+    uint64_t wait = 0;
+    if (contended) {
+        uint64_t start = now_ns();
+        result = pthread_rwlock_wrlock(rwlock);
+        wait = now_ns() - start;
+    }
+    if (result == 0) {
+        record_acquire(rwlock, class, contended, wait);
+    }
+    return result;
+}
+
+/* Failed attempts are not waits, so only the acquisitions are counted */
+int lockstat_rwlock_trywrlock(pthread_rwlock_t *rwlock) {
+    int result = pthread_rwlock_trywrlock(rwlock);
+    lock_class_t class = lock_class(rwlock);
+    if (result == 0 && class != LOCK_CLASSES) {
+        record_acquire(rwlock, class, false, 0);
+    }
+    return result;
+}
+
+int lockstat_rwlock_unlock(pthread_rwlock_t *rwlock) {
+    record_release(rwlock);
+    return pthread_rwlock_unlock(rwlock);
+}
+
+/* Waiting on a condition variable releases the mutex, so the wait is not
+ * counted as holding it (nor as contention: it is not waiting for it) */
+int lockstat_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    record_release(mutex);
+    int result = pthread_cond_wait(cond, mutex);
+    lock_class_t class = lock_class(mutex);
+    if (class != LOCK_CLASSES) {
+        record_hold(mutex, class);
+    }
+    return result;
+}
+
+int lockstat_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                            struct timespec const *abstime) {
+    record_release(mutex);
+    int result = pthread_cond_timedwait(cond, mutex, abstime);
+    lock_class_t class = lock_class(mutex);
+    if (class != LOCK_CLASSES) {
+        record_hold(mutex, class);
+    }
+    return result;
+}
+
+static void dump_histogram(FILE *out, char const *name,
+                           _Atomic uint64_t const *hist) {
+    fprintf(out, "    %s:", name);
+    for (size_t b = 0; b < LOCKSTAT_BUCKETS; b++) {
+        uint64_t count = atomic_load(&hist[b]);
+        if (count > 0) {
+            fprintf(out, " <%lluns:%llu", 2ull << b,
+                    (unsigned long long)count);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+/*
+ * Prints the statistics of every lock class taken so far, sorted by the
+ * total time spent waiting for it
+ * Returns: 0 if successful, -1 otherwise
+ */
+int lockstat_dump(FILE *out) {
+    lock_class_t order[LOCK_CLASSES];
+    for (size_t i = 0; i < LOCK_CLASSES; i++) {
+        order[i] = (lock_class_t)i;
+        for (size_t j = i; j > 0 && atomic_load(&stats[order[j]].wait_ns) >
+                                        atomic_load(&stats[order[j - 1]].wait_ns);
+             j--) {
+            lock_class_t tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+    }
+
+    fprintf(out, "%-29s %12s %12s %14s %14s\n", "lock class", "acquires",
+            "contended", "wait (ns)", "hold (ns)");
+    for (size_t i = 0; i < LOCK_CLASSES; i++) {
+        lock_stats_t *s = &stats[order[i]];
+        uint64_t acquires = atomic_load(&s->acquires);
+        if (acquires == 0) {
+            continue;
+        }
+        fprintf(out, "%-29s %12llu %12llu %14llu %14llu\n",
+                class_names[order[i]], (unsigned long long)acquires,
+                (unsigned long long)atomic_load(&s->contended),
+                (unsigned long long)atomic_load(&s->wait_ns),
+                (unsigned long long)atomic_load(&s->hold_ns));
+        dump_histogram(out, "wait", s->wait_hist);
+        dump_histogram(out, "hold", s->hold_hist);
+    }
+    return fflush(out) == 0 ? 0 : -1;
+}
+
+/*
+ * Clears the statistics (e.g., between the phases of a workload)
+ */
+void lockstat_reset() {
+    for (size_t i = 0; i < LOCK_CLASSES; i++) {
+        lock_stats_t *s = &stats[i];
+        atomic_store(&s->acquires, 0);
+        atomic_store(&s->contended, 0);
+        atomic_store(&s->wait_ns, 0);
+        atomic_store(&s->hold_ns, 0);
+        for (size_t b = 0; b < LOCKSTAT_BUCKETS; b++) {
+            atomic_store(&s->wait_hist[b], 0);
+            atomic_store(&s->hold_hist[b], 0);
+        }
+    }
+}
+
+#else
+
+int lockstat_dump(FILE *out) {
+    (void)out;
+    return -1;
+}
+
+void lockstat_reset() {}
+
+#endif // TFS_LOCKSTAT
@@ -0,0 +1,84 @@
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Lock contention profiling (built with make LOCKSTAT=yes)
+ *
+ * The locks of the FS state are registered by class; in the profiling
+ * build, locking any of them records whether it was contended, how long
+ * it waited for and how long it was held.
+ */
+
+typedef enum {
+    LOCK_INODE,
+    LOCK_INODE_TABLE,
+    LOCK_FREEINODE_TS,
+    LOCK_FREE_BLOCKS,
+    LOCK_OPEN_FILE,
+    LOCK_OPEN_FILE_TABLE,
+    LOCK_FREE_OPEN_FILE_ENTRIES,
+    LOCK_RECLAIM_QUEUE,
+    LOCK_SCRUBBER,
+    LOCK_DEFRAGMENTER,
+    LOCK_APPEND,
+    LOCK_CLUSTER_CACHE,
+    LOCK_BLOCKDEV,
+    LOCK_DATA_LOAD,
+    LOCK_RCU,
+    LOCK_COPY_POOL,
+    LOCK_CLASSES
+} lock_class_t;
+
+int lockstat_dump(FILE *out);
+void lockstat_reset();
+
+#ifdef TFS_LOCKSTAT
+
+void lockstat_register(void const *start, size_t size, lock_class_t class);
+void lockstat_unregister(void const *start, size_t size);
+
+int lockstat_mutex_lock(pthread_mutex_t *mutex);
+int lockstat_mutex_unlock(pthread_mutex_t *mutex);
+int lockstat_rwlock_rdlock(pthread_rwlock_t *rwlock);
+int lockstat_rwlock_wrlock(pthread_rwlock_t *rwlock);
+int lockstat_rwlock_trywrlock(pthread_rwlock_t *rwlock);
+int lockstat_rwlock_unlock(pthread_rwlock_t *rwlock);
+int lockstat_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int lockstat_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                            struct timespec const *abstime);
+
+/* Every lock operation goes through the profiler (except in the profiler
+ * itself), which passes those on unregistered locks straight through */
+#ifndef LOCKSTAT_IMPL
+#define pthread_mutex_lock(mutex) lockstat_mutex_lock(mutex)
+#define pthread_mutex_unlock(mutex) lockstat_mutex_unlock(mutex)
+#define pthread_rwlock_rdlock(rwlock) lockstat_rwlock_rdlock(rwlock)
+#define pthread_rwlock_wrlock(rwlock) lockstat_rwlock_wrlock(rwlock)
+#define pthread_rwlock_trywrlock(rwlock) lockstat_rwlock_trywrlock(rwlock)
+#define pthread_rwlock_unlock(rwlock) lockstat_rwlock_unlock(rwlock)
+#define pthread_cond_wait(cond, mutex) lockstat_cond_wait(cond, mutex)
+#define pthread_cond_timedwait(cond, mutex, abstime)                          \
+    lockstat_cond_timedwait(cond, mutex, abstime)
+#endif
+
+#else
+
+static inline void lockstat_register(void const *start, size_t size,
+                                     lock_class_t class) {
+    (void)start;
+    (void)size;
+    (void)class;
+}
+
+static inline void lockstat_unregister(void const *start, size_t size) {
+    (void)start;
+    (void)size;
+}
+
+#endif // TFS_LOCKSTAT
+
+#endif // LOCKSTAT_H
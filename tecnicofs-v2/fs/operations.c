@@ -1,24 +1,67 @@
 #include "operations.h"
+#include "compress.h"
+#include "copy_pool.h"
+#include "trace.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+tfs_params tfs_default_params() {
+    tfs_params params = {
+        .max_block_count = DATA_BLOCKS,
+        .max_inode_count = INODE_TABLE_SIZE,
+        .device = BLOCKDEV_RAM,
+        .device_path = NULL,
+    };
+    return params;
+}
 
-int tfs_init() {
-    state_init();
+tfs_ctx *tfs_init(tfs_params const *params_ptr) {
+    tfs_params params;
+    if (params_ptr != NULL) {
+        params = *params_ptr;
+    } else {
+        params = tfs_default_params();
+    }
+
+    tfs_ctx *fs = state_init(params);
+    if (fs == NULL) {
+        return NULL;
+    }
+    if (compressed_cache_init(fs) == -1) {
+        state_destroy(fs);
+        return NULL;
+    }
 
     /* create root inode */
-    int root = inode_create(T_DIRECTORY);
+    int root = inode_create(fs, T_DIRECTORY);
     if (root != ROOT_DIR_INUM) {
-        return -1;
+        tfs_destroy(fs);
+        return NULL;
     }
 
-    return 0;
+    return fs;
 }
 
-int tfs_destroy() {
-    state_destroy();
+int tfs_destroy(tfs_ctx *fs) {
+    if (fs == NULL) {
+        return -1;
+    }
+    trace_stop(fs);
+    compressed_cache_destroy(fs);
+    copy_pool_destroy(atomic_load(&fs->copy_pool));
+    state_destroy(fs);
+#ifdef TFS_LOCKSTAT
+    lockstat_dump(stderr);
+#endif
     return 0;
 }
 
@@ -27,7 +70,7 @@ static bool valid_pathname(char const *name) {
 }
 
 
-int tfs_lookup(char const *name) {
+static int lookup_file(tfs_ctx *fs, char const *name) {
     if (!valid_pathname(name)) {
         return -1;
     }
@@ -35,10 +78,40 @@ int tfs_lookup(char const *name) {
     // skip the initial '/' character
     name++;
 
-    return find_in_dir(ROOT_DIR_INUM, name);
+    return find_in_dir(fs, ROOT_DIR_INUM, name);
+}
+
+int tfs_lookup(tfs_ctx *fs, char const *name) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = lookup_file(fs, name);
+    trace_end(fs, &call, TRACE_LOOKUP, &(trace_args_t){.path = {name}},
+              result);
+    return result;
+}
+
+static ssize_t list_dir(tfs_ctx *fs, char const *dir, size_t *cursor,
+                        dir_entry_t *entries, size_t n) {
+    /* Only the root directory exists */
+    if (dir == NULL || strcmp(dir, "/") != 0 || cursor == NULL) {
+        return -1;
+    }
+
+    return read_dir_entries(fs, ROOT_DIR_INUM, cursor, entries, n);
 }
 
-int tfs_open(char const *name, int flags) {
+ssize_t tfs_readdir(tfs_ctx *fs, char const *dir, size_t *cursor,
+                    dir_entry_t *entries, size_t n) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    size_t start = cursor == NULL ? 0 : *cursor;
+    ssize_t result = list_dir(fs, dir, cursor, entries, n);
+    trace_end(fs, &call, TRACE_READDIR,
+              &(trace_args_t){.path = {dir}, .arg = {start, n}}, result);
+    return result;
+}
+
+static int open_file(tfs_ctx *fs, char const *name, int flags) {
     int inum;
     size_t offset;
 
@@ -48,47 +121,37 @@ int tfs_open(char const *name, int flags) {
     }
 
 
-    inum = tfs_lookup(name);
+    inum = lookup_file(fs, name);
 
 
     if (inum >= 0) {
         /* The file already exists */
-        inode_t *inode = inode_get(inum);
+        inode_t *inode = inode_get(fs, inum);
         if (inode == NULL) {
             return -1;
         }
 
+        /* The file may have been unlinked (and its i-node even reused)
+         * since the lookup; if so, starts over */
+        if (inode_open(fs, inum) == -1) {
+            return open_file(fs, name, flags);
+        }
+        if (lookup_file(fs, name) != inum) {
+            inode_close(fs, inum);
+            return open_file(fs, name, flags);
+        }
+
         /* Trucate (if requested) */
         if (flags & TFS_O_TRUNC) {
-            pthread_rwlock_rdlock(&inode->rwlock);
-            if (inode->i_size > 0) {
-                for (int i = 0; i < DIRECT_BLOCKS; i++) {
-                    // Frees the inode's direct blocks that are initialized
-                    if (inode->direct_blocks[i] != -1) {
-                        if (data_block_free(inode->direct_blocks[i]) == -1) {
-                            pthread_rwlock_unlock(&inode->rwlock);
-                            return -1;
-                        }
-                    }
-                }
-                // Frees the inode's indirect block if initialized
-                if (inode->indirect_block!=-1) {
-                    int* indirect_block = data_block_get(inode->indirect_block); 
-                    for (int i = 0; i < INDIRECT_BLOCKS; i++) {
-                        if (indirect_block[i] != -1) {
-                            if (data_block_free(indirect_block[i]) == -1) {
-                                pthread_rwlock_unlock(&inode->rwlock);
-                                return -1;
-                            }
-                        }
-                    }
-                    if (data_block_free(inode->indirect_block) == -1) {
-                        pthread_rwlock_unlock(&inode->rwlock);
-                        return -1;
-                    }
-                }
-                inode->i_size = 0;
+            pthread_rwlock_wrlock(&inode->rwlock);
+            if (inode_truncate(fs, inode) == -1) {
+                pthread_rwlock_unlock(&inode->rwlock);
+                inode_close(fs, inum);
+                return -1;
             }
+            /* Before a reader can cache a cluster from before the
+             * truncation again */
+            compressed_cache_invalidate(fs, inum);
             pthread_rwlock_unlock(&inode->rwlock);
         }    
 
@@ -105,20 +168,38 @@ int tfs_open(char const *name, int flags) {
         /* The file doesn't exist; the flags specify that it should be created*/
         /* Create inode */
 
-        inum = inode_create(T_FILE);
+        inum = inode_create(fs, T_FILE);
         if (inum == -1) {
             return -1;
         }
+        if (flags & TFS_O_COMPRESS) {
+            inode_t *inode = inode_get(fs, inum);
+            pthread_rwlock_wrlock(&inode->rwlock);
+            inode->i_flags |= I_COMPRESSED;
+            pthread_rwlock_unlock(&inode->rwlock);
+            /* The i-node may have belonged to a deleted compressed file */
+            compressed_cache_invalidate(fs, inum);
+        } else if (flags & TFS_O_DEDUP) {
+            inode_t *inode = inode_get(fs, inum);
+            pthread_rwlock_wrlock(&inode->rwlock);
+            inode->i_flags |= I_DEDUP;
+            pthread_rwlock_unlock(&inode->rwlock);
+        }
+        /* Opened before it is visible, so that an unlink cannot reclaim
+         * it first */
+        inode_open(fs, inum);
+
         /* Add entry in the root directory */
         // Lock of the root
-        pthread_rwlock_wrlock(&inode_get(ROOT_DIR_INUM)->rwlock);
+        pthread_rwlock_wrlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
 
-        if (add_dir_entry(ROOT_DIR_INUM, inum, name + 1) == -1) {
-            pthread_rwlock_unlock(&inode_get(ROOT_DIR_INUM)->rwlock);
-            inode_delete(inum);
+        if (add_dir_entry(fs, ROOT_DIR_INUM, inum, name + 1) == -1) {
+            pthread_rwlock_unlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
+            inode_unlink(fs, inum);
+            inode_close(fs, inum);
             return -1;
         }
-        pthread_rwlock_unlock(&inode_get(ROOT_DIR_INUM)->rwlock);
+        pthread_rwlock_unlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
 
         offset = 0;
 
@@ -129,247 +210,1322 @@ int tfs_open(char const *name, int flags) {
     /* Finally, add entry to the open file table and
      * return the corresponding handle */                                   
 
-    return add_to_open_file_table(inum, offset);
+    int fhandle =
+        add_to_open_file_table(fs, inum, offset, (flags & TFS_O_APPEND) != 0);
+    if (fhandle == -1) {
+        inode_close(fs, inum);
+    }
+    return fhandle;
 
     /* Note: for simplification, if file was created with TFS_O_CREAT and there
      * is an error adding an entry to the open file table, the file is not
      * opened but it remains created */
 }
 
-int tfs_close(int fhandle) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    inode_t *inode = inode_get(file->of_inumber);
+int tfs_open(tfs_ctx *fs, char const *name, int flags) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = open_file(fs, name, flags);
+    trace_end(fs, &call, TRACE_OPEN,
+              &(trace_args_t){.path = {name}, .arg = {(uint64_t)flags}},
+              result);
+    return result;
+}
+
+static int close_file(tfs_ctx *fs, int fhandle) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+    int inum = file->of_inumber;
+    inode_t *inode = inode_get(fs, inum);
     pthread_rwlock_wrlock(&inode->rwlock);
-    int return_value = remove_from_open_file_table(fhandle); 
+    int return_value = remove_from_open_file_table(fs, fhandle); 
     pthread_rwlock_unlock(&inode->rwlock);
-    return return_value;
+    if (return_value == 0) {
+        inode_close(fs, inum);
     }
+    return return_value;
+}
 
-ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    size_t bytes_to_write, bytes_written = 0;
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
+int tfs_close(tfs_ctx *fs, int fhandle) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = close_file(fs, fhandle);
+    trace_end(fs, &call, TRACE_CLOSE, &(trace_args_t){.fhandle = {fhandle}},
+              result);
+    return result;
+}
+
+static int unlink_file(tfs_ctx *fs, char const *name) {
+    if (!valid_pathname(name)) {
         return -1;
     }
 
-    /* From the open file table entry, we get the inode */
-    pthread_mutex_lock(&file->mutex);
-    inode_t *inode = inode_get(file->of_inumber);
-    pthread_mutex_unlock(&file->mutex);
-
-    if (inode == NULL) {
+    pthread_rwlock_wrlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
+    int inum = clear_dir_entry(fs, ROOT_DIR_INUM, name + 1);
+    pthread_rwlock_unlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
+    if (inum == -1) {
         return -1;
     }
 
+    /* The blocks are freed in the background, once the file is closed */
+    return inode_unlink(fs, inum);
+}
 
-    if (to_write > 0) {
-        // Number of blocks needed to write the size given in the input
-        int blocks_to_write = (int) to_write / BLOCK_SIZE;
+int tfs_unlink(tfs_ctx *fs, char const *name) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = unlink_file(fs, name);
+    trace_end(fs, &call, TRACE_UNLINK, &(trace_args_t){.path = {name}},
+              result);
+    return result;
+}
 
-        pthread_mutex_lock(&file->mutex);
-        // Block where the current offset of the file is
-        int offset_block = (int) file->of_offset / BLOCK_SIZE;
+static long online_cpus;
+static pthread_once_t online_cpus_once = PTHREAD_ONCE_INIT;
+
+/* Counts the CPUs once, as sysconf reads it from a file */
+static void online_cpus_init() { online_cpus = sysconf(_SC_NPROCESSORS_ONLN); }
+
+/*
+ * One block of a large read or write, resolved before the copies start so
+ * that they can be split among threads (see tfs_set_parallel_copy)
+ */
+typedef struct {
+    char *block;
+    int block_number;
+    size_t block_offset;
+    size_t buffer_offset;
+    size_t len;
+    /* Reads verify the block first, writes seal it after */
+    bool check;
+    bool failed; /* verification failed */
+} copy_segment_t;
+
+typedef enum { COPY_READ, COPY_WRITE, COPY_APPEND } copy_mode_t;
+
+typedef struct {
+    tfs_ctx *fs;
+    copy_mode_t mode;
+    copy_segment_t *segments;
+    size_t count;
+    size_t parts;
+    char *dest;         /* for COPY_READ */
+    char const *source; /* otherwise */
+} segment_copy_t;
+
+/*
+ * Returns the number of threads among which the block copies of a read or
+ * write of len bytes are split (1 if they are not)
+ */
+static size_t copy_parts(tfs_ctx *fs, size_t len) {
+    size_t threshold =
+        atomic_load_explicit(&fs->copy_threshold, memory_order_acquire);
+    if (threshold == 0 || len < threshold) {
+        return 1;
+    }
+    size_t parts = atomic_load_explicit(&fs->copy_threads,
+                                        memory_order_relaxed);
+    size_t blocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return parts < blocks ? parts : blocks;
+}
 
-        // In case the numbers are not divisible we need to increase
-        // the variables by 1
-        if ((int)to_write % BLOCK_SIZE != 0) {
-            blocks_to_write++;
+/*
+ * Resolves the blocks of a range of an uncompressed file, stopping at the
+ * first one that is missing (COPY_WRITE makes them private to the file;
+ * the blocks of an append were already made private)
+ * The caller must hold the i-node's lock (for writing, with COPY_WRITE).
+ * Returns the number of segments
+ */
+static size_t resolve_segments(tfs_ctx *fs, inode_t *inode,
+                               block_cursor_t *cursor, size_t offset,
+                               size_t len, copy_mode_t mode,
+                               copy_segment_t *segments) {
+    size_t count = 0, resolved = 0;
+    while (resolved < len && count < MAX_FILE_BLOCKS) {
+        size_t index = (offset + resolved) / BLOCK_SIZE;
+        size_t block_offset = (offset + resolved) % BLOCK_SIZE;
+        size_t bytes = BLOCK_SIZE - block_offset;
+        if (bytes > len - resolved) {
+            bytes = len - resolved;
         }
 
-        if (file->of_offset > BLOCK_SIZE) {
-            if (file->of_offset % BLOCK_SIZE != 0) {
-                offset_block++;
+        int b = mode == COPY_WRITE
+                    ? inode_block_get_private(fs, inode, index, cursor)
+                    : inode_block_lookup(fs, inode, cursor, index);
+        char *block = data_block_get(fs, b);
+        if (block == NULL) {
+            break;
+        }
+        bool check = mode == COPY_READ    ? !inode_block_is_tail(inode, index)
+                     : mode == COPY_WRITE ? true
+                                          : bytes == BLOCK_SIZE;
+        segments[count++] = (copy_segment_t){.block = block,
+                                             .block_number = b,
+                                             .block_offset = block_offset,
+                                             .buffer_offset = resolved,
+                                             .len = bytes,
+                                             .check = check,
+                                             .failed = false};
+        resolved += bytes;
+    }
+    return count;
+}
+
+/*
+ * Copies one part of the segments of a read or write (a run of consecutive
+ * segments); a read stops at a block that fails verification
+ */
+static void copy_segments_part(void *arg, size_t part) {
+    segment_copy_t *copy = arg;
+    size_t first = copy->count * part / copy->parts;
+    size_t end = copy->count * (part + 1) / copy->parts;
+    for (size_t i = first; i < end; i++) {
+        copy_segment_t *segment = &copy->segments[i];
+        if (copy->mode == COPY_READ) {
+            if (segment->check &&
+                data_block_verify(copy->fs, segment->block_number) == -1) {
+                segment->failed = true;
+                return;
+            }
+            memcpy(copy->dest + segment->buffer_offset,
+                   segment->block + segment->block_offset, segment->len);
+        } else {
+            memcpy(segment->block + segment->block_offset,
+                   copy->source + segment->buffer_offset, segment->len);
+            if (segment->check) {
+                data_block_seal(copy->fs, segment->block_number);
             }
         }
+    }
+}
 
-        pthread_rwlock_wrlock(&inode->rwlock);
+/*
+ * Reads or writes a range of an uncompressed file, resolving its blocks
+ * first and then splitting their copies among the copy pool's threads
+ * The caller must hold the i-node's lock, as for resolve_segments.
+ * Returns the number of bytes copied
+ */
+static size_t copy_segments(tfs_ctx *fs, inode_t *inode,
+                            block_cursor_t *cursor, size_t offset,
+                            size_t len, copy_mode_t mode, void *dest,
+                            void const *source, size_t parts) {
+    copy_segment_t segments[MAX_FILE_BLOCKS];
+    segment_copy_t copy = {
+        .fs = fs,
+        .mode = mode,
+        .segments = segments,
+        .count = resolve_segments(fs, inode, cursor, offset, len, mode,
+                                  segments),
+        .dest = dest,
+        .source = source};
+    copy.parts = parts < copy.count ? parts : copy.count;
+    copy_pool_run(atomic_load(&fs->copy_pool), copy_segments_part, &copy,
+                  copy.parts);
+
+    size_t copied = 0;
+    for (size_t i = 0; i < copy.count && !segments[i].failed; i++) {
+        copied += segments[i].len;
+    }
+    return copied;
+}
 
-        // In case the size of the write doesn't fit in the direct blocks
-        // and the index block hasn't been allocated
-        if (offset_block + blocks_to_write >= DIRECT_BLOCKS && inode->indirect_block == -1) {
-            inode->indirect_block = data_block_alloc();
-            int *indirect_block = data_block_get(inode->indirect_block);
-            for (size_t i = 0; i < INDIRECT_BLOCKS; i++) {
-                indirect_block[i] = -1;
+/*
+ * Writes to the blocks of an uncompressed file, allocating missing ones
+ * and finding them through the open file's cursor
+ * The caller must hold the i-node's lock for writing.
+ * Returns the number of bytes written
+ */
+static size_t write_blocks(tfs_ctx *fs, inode_t *inode, block_cursor_t *cursor,
+                           size_t offset, void const *buffer, size_t len) {
+    size_t written = 0;
+    size_t end = offset + len > inode->i_size ? offset + len : inode->i_size;
+
+    /* Allocates the missing blocks in one batch; if there are not enough
+     * free blocks, the loop below writes as much as it can */
+    size_t first = offset / BLOCK_SIZE;
+    inode_blocks_alloc(fs, inode, first,
+                       (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE - first,
+                       false);
+
+    size_t parts = copy_parts(fs, len);
+    if (parts > 1 && !(inode->i_flags & I_DEDUP)) {
+        return copy_segments(fs, inode, cursor, offset, len, COPY_WRITE,
+                             NULL, buffer, parts);
+    }
+
+    while (written < len) {
+        size_t index = (offset + written) / BLOCK_SIZE;
+        // where the offset is from the beginning of its block
+        size_t block_offset = (offset + written) % BLOCK_SIZE;
+        size_t bytes_to_write = BLOCK_SIZE - block_offset;
+        if (bytes_to_write > len - written) {
+            bytes_to_write = len - written;
+        }
+
+        int b = inode_block_get_private(fs, inode, index, cursor);
+        char *block = data_block_get(fs, b);
+        if (block == NULL) {
+            break;
+        }
+
+        memcpy(block + block_offset, (char const *)buffer + written,
+               bytes_to_write);
+        data_block_seal(fs, b);
+        written += bytes_to_write;
+
+        /* Once a block is full, shares it with any block with the same
+         * contents */
+        if ((inode->i_flags & I_DEDUP) && (index + 1) * BLOCK_SIZE <= end) {
+            int shared = data_block_dedup(fs, b);
+            if (shared != b && shared != -1) {
+                inode_block_set(fs, inode, index, shared);
+                data_block_free(fs, b);
             }
         }
+    }
+    return written;
+}
+
+/*
+ * Reads from the blocks of an uncompressed file, finding them through the
+ * open file's cursor
+ * The caller must hold the i-node's lock.
+ * Returns the number of bytes read
+ */
+static size_t read_blocks(tfs_ctx *fs, inode_t *inode, block_cursor_t *cursor,
+                          size_t offset, void *buffer, size_t len) {
+    size_t read = 0;
+
+    size_t parts = copy_parts(fs, len);
+    if (parts > 1) {
+        return copy_segments(fs, inode, cursor, offset, len, COPY_READ,
+                             buffer, NULL, parts);
+    }
+
+    while (read < len) {
+        size_t block_offset = (offset + read) % BLOCK_SIZE;
+        size_t bytes_to_read = BLOCK_SIZE - block_offset;
+        if (bytes_to_read > len - read) {
+            bytes_to_read = len - read;
+        }
 
-        int *indirect_block = NULL;
+        size_t index = (offset + read) / BLOCK_SIZE;
+        int b = inode_block_lookup(fs, inode, cursor, index);
+        char *block = data_block_get(fs, b);
+        if (block == NULL || (!inode_block_is_tail(inode, index) &&
+                              data_block_verify(fs, b) == -1)) {
+            break;
+        }
 
-        if (offset_block + blocks_to_write >= DIRECT_BLOCKS) 
-            indirect_block = data_block_get(inode->indirect_block); 
+        memcpy((char *)buffer + read, block + block_offset, bytes_to_read);
+        read += bytes_to_read;
+    }
+    return read;
+}
 
-        // iterates from the block where the current offset is to the one
-        // needed to write everything
-        for (int i = offset_block; i <= offset_block + blocks_to_write; i++) {
-            void *block;
-            // where the offset is from the beggining of its block
-            size_t offset = file->of_offset % BLOCK_SIZE;
-            
-            // DIRECT BLOCKS
-            if (i < DIRECT_BLOCKS) {
-                if (inode->direct_blocks[i] == -1) {
-                    inode->direct_blocks[i] = data_block_alloc();
-                }
-                block = data_block_get(inode->direct_blocks[i]);
-                if (block == NULL) {
-                    pthread_rwlock_unlock(&inode->rwlock);
-                    pthread_mutex_unlock(&file->mutex);
-                    return -1;
-                }
-            // INDIRECT BLOCKS
-            } else {
-                if (indirect_block[i] == -1) {
-                    indirect_block[i] = data_block_alloc();
-                } 
-                block = data_block_get(indirect_block[i]);
-                if (block == NULL) {
-                    pthread_rwlock_unlock(&inode->rwlock);
-                    pthread_mutex_unlock(&file->mutex);
-                    return -1;
+/*
+ * Whether the blocks of a range of a file are all mapped and not shared,
+ * so that it can be written without changing the block map
+ * The caller must hold the i-node's lock.
+ */
+static bool range_writable(tfs_ctx *fs, inode_t *inode, block_cursor_t *cursor,
+                           size_t start, size_t end) {
+    for (size_t i = start / BLOCK_SIZE; i * BLOCK_SIZE < end; i++) {
+        int b = inode_block_lookup(fs, inode, cursor, i);
+        if (b == -1 || data_block_unindex(fs, b) != 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Appends to an uncompressed, non-deduplicated file: reserves a range at
+ * the end of the file, writes it holding the i-node's lock only for
+ * reading (so that appenders copy their data in parallel, taking the lock
+ * for writing only if blocks must be allocated) and then publishes it.
+ * The caller must hold the open file's mutex.
+ * Returns the number of bytes written, -1 if failed
+ */
+static ssize_t append_blocks(tfs_ctx *fs, open_file_entry_t *file,
+                             inode_t *inode, void const *buffer, size_t len) {
+    size_t max_size = BLOCK_SIZE * MAX_FILE_BLOCKS;
+    unsigned int gen;
+    size_t start, end, written = 0;
+
+    for (;;) {
+        pthread_rwlock_rdlock(&inode->rwlock);
+        start = inode_append_reserve(inode, len, &gen);
+        if (start >= max_size) {
+            pthread_rwlock_unlock(&inode->rwlock);
+            return 0;
+        }
+        end = start + len < max_size ? start + len : max_size;
+
+        if (range_writable(fs, inode, &file->of_cursor, start, end)) {
+            break;
+        }
+        pthread_rwlock_unlock(&inode->rwlock);
+
+        pthread_rwlock_wrlock(&inode->rwlock);
+        bool truncated = inode->i_append_gen != gen;
+        if (!truncated) {
+            size_t first = start / BLOCK_SIZE;
+            inode_blocks_alloc(fs, inode, first,
+                               (end + BLOCK_SIZE - 1) / BLOCK_SIZE - first,
+                               false);
+            for (size_t i = first; i * BLOCK_SIZE < end; i++) {
+                if (inode_block_get_private(fs, inode, i, &file->of_cursor) ==
+                    -1) {
+                    break;
                 }
             }
-            // Calculates the number of bytes that will be
-            // written in the current block
-            if (offset != 0) {
-                if (to_write > BLOCK_SIZE - offset) {
-                    bytes_to_write = BLOCK_SIZE - offset;
-                } else {
-                    bytes_to_write = to_write;
-                }
-            } else if (to_write > BLOCK_SIZE) {
-                bytes_to_write = BLOCK_SIZE;
-            } else {
-                bytes_to_write = to_write;
+        }
+        pthread_rwlock_unlock(&inode->rwlock);
+
+        /* A truncation voids the reservation; otherwise the range is
+         * written with whatever blocks could be allocated */
+        pthread_rwlock_rdlock(&inode->rwlock);
+        if (!truncated && inode->i_append_gen == gen) {
+            break;
+        }
+        pthread_rwlock_unlock(&inode->rwlock);
+    }
+
+    size_t parts = copy_parts(fs, end - start);
+    if (parts > 1) {
+        written = copy_segments(fs, inode, &file->of_cursor, start,
+                                end - start, COPY_APPEND, NULL, buffer, parts);
+    }
+    while (start + written < end) {
+        size_t offset = start + written;
+        size_t index = offset / BLOCK_SIZE;
+        size_t block_offset = offset % BLOCK_SIZE;
+        size_t bytes_to_write = BLOCK_SIZE - block_offset;
+        if (bytes_to_write > end - offset) {
+            bytes_to_write = end - offset;
+        }
+
+        int b = inode_block_lookup(fs, inode, &file->of_cursor, index);
+        char *block = data_block_get(fs, b);
+        if (block == NULL) {
+            break;
+        }
+        memcpy(block + block_offset, (char const *)buffer + written,
+               bytes_to_write);
+        /* Blocks shared with the neighbouring ranges are sealed when the
+         * append is published */
+        if (bytes_to_write == BLOCK_SIZE) {
+            data_block_seal(fs, b);
+        }
+        written += bytes_to_write;
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+
+    if (inode_append_publish(fs, inode, start, start + len, start + written,
+                             gen) == 0) {
+        file->of_offset = start + written;
+    }
+    return written > 0 ? (ssize_t)written : -1;
+}
+
+/*
+ * Writes through an open file at its offset (at the end of the file, if it
+ * was opened for appending), advancing the offset
+ * The caller must hold the i-node's lock for writing and own the open file.
+ * Returns the number of bytes written, -1 if unsuccessful
+ */
+static ssize_t write_locked(tfs_ctx *fs, open_file_entry_t *file,
+                            inode_t *inode, void const *buffer,
+                            size_t to_write) {
+    ssize_t bytes_written = 0;
+    if (file->of_append) {
+        file->of_offset = inode->i_size;
+    }
+
+    /* The write is cut short at the maximum file size */
+    size_t max_size = BLOCK_SIZE * ((inode->i_flags & I_COMPRESSED)
+                                        ? MAX_COMPRESSED_FILE_BLOCKS
+                                        : MAX_FILE_BLOCKS);
+    if (file->of_offset >= max_size) {
+        to_write = 0;
+    } else if (to_write > max_size - file->of_offset) {
+        to_write = max_size - file->of_offset;
+    }
+
+    if (to_write > 0) {
+        if (inode->i_flags & I_COMPRESSED) {
+            bytes_written = compressed_write(fs, file->of_inumber, inode,
+                                             file->of_offset, buffer, to_write);
+        } else {
+            bytes_written =
+                (ssize_t)write_blocks(fs, inode, &file->of_cursor,
+                                      file->of_offset, buffer, to_write);
+            if (bytes_written == 0) {
+                bytes_written = -1;
             }
+        }
 
-            // Perform the actual write and updates the offset
-            // of the file accordingly
-            memcpy(block + offset, buffer, bytes_to_write);
-            file->of_offset += bytes_to_write;
-            to_write -= bytes_to_write;
-            bytes_written += bytes_to_write;
+        if (bytes_written > 0) {
+            // updates the offset of the file accordingly
+            file->of_offset += (size_t)bytes_written;
+            if (file->of_offset > inode->i_size) {
+                inode->i_size = file->of_offset;
+                inode_append_sync(fs, inode);
+            }
         }
+    }
+    return bytes_written;
+}
 
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
+/*
+ * A write published by a thread that found the i-node locked, for the
+ * lock holder to apply on its behalf (flat combining); the thread keeps
+ * owning the open file until the write is done
+ */
+typedef struct write_request {
+    struct write_request *next;
+    open_file_entry_t *file;
+    void const *buffer;
+    size_t len;
+    ssize_t result;
+    _Atomic bool done;
+} write_request_t;
+
+/*
+ * Applies the writes published on an i-node, oldest first, in up to
+ * WRITE_COMBINE_ROUNDS batches (those published later are left to their
+ * threads, so that the holder does not keep the lock indefinitely)
+ * The caller must hold the i-node's lock for writing.
+ */
+static void write_combine(tfs_ctx *fs, inode_t *inode) {
+    for (int round = 0; round < WRITE_COMBINE_ROUNDS; round++) {
+        /* Checked first, so that uncontended writes only read the line */
+        if (atomic_load_explicit(&inode->i_write_requests,
+                                 memory_order_relaxed) == NULL) {
+            return;
+        }
+        write_request_t *request =
+            atomic_exchange_explicit(&inode->i_write_requests, NULL,
+                                     memory_order_acquire);
+        /* Published as a stack: reverses it */
+        write_request_t *batch = NULL;
+        while (request != NULL) {
+            write_request_t *next = request->next;
+            request->next = batch;
+            batch = request;
+            request = next;
         }
+        while (batch != NULL) {
+            /* The request may be gone as soon as it is done */
+            write_request_t *next = batch->next;
+            batch->result = write_locked(fs, batch->file, inode,
+                                         batch->buffer, batch->len);
+            atomic_store_explicit(&batch->done, true, memory_order_release);
+            batch = next;
+        }
+    }
+}
 
+/*
+ * Writes through an open file while another thread holds the i-node's
+ * lock: publishes the write and waits until a lock holder applies it, or
+ * until it gets the lock itself (and then applies all the published
+ * writes)
+ * The caller must own the open file.
+ * Returns the number of bytes written, -1 if unsuccessful
+ */
+static ssize_t write_contended(tfs_ctx *fs, open_file_entry_t *file,
+                               inode_t *inode, void const *buffer,
+                               size_t to_write) {
+    write_request_t request = {
+        .file = file, .buffer = buffer, .len = to_write, .done = false};
+    request.next = atomic_load_explicit(&inode->i_write_requests,
+                                        memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(
+        &inode->i_write_requests, &request.next, &request,
+        memory_order_release, memory_order_relaxed)) {
+    }
+
+    for (int spins = 0;
+         !atomic_load_explicit(&request.done, memory_order_acquire);
+         spins++) {
+        if (spins < WRITE_COMBINE_SPINS
+                ? pthread_rwlock_trywrlock(&inode->rwlock) != 0
+                : pthread_rwlock_wrlock(&inode->rwlock) != 0) {
+            sched_yield();
+            continue;
+        }
+        /* No other holder can be applying the request now, so it is
+         * either done or still published */
+        write_combine(fs, inode);
         pthread_rwlock_unlock(&inode->rwlock);
-        pthread_mutex_unlock(&file->mutex);
-    } 
-    return (ssize_t)bytes_written;
+    }
+    return request.result;
 }
 
-ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
-    size_t bytes_to_read, bytes_read = 0;
-    open_file_entry_t *file = get_open_file_entry(fhandle);
+static ssize_t write_file(tfs_ctx *fs, int fhandle, void const *buffer,
+                          size_t to_write) {
+    ssize_t bytes_written = 0;
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
     if (file == NULL) {
         return -1;
     }
 
-     /*From the open file table entry, we get the inode */
+    /* From the open file table entry, we get the inode */
     pthread_mutex_lock(&file->mutex);
-    inode_t *inode = inode_get(file->of_inumber);
+    inode_t *inode = inode_get(fs, file->of_inumber);
+    if (inode == NULL) {
+        pthread_mutex_unlock(&file->mutex);
+        return -1;
+    }
+
+    if (file->of_append) {
+        pthread_rwlock_rdlock(&inode->rwlock);
+        bool plain = !(inode->i_flags & (I_COMPRESSED | I_DEDUP));
+        pthread_rwlock_unlock(&inode->rwlock);
+        if (plain) {
+            bytes_written = to_write > 0 ? append_blocks(fs, file, inode,
+                                                         buffer, to_write)
+                                         : 0;
+            pthread_mutex_unlock(&file->mutex);
+            return bytes_written;
+        }
+    }
+
+    /* A contended i-node is written by whichever thread holds its lock,
+     * which applies the writes of those waiting for it before releasing
+     * it */
+    if (pthread_rwlock_trywrlock(&inode->rwlock) != 0) {
+        bytes_written = write_contended(fs, file, inode, buffer, to_write);
+        pthread_mutex_unlock(&file->mutex);
+        return bytes_written;
+    }
+    bytes_written = write_locked(fs, file, inode, buffer, to_write);
+    write_combine(fs, inode);
+    pthread_rwlock_unlock(&inode->rwlock);
+    pthread_mutex_unlock(&file->mutex);
+    return bytes_written;
+}
+
+ssize_t tfs_write(tfs_ctx *fs, int fhandle, void const *buffer,
+                  size_t to_write) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    ssize_t result = write_file(fs, fhandle, buffer, to_write);
+    trace_end(fs, &call, TRACE_WRITE,
+              &(trace_args_t){.fhandle = {fhandle}, .arg = {to_write}}, result);
+    return result;
+}
+
+static ssize_t read_file(tfs_ctx *fs, int fhandle, void *buffer, size_t len) {
+    ssize_t bytes_read = 0;
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
 
+    /* From the open file table entry, we get the inode */
+    pthread_mutex_lock(&file->mutex);
+    inode_t *inode = inode_get(fs, file->of_inumber);
     if (inode == NULL) {
         pthread_mutex_unlock(&file->mutex);
         return -1;
     }
 
+    pthread_rwlock_rdlock(&inode->rwlock);
+
+    /* Determine how many bytes to read */
+    size_t to_read = 0;
+    if (inode->i_size > file->of_offset) {
+        to_read = inode->i_size - file->of_offset;
+    }
+    if (to_read > len) {
+        to_read = len;
+    }
+
+    if (to_read > 0) {
+        if (inode->i_flags & I_COMPRESSED) {
+            bytes_read = compressed_read(fs, file->of_inumber, inode,
+                                         file->of_offset, buffer, to_read);
+        } else {
+            bytes_read =
+                (ssize_t)read_blocks(fs, inode, &file->of_cursor,
+                                     file->of_offset, buffer, to_read);
+            if (bytes_read == 0) {
+                bytes_read = -1;
+            }
+        }
+
+        if (bytes_read > 0) {
+            file->of_offset += (size_t)bytes_read;
+        }
+    }
+
+    pthread_rwlock_unlock(&inode->rwlock);
+    pthread_mutex_unlock(&file->mutex);
+    return bytes_read;
+}
+
+ssize_t tfs_read(tfs_ctx *fs, int fhandle, void *buffer, size_t len) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    ssize_t result = read_file(fs, fhandle, buffer, len);
+    trace_end(fs, &call, TRACE_READ,
+              &(trace_args_t){.fhandle = {fhandle}, .arg = {len}}, result);
+    return result;
+}
+
+/*
+ * The buffers returned by a zero-copy read, along with the data blocks
+ * they point into, each pinned by a reference until they are released
+ */
+typedef struct {
+    size_t block_count;
+    int *blocks;
+    struct iovec iov[];
+} zc_read_t;
+
+/*
+ * Maps a range of an uncompressed file to buffers that point into its
+ * blocks, merging blocks that are consecutive in the data region, and pins
+ * the blocks
+ * The caller must hold the i-node's lock.
+ * Returns the buffers, NULL if failed (e.g., if not even the first block
+ * could be read)
+ */
+static zc_read_t *read_zc_blocks(tfs_ctx *fs, inode_t *inode,
+                                 block_cursor_t *cursor, size_t offset,
+                                 size_t len, size_t *read, size_t *iovcnt) {
+    size_t first = offset / BLOCK_SIZE;
+    size_t blocks = (offset + len - 1) / BLOCK_SIZE - first + 1;
+    zc_read_t *zc = malloc(sizeof(zc_read_t) +
+                           blocks * (sizeof(struct iovec) + sizeof(int)));
+    if (zc == NULL) {
+        return NULL;
+    }
+    zc->block_count = 0;
+    zc->blocks = (int *)(zc->iov + blocks);
+
+    size_t n = 0;
+    *read = 0;
+    while (*read < len) {
+        size_t block_offset = (offset + *read) % BLOCK_SIZE;
+        size_t bytes_to_read = BLOCK_SIZE - block_offset;
+        if (bytes_to_read > len - *read) {
+            bytes_to_read = len - *read;
+        }
+
+        size_t index = (offset + *read) / BLOCK_SIZE;
+        int b = inode_block_lookup(fs, inode, cursor, index);
+        char *block = data_block_get(fs, b);
+        if (block == NULL || (!inode_block_is_tail(inode, index) &&
+                              data_block_verify(fs, b) == -1)) {
+            break;
+        }
+
+        zc->blocks[zc->block_count++] = b;
+        if (n > 0 && (char *)zc->iov[n - 1].iov_base + zc->iov[n - 1].iov_len ==
+                         block + block_offset) {
+            zc->iov[n - 1].iov_len += bytes_to_read;
+        } else {
+            zc->iov[n++] = (struct iovec){.iov_base = block + block_offset,
+                                          .iov_len = bytes_to_read};
+        }
+        *read += bytes_to_read;
+    }
+
+    if (zc->block_count == 0 ||
+        data_blocks_ref_batch(fs, zc->blocks, zc->block_count) == -1) {
+        free(zc);
+        return NULL;
+    }
+    atomic_fetch_add(&fs->zc_pinned, zc->block_count);
+    *iovcnt = n;
+    return zc;
+}
+
+static ssize_t read_zc(tfs_ctx *fs, int fhandle, size_t len,
+                       struct iovec **iov, size_t *iovcnt) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL || iov == NULL || iovcnt == NULL) {
+        return -1;
+    }
+    *iov = NULL;
+    *iovcnt = 0;
+
+    pthread_mutex_lock(&file->mutex);
+    inode_t *inode = inode_get(fs, file->of_inumber);
+    if (inode == NULL) {
+        pthread_mutex_unlock(&file->mutex);
+        return -1;
+    }
 
-     /* Determine how many bytes to read */
     pthread_rwlock_rdlock(&inode->rwlock);
-    size_t to_read = inode->i_size - file->of_offset;
+    ssize_t bytes_read = 0;
+    size_t to_read = 0;
+    if (inode->i_size > file->of_offset) {
+        to_read = inode->i_size - file->of_offset;
+    }
     if (to_read > len) {
         to_read = len;
     }
+
+    /* Compressed files keep no block with their plain contents */
+    if (inode->i_flags & I_COMPRESSED) {
+        bytes_read = -1;
+    } else if (to_read > 0) {
+        size_t read;
+        zc_read_t *zc = read_zc_blocks(fs, inode, &file->of_cursor,
+                                       file->of_offset, to_read, &read,
+                                       iovcnt);
+        if (zc == NULL) {
+            bytes_read = -1;
+        } else {
+            *iov = zc->iov;
+            bytes_read = (ssize_t)read;
+            file->of_offset += read;
+        }
+    }
+
     pthread_rwlock_unlock(&inode->rwlock);
     pthread_mutex_unlock(&file->mutex);
+    return bytes_read;
+}
 
-    if (to_read > 0) {
-        // Number of blocks needed to read
-        int block_to_read = (int) to_read / BLOCK_SIZE;
-
-        pthread_mutex_lock(&file->mutex);
-        // Block where the current offset of the file is
-        int offset_block = (int) file->of_offset / BLOCK_SIZE;
-
-        // In case the numbers are not divisible we need to increase
-        // the variables by 1
-        if (file->of_offset > BLOCK_SIZE) {
-            if (file->of_offset % BLOCK_SIZE != 0) {
-                offset_block++;
-            }
+/*
+ * A zero-copy read is traced as a read of the same length, which has the
+ * same effect when replayed; releasing its buffers is not traced.
+ */
+ssize_t tfs_read_zc(tfs_ctx *fs, int fhandle, size_t len, struct iovec **iov,
+                    size_t *iovcnt) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    ssize_t result = read_zc(fs, fhandle, len, iov, iovcnt);
+    trace_end(fs, &call, TRACE_READ,
+              &(trace_args_t){.fhandle = {fhandle}, .arg = {len}}, result);
+    return result;
+}
+
+int tfs_read_zc_release(tfs_ctx *fs, struct iovec *iov) {
+    if (iov == NULL) {
+        return -1;
+    }
+    zc_read_t *zc = (zc_read_t *)((char *)iov - offsetof(zc_read_t, iov));
+    int result = data_blocks_free_batch(fs, zc->blocks, zc->block_count);
+    atomic_fetch_sub(&fs->zc_pinned, zc->block_count);
+    free(zc);
+    return result;
+}
+
+
+/*
+ * Copies a range of an uncompressed file to another one, block to block
+ * inside the data region: the destination's missing blocks are allocated
+ * as one contiguous run, and each run of blocks that is consecutive in
+ * both files is copied with a single memcpy.
+ * The caller must hold the source i-node's lock and the destination
+ * i-node's lock for writing; len is at most COPY_BATCH_BLOCKS blocks.
+ * Returns the number of bytes copied
+ */
+static size_t copy_blocks(tfs_ctx *fs, inode_t *source,
+                          block_cursor_t *source_cursor, size_t source_offset,
+                          inode_t *dest, block_cursor_t *dest_cursor,
+                          size_t dest_offset, size_t len) {
+    size_t first = dest_offset / BLOCK_SIZE;
+    size_t count = (dest_offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE - first;
+    inode_blocks_alloc(fs, dest, first, count, true);
+
+    /* Destination blocks written, sealed once the copy is done */
+    int written[COPY_BATCH_BLOCKS + 1];
+    size_t n_written = 0;
+
+    size_t copied = 0, run = 0;
+    char const *run_source = NULL;
+    char *run_dest = NULL;
+    while (copied < len && n_written <= COPY_BATCH_BLOCKS) {
+        size_t source_index = (source_offset + copied) / BLOCK_SIZE;
+        size_t source_block_offset = (source_offset + copied) % BLOCK_SIZE;
+        size_t dest_index = (dest_offset + copied) / BLOCK_SIZE;
+        size_t dest_block_offset = (dest_offset + copied) % BLOCK_SIZE;
+        size_t bytes_to_copy =
+            BLOCK_SIZE - (source_block_offset > dest_block_offset
+                              ? source_block_offset
+                              : dest_block_offset);
+        if (bytes_to_copy > len - copied) {
+            bytes_to_copy = len - copied;
         }
 
-        if ((int)to_read % BLOCK_SIZE != 0) {
-            block_to_read++;
+        int sb = inode_block_lookup(fs, source, source_cursor, source_index);
+        char const *source_block = data_block_get(fs, sb);
+        if (source_block == NULL ||
+            (source_block_offset == 0 &&
+             !inode_block_is_tail(source, source_index) &&
+             data_block_verify(fs, sb) == -1)) {
+            break;
+        }
+        int db = inode_block_get_private(fs, dest, dest_index, dest_cursor);
+        char *dest_block = data_block_get(fs, db);
+        if (dest_block == NULL) {
+            break;
+        }
+        if (n_written == 0 || written[n_written - 1] != db) {
+            written[n_written++] = db;
         }
 
-        int *indirect_block=NULL;
+        /* Extends the current run if both pieces follow it in memory */
+        char const *from = source_block + source_block_offset;
+        char *to = dest_block + dest_block_offset;
+        if (run > 0 && (from != run_source + run || to != run_dest + run)) {
+            memcpy(run_dest, run_source, run);
+            run = 0;
+        }
+        if (run == 0) {
+            run_source = from;
+            run_dest = to;
+        }
+        run += bytes_to_copy;
+        copied += bytes_to_copy;
+    }
+    if (run > 0) {
+        memcpy(run_dest, run_source, run);
+    }
 
-        pthread_rwlock_rdlock(&inode->rwlock);
-        if (offset_block + block_to_read>=DIRECT_BLOCKS) 
-            indirect_block = data_block_get(inode->indirect_block); 
-
-        // iterates from the block where the current offset is to the one
-        // needed to read everything
-        for (int i = offset_block; i <= offset_block + block_to_read; i++) {
-            void *block;
-            // where the offset is from the beggining of its block
-            size_t offset = file->of_offset % BLOCK_SIZE;
-
-            // DIRECT BLOCKS
-            if (i < DIRECT_BLOCKS) {
-                block = data_block_get(inode->direct_blocks[i]);
-                if (block == NULL) {
-                    pthread_mutex_unlock(&file->mutex);
-                    pthread_rwlock_unlock(&inode->rwlock);
-                    return -1;
-                }
-            // INDIRECT BLOCKS
-            } else {
-                block = data_block_get(indirect_block[i]);
-                if (block == NULL) {
-                    pthread_mutex_unlock(&file->mutex);
-                    pthread_rwlock_unlock(&inode->rwlock);
-                    return -1;
-                }
-            }
-            // Calculates the number of bytes that will be
-            // read in the current block
-            if (offset != 0) {
-                if (to_read > BLOCK_SIZE - offset) {
-                    bytes_to_read = BLOCK_SIZE - offset;
-                } else {
-                    bytes_to_read = to_read;
-                }
-            } else if (to_read > BLOCK_SIZE) {
-                bytes_to_read = BLOCK_SIZE;
-            } else {
-                bytes_to_read = to_read;
-            }
+    for (size_t i = 0; i < n_written; i++) {
+        data_block_seal(fs, written[i]);
+    }
+    return copied;
+}
+
+/*
+ * Copies through a buffer, for files whose blocks cannot be copied
+ * directly (compressed or deduplicated ones)
+ * Returns the number of bytes copied, -1 if failed
+ */
+static ssize_t copy_buffered(tfs_ctx *fs, int source_fhandle,
+                             int dest_fhandle, size_t len) {
+    char *buffer = malloc(COPY_BATCH_BLOCKS * BLOCK_SIZE);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    size_t copied = 0;
+    bool failed = false;
+    while (!failed && copied < len) {
+        size_t to_copy = len - copied < COPY_BATCH_BLOCKS * BLOCK_SIZE
+                             ? len - copied
+                             : COPY_BATCH_BLOCKS * BLOCK_SIZE;
+        ssize_t bytes_read = read_file(fs, source_fhandle, buffer, to_copy);
+        if (bytes_read <= 0) {
+            failed = bytes_read == -1;
+            break;
+        }
+        ssize_t bytes_written =
+            write_file(fs, dest_fhandle, buffer, (size_t)bytes_read);
+        if (bytes_written > 0) {
+            copied += (size_t)bytes_written;
+        }
+        failed = bytes_written != bytes_read;
+    }
+    free(buffer);
+    return copied == 0 && failed ? -1 : (ssize_t)copied;
+}
+
+static ssize_t copy_range(tfs_ctx *fs, int source_fhandle, int dest_fhandle,
+                          size_t len) {
+    open_file_entry_t *source_file = get_open_file_entry(fs, source_fhandle);
+    open_file_entry_t *dest_file = get_open_file_entry(fs, dest_fhandle);
+    if (source_file == NULL || dest_file == NULL ||
+        source_file->of_inumber == dest_file->of_inumber) {
+        return -1;
+    }
+    inode_t *source = inode_get(fs, source_file->of_inumber);
+    inode_t *dest = inode_get(fs, dest_file->of_inumber);
+    if (source == NULL || dest == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&source->rwlock);
+    bool direct = !(source->i_flags & I_COMPRESSED);
+    pthread_rwlock_unlock(&source->rwlock);
+    pthread_rwlock_rdlock(&dest->rwlock);
+    direct = direct && !(dest->i_flags & (I_COMPRESSED | I_DEDUP));
+    pthread_rwlock_unlock(&dest->rwlock);
+    if (!direct) {
+        return copy_buffered(fs, source_fhandle, dest_fhandle, len);
+    }
+
+    /* Locks in a fixed order (by handle, then by i-number), so that two
+     * copies in opposite directions cannot deadlock */
+    bool source_first = source_fhandle < dest_fhandle;
+    pthread_mutex_lock(source_first ? &source_file->mutex : &dest_file->mutex);
+    pthread_mutex_lock(source_first ? &dest_file->mutex : &source_file->mutex);
+
+    size_t max_size = BLOCK_SIZE * MAX_FILE_BLOCKS;
+    size_t copied = 0;
+    bool done = false, failed = false;
+    while (!done && copied < len) {
+        /* Each batch holds the locks of the i-nodes once */
+        if (source_file->of_inumber < dest_file->of_inumber) {
+            pthread_rwlock_rdlock(&source->rwlock);
+            pthread_rwlock_wrlock(&dest->rwlock);
+        } else {
+            pthread_rwlock_wrlock(&dest->rwlock);
+            pthread_rwlock_rdlock(&source->rwlock);
+        }
+        if (dest_file->of_append) {
+            dest_file->of_offset = dest->i_size;
+        }
 
-            // Perform the actual read and updates the offset
-            // of the file accordingly
-            memcpy(buffer, block + offset, bytes_to_read);
-            file->of_offset += bytes_to_read;
-            to_read -= bytes_to_read;
-            bytes_read += bytes_to_read;
+        size_t to_copy = len - copied;
+        if (to_copy > COPY_BATCH_BLOCKS * BLOCK_SIZE) {
+            to_copy = COPY_BATCH_BLOCKS * BLOCK_SIZE;
         }
+        if (source_file->of_offset >= source->i_size) {
+            to_copy = 0;
+        } else if (to_copy > source->i_size - source_file->of_offset) {
+            to_copy = source->i_size - source_file->of_offset;
+        }
+        if (dest_file->of_offset >= max_size) {
+            to_copy = 0;
+        } else if (to_copy > max_size - dest_file->of_offset) {
+            to_copy = max_size - dest_file->of_offset;
+        }
+
+        size_t batch = 0;
+        if (to_copy > 0) {
+            batch = copy_blocks(fs, source, &source_file->of_cursor,
+                                source_file->of_offset, dest,
+                                &dest_file->of_cursor, dest_file->of_offset,
+                                to_copy);
+            source_file->of_offset += batch;
+            dest_file->of_offset += batch;
+            if (dest_file->of_offset > dest->i_size) {
+                dest->i_size = dest_file->of_offset;
+                inode_append_sync(fs, dest);
+            }
+            copied += batch;
+        }
+        /* Stops at the end of the source, or when a block cannot be
+         * read or allocated */
+        failed = batch < to_copy;
+        done = batch == 0 || failed;
+
+        pthread_rwlock_unlock(&source->rwlock);
+        pthread_rwlock_unlock(&dest->rwlock);
+    }
+
+    pthread_mutex_unlock(&dest_file->mutex);
+    pthread_mutex_unlock(&source_file->mutex);
+    return copied == 0 && failed ? -1 : (ssize_t)copied;
+}
+
+ssize_t tfs_copy_range(tfs_ctx *fs, int source_fhandle, int dest_fhandle,
+                       size_t len) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    ssize_t result = copy_range(fs, source_fhandle, dest_fhandle, len);
+    trace_end(fs, &call, TRACE_COPY_RANGE,
+              &(trace_args_t){.fhandle = {source_fhandle, dest_fhandle},
+                              .arg = {len}},
+              result);
+    return result;
+}
+
+static int copy_file(tfs_ctx *fs, char const *source_path,
+                     char const *dest_path) {
+    int source_inumber = lookup_file(fs, source_path);
+    if (source_inumber == -1 || lookup_file(fs, dest_path) == source_inumber) {
+        return -1;
+    }
 
+    int source_fhandle = open_file(fs, source_path, 0);
+    if (source_fhandle == -1) {
+        return -1;
+    }
+    int dest_fhandle = open_file(fs, dest_path, TFS_O_CREAT | TFS_O_TRUNC);
+    if (dest_fhandle == -1) {
+        close_file(fs, source_fhandle);
+        return -1;
+    }
+
+    ssize_t copied;
+    do {
+        copied = copy_range(fs, source_fhandle, dest_fhandle, SIZE_MAX);
+    } while (copied > 0);
+
+    /* Copying stops short only at the end of the source */
+    int result = copied == 0 ? 0 : -1;
+    if (close_file(fs, dest_fhandle) == -1 ||
+        close_file(fs, source_fhandle) == -1) {
+        result = -1;
+    }
+    return result;
+}
+
+int tfs_copy_file(tfs_ctx *fs, char const *source_path, char const *dest_path) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = copy_file(fs, source_path, dest_path);
+    trace_end(fs, &call, TRACE_COPY_FILE,
+              &(trace_args_t){.path = {source_path, dest_path}}, result);
+    return result;
+}
+
+static int seek_file(tfs_ctx *fs, int fhandle, size_t offset) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&file->mutex);
+    inode_t *inode = inode_get(fs, file->of_inumber);
+    if (inode == NULL) {
         pthread_mutex_unlock(&file->mutex);
-        pthread_rwlock_unlock(&inode->rwlock);
+        return -1;
+    }
+
+    int result = -1;
+    pthread_rwlock_rdlock(&inode->rwlock);
+    /* Files have no holes, so the offset cannot go past the end */
+    if (offset <= inode->i_size) {
+        file->of_offset = offset;
+        result = 0;
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+    pthread_mutex_unlock(&file->mutex);
+    return result;
+}
+
+int tfs_seek(tfs_ctx *fs, int fhandle, size_t offset) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = seek_file(fs, fhandle, offset);
+    trace_end(fs, &call, TRACE_SEEK,
+              &(trace_args_t){.fhandle = {fhandle}, .arg = {offset}}, result);
+    return result;
+}
+
+static int fallocate_file(tfs_ctx *fs, int fhandle, size_t offset, size_t len) {
+    open_file_entry_t *file = get_open_file_entry(fs, fhandle);
+    if (file == NULL || len == 0 || offset > MAX_FILE_BLOCKS * BLOCK_SIZE ||
+        len > MAX_FILE_BLOCKS * BLOCK_SIZE - offset) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&file->mutex);
+    inode_t *inode = inode_get(fs, file->of_inumber);
+    if (inode == NULL) {
+        pthread_mutex_unlock(&file->mutex);
+        return -1;
     }
 
-    return (ssize_t)bytes_read;
-} 
+    pthread_rwlock_wrlock(&inode->rwlock);
+    int result = -1;
+    /* Compressed files place their clusters as they are written */
+    if (!(inode->i_flags & I_COMPRESSED)) {
+        size_t first = offset / BLOCK_SIZE;
+        result = inode_blocks_alloc(
+            fs, inode, first,
+            (offset + len + BLOCK_SIZE - 1) / BLOCK_SIZE - first, true);
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+    pthread_mutex_unlock(&file->mutex);
+    return result;
+}
 
+int tfs_fallocate(tfs_ctx *fs, int fhandle, size_t offset, size_t len) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = fallocate_file(fs, fhandle, offset, len);
+    trace_end(fs, &call, TRACE_FALLOCATE,
+              &(trace_args_t){.fhandle = {fhandle}, .arg = {offset, len}},
+              result);
+    return result;
+}
 
-int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
+int tfs_trace_start(tfs_ctx *fs, char const *path) {
+    return trace_start(fs, path);
+}
+
+int tfs_trace_stop(tfs_ctx *fs) { return trace_stop(fs); }
+
+int tfs_trace_replay(tfs_ctx *fs, char const *path, bool timed,
+                     trace_replay_stats_t *stats) {
+    return trace_replay(fs, path, timed, stats);
+}
+
+int tfs_lockstat_dump(FILE *out) { return lockstat_dump(out); }
+
+void tfs_lockstat_reset() { lockstat_reset(); }
+
+int tfs_set_parallel_copy(tfs_ctx *fs, size_t threshold,
+                          unsigned int threads) {
+    if (threads > COPY_POOL_THREADS) {
+        return -1;
+    }
+    if (threads == 0) {
+        pthread_once(&online_cpus_once, online_cpus_init);
+        threads = online_cpus > 0 && online_cpus < COPY_POOL_THREADS
+                      ? (unsigned int)online_cpus
+                      : COPY_POOL_THREADS;
+    }
+
+    /* The pool is started the first time the mode is enabled, and kept
+     * until the instance is destroyed */
+    if (threshold > 0 && atomic_load(&fs->copy_pool) == NULL) {
+        copy_pool_t *pool = copy_pool_create(COPY_POOL_THREADS - 1);
+        if (pool == NULL) {
+            return -1;
+        }
+        copy_pool_t *expected = NULL;
+        if (!atomic_compare_exchange_strong(&fs->copy_pool, &expected,
+                                            pool)) {
+            copy_pool_destroy(pool);
+        }
+    }
+    atomic_store_explicit(&fs->copy_threads, threads, memory_order_relaxed);
+    atomic_store_explicit(&fs->copy_threshold, threshold,
+                          memory_order_release);
+    return 0;
+}
+
+int tfs_set_verify_mode(tfs_ctx *fs, verify_mode_t mode) {
+    if (mode != VERIFY_OFF && mode != VERIFY_SAMPLED && mode != VERIFY_ALWAYS) {
+        return -1;
+    }
+    data_block_set_verify_mode(fs, mode);
+    return 0;
+}
+
+int tfs_scrubber_start(tfs_ctx *fs, unsigned int blocks_per_second) {
+    return scrubber_start(fs, blocks_per_second);
+}
+
+int tfs_scrubber_stop(tfs_ctx *fs) { return scrubber_stop(fs); }
+
+static int defrag_file(tfs_ctx *fs, char const *path) {
+    int inumber = lookup_file(fs, path);
+    if (inumber == -1) {
+        return -1;
+    }
+    return inode_defrag(fs, inumber);
+}
+
+int tfs_defrag(tfs_ctx *fs, char const *path) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = defrag_file(fs, path);
+    trace_end(fs, &call, TRACE_DEFRAG, &(trace_args_t){.path = {path}},
+              result);
+    return result;
+}
+
+int tfs_defrag_start(tfs_ctx *fs, unsigned int files_per_second) {
+    return defragmenter_start(fs, files_per_second);
+}
+
+int tfs_defrag_stop(tfs_ctx *fs) { return defragmenter_stop(fs); }
+
+static int file_fragmentation(tfs_ctx *fs, char const *path,
+                              fragmentation_t *frag) {
+    inode_t *inode = inode_get(fs, lookup_file(fs, path));
+    if (inode == NULL || frag == NULL) {
+        return -1;
+    }
+    pthread_rwlock_rdlock(&inode->rwlock);
+    int result = inode->i_node_type == T_FILE
+                     ? inode_fragmentation(fs, inode, frag)
+                     : -1;
+    pthread_rwlock_unlock(&inode->rwlock);
+    return result;
+}
+
+int tfs_fragmentation(tfs_ctx *fs, char const *path, fragmentation_t *frag) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = file_fragmentation(fs, path, frag);
+    trace_end(fs, &call, TRACE_FRAGMENTATION,
+              &(trace_args_t){.path = {path}}, result);
+    return result;
+}
+
+size_t tfs_checksum_errors(tfs_ctx *fs) {
+    return data_block_checksum_errors(fs);
+}
+
+int tfs_sync(tfs_ctx *fs) { return data_region_sync(fs); }
+
+int tfs_drop_caches(tfs_ctx *fs) {
+    /* Evicting the blocks would zero the buffers of zero-copy reads */
+    if (atomic_load(&fs->zc_pinned) > 0 || data_region_drop(fs) == -1) {
+        return -1;
+    }
+    /* Decompressed clusters would otherwise hide the blocks read back */
+    size_t extent = inode_table_extent(fs);
+    for (int inumber = 0; (size_t)inumber < extent; inumber++) {
+        compressed_cache_invalidate(fs, inumber);
+    }
+    return 0;
+}
+
+static int clone_file(tfs_ctx *fs, char const *source_path,
+                      char const *dest_path) {
+    if (!valid_pathname(dest_path) || lookup_file(fs, dest_path) != -1) {
+        return -1;
+    }
+
+    int source_inumber = lookup_file(fs, source_path);
+    inode_t *source = inode_get(fs, source_inumber);
+    if (source == NULL) {
+        return -1;
+    }
+
+    int inumber = inode_create(fs, T_FILE);
+    if (inumber == -1) {
+        return -1;
+    }
+    inode_t *inode = inode_get(fs, inumber);
+
+    pthread_rwlock_rdlock(&source->rwlock);
+    pthread_rwlock_wrlock(&inode->rwlock);
+    int result = inode_share_blocks(fs, inode, source);
+    pthread_rwlock_unlock(&inode->rwlock);
+    pthread_rwlock_unlock(&source->rwlock);
+
+    if (result == -1) {
+        inode_delete(fs, inumber);
+        return -1;
+    }
+    /* The i-node may have belonged to a deleted compressed file */
+    compressed_cache_invalidate(fs, inumber);
+
+    /* Add entry in the root directory */
+    pthread_rwlock_wrlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
+    if (add_dir_entry(fs, ROOT_DIR_INUM, inumber, dest_path + 1) == -1) {
+        pthread_rwlock_unlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
+        inode_delete(fs, inumber);
+        return -1;
+    }
+    pthread_rwlock_unlock(&inode_get(fs, ROOT_DIR_INUM)->rwlock);
+    return 0;
+}
+
+int tfs_clone(tfs_ctx *fs, char const *source_path, char const *dest_path) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = clone_file(fs, source_path, dest_path);
+    trace_end(fs, &call, TRACE_CLONE,
+              &(trace_args_t){.path = {source_path, dest_path}}, result);
+    return result;
+}
+
+static int export_file(tfs_ctx *fs, char const *source_path,
+                       char const *dest_path) {
     FILE *dest_pt;
-    int source_inumber = tfs_lookup(source_path);
+    int source_inumber = lookup_file(fs, source_path);
     dest_pt = fopen(dest_path,"w");
     if (source_inumber == -1){
         fclose(dest_pt);
@@ -381,9 +1537,10 @@ int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
     }
     // Max number of bytes that can be read
     char *buffer = malloc(BLOCK_SIZE*DATA_BLOCKS);
-    int fhandle_source = tfs_open(source_path,0);
+    int fhandle_source = open_file(fs, source_path,0);
 
-    ssize_t n_bytes = tfs_read(fhandle_source, buffer, BLOCK_SIZE*DATA_BLOCKS);
+    ssize_t n_bytes =
+        read_file(fs, fhandle_source, buffer, BLOCK_SIZE*DATA_BLOCKS);
     if (n_bytes == -1) {
         free(buffer);
         return -1;
@@ -393,7 +1550,235 @@ int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
     fwrite(buffer,1,(size_t)n_bytes,dest_pt);
 
     free(buffer);
-    tfs_close(fhandle_source);
+    close_file(fs, fhandle_source);
     fclose(dest_pt);
     return 0;
-}
\ No newline at end of file
+}
+
+int tfs_copy_to_external_fs(tfs_ctx *fs, char const *source_path,
+                            char const *dest_path) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    int result = export_file(fs, source_path, dest_path);
+    trace_end(fs, &call, TRACE_COPY_TO_EXTERNAL,
+              &(trace_args_t){.path = {source_path, dest_path}}, result);
+    return result;
+}
+
+/* A range of blocks of an imported file, filled by one thread */
+typedef struct {
+    tfs_ctx *fs;
+    inode_t *inode;
+    char const *source;
+    size_t start, end; /* byte range */
+    bool failed;
+} import_range_t;
+
+/*
+ * Copies a range of an external file into the (already allocated) blocks
+ * of a file; ranges are disjoint, so threads fill them holding the
+ * i-node's lock only for reading
+ */
+static void *import_range(void *arg) {
+    import_range_t *range = arg;
+    inode_t *inode = range->inode;
+
+    pthread_rwlock_rdlock(&inode->rwlock);
+    block_cursor_t cursor = {
+        .gen = inode->i_map_gen, .index = SIZE_MAX, .indirect_block = NULL};
+    for (size_t offset = range->start; offset < range->end;
+         offset += BLOCK_SIZE) {
+        size_t len =
+            range->end - offset < BLOCK_SIZE ? range->end - offset : BLOCK_SIZE;
+        int b = inode_block_lookup(range->fs, inode, &cursor,
+                                   offset / BLOCK_SIZE);
+        char *block = data_block_get(range->fs, b);
+        if (block == NULL) {
+            range->failed = true;
+            break;
+        }
+        memcpy(block, range->source + offset, len);
+        data_block_seal(range->fs, b);
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+    return NULL;
+}
+
+/*
+ * Returns the number of threads that import a file of the given size
+ */
+static size_t import_threads(size_t size) {
+    size_t n_threads = (size + BLOCK_SIZE - 1) / BLOCK_SIZE / IMPORT_MIN_BLOCKS;
+    if (n_threads > IMPORT_THREADS) {
+        n_threads = IMPORT_THREADS;
+    }
+    /* More threads than CPUs would only take turns */
+    pthread_once(&online_cpus_once, online_cpus_init);
+    if (online_cpus > 0 && n_threads > (size_t)online_cpus) {
+        n_threads = (size_t)online_cpus;
+    }
+    return n_threads > 0 ? n_threads : 1;
+}
+
+/*
+ * Fills a newly truncated file with the contents of an external file, in
+ * parallel: its blocks are reserved up front and split in ranges, one per
+ * thread
+ * Returns 0 if successful, -1 otherwise
+ */
+static int import_blocks(tfs_ctx *fs, int fhandle, char const *source,
+                         size_t size) {
+    if (fallocate_file(fs, fhandle, 0, size) == -1) {
+        return -1;
+    }
+    inode_t *inode =
+        inode_get(fs, get_open_file_entry(fs, fhandle)->of_inumber);
+
+    size_t blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t n_threads = import_threads(size);
+
+    import_range_t ranges[IMPORT_THREADS];
+    pthread_t threads[IMPORT_THREADS];
+    for (size_t i = 0; i < n_threads; i++) {
+        ranges[i] = (import_range_t){
+            .fs = fs,
+            .inode = inode,
+            .source = source,
+            .start = blocks * i / n_threads * BLOCK_SIZE,
+            .end = blocks * (i + 1) / n_threads * BLOCK_SIZE,
+            .failed = false};
+        if (ranges[i].end > size) {
+            ranges[i].end = size;
+        }
+    }
+    /* The calling thread fills the first range itself */
+    size_t started = 1;
+    for (; started < n_threads; started++) {
+        if (pthread_create(&threads[started], NULL, import_range,
+                           &ranges[started]) != 0) {
+            break;
+        }
+    }
+    import_range(&ranges[0]);
+    for (size_t i = 1; i < n_threads; i++) {
+        if (i < started) {
+            pthread_join(threads[i], NULL);
+        } else {
+            import_range(&ranges[i]);
+        }
+    }
+
+    for (size_t i = 0; i < n_threads; i++) {
+        if (ranges[i].failed) {
+            return -1;
+        }
+    }
+    pthread_rwlock_wrlock(&inode->rwlock);
+    if (size > inode->i_size) {
+        inode->i_size = size;
+        inode_append_sync(fs, inode);
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+    return 0;
+}
+
+/*
+ * Copies an external file to a file in TecnicoFS (see
+ * tfs_copy_from_external_fs), storing the size of the external file in
+ * size_ptr (which the trace records in place of its contents)
+ */
+static int import_file(tfs_ctx *fs, char const *source_path,
+                       char const *dest_path, size_t *size_ptr) {
+    int fd = open(source_path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    *size_ptr = size;
+    if (size > BLOCK_SIZE * MAX_FILE_BLOCKS) {
+        close(fd);
+        return -1;
+    }
+
+    /* Files split among threads are mapped, so that the threads copy
+     * straight from the page cache. Smaller files are read, as mapping
+     * them costs more than the copy it saves; so are files that cannot be
+     * mapped. */
+    bool mapped = false;
+    char *source = NULL;
+    if (import_threads(size) > 1) {
+        source = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (source == MAP_FAILED) {
+            source = NULL;
+        } else {
+            mapped = true;
+            posix_madvise(source, size, POSIX_MADV_WILLNEED);
+        }
+    }
+    if (!mapped && size > 0) {
+        source = malloc(size);
+        size_t done = 0;
+        while (source != NULL && done < size) {
+            ssize_t n = read(fd, source + done, size - done);
+            if (n <= 0) {
+                free(source);
+                source = NULL;
+            } else {
+                done += (size_t)n;
+            }
+        }
+    }
+    close(fd);
+    if (size > 0 && source == NULL) {
+        return -1;
+    }
+
+    int result = -1;
+    int fhandle = open_file(fs, dest_path, TFS_O_CREAT | TFS_O_TRUNC);
+    if (fhandle != -1) {
+        inode_t *inode =
+            inode_get(fs, get_open_file_entry(fs, fhandle)->of_inumber);
+        pthread_rwlock_rdlock(&inode->rwlock);
+        bool plain = !(inode->i_flags & (I_COMPRESSED | I_DEDUP));
+        pthread_rwlock_unlock(&inode->rwlock);
+
+        if (size == 0) {
+            result = 0;
+        } else if (plain) {
+            result = import_blocks(fs, fhandle, source, size);
+        } else {
+            /* An existing compressed or deduplicated file stays so */
+            result = write_file(fs, fhandle, source, size) == (ssize_t)size
+                         ? 0
+                         : -1;
+        }
+        if (close_file(fs, fhandle) == -1) {
+            result = -1;
+        }
+    }
+
+    if (mapped) {
+        munmap(source, size);
+    } else {
+        free(source);
+    }
+    return result;
+}
+
+int tfs_copy_from_external_fs(tfs_ctx *fs, char const *source_path,
+                              char const *dest_path) {
+    trace_call_t call;
+    trace_begin(fs, &call);
+    size_t size = 0;
+    int result = import_file(fs, source_path, dest_path, &size);
+    trace_end(fs, &call, TRACE_COPY_FROM_EXTERNAL,
+              &(trace_args_t){.path = {source_path, dest_path},
+                              .arg = {size}},
+              result);
+    return result;
+}
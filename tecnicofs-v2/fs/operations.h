@@ -3,32 +3,49 @@
 
 #include "config.h"
 #include "state.h"
+#include "trace.h"
 #include <pthread.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 enum {
     TFS_O_CREAT = 0b001,
     TFS_O_TRUNC = 0b010,
     TFS_O_APPEND = 0b100,
+    TFS_O_COMPRESS = 0b1000,
+    TFS_O_DEDUP = 0b10000,
 };
 
 /*
- * Initializes tecnicofs
- * Returns 0 if successful, -1 otherwise.
+ * Returns the default FS parameters
+ */
+tfs_params tfs_default_params();
+
+/*
+ * Initializes a new, independent tecnicofs instance. Every other function
+ * takes the instance it operates on; instances share no state (nor locks),
+ * so a process can run, e.g., one per core.
+ * Input:
+ *  - params_ptr: the FS parameters (NULL for the defaults). The data region
+ *    grows as blocks are allocated, up to params_ptr->max_block_count.
+ *    With params_ptr->device other than BLOCKDEV_RAM, the data blocks are
+ *    stored in the file params_ptr->device_path (created or truncated), and
+ *    the data region caches them.
+ * Returns the instance if successful, NULL otherwise.
  */
-int tfs_init();
+tfs_ctx *tfs_init(tfs_params const *params_ptr);
 
 /*
- * Destroy tecnicofs
+ * Destroy a tecnicofs instance
  * Returns 0 if successful, -1 otherwise.
  */
-int tfs_destroy();
+int tfs_destroy(tfs_ctx *fs);
 
 /*
  * Waits until no file is open and then destroy tecnicofs 
  * Returns 0 if successful, -1 otherwise.
  */
-int tfs_destroy_after_all_closed();
+int tfs_destroy_after_all_closed(tfs_ctx *fs);
 
 
 /*
@@ -38,25 +55,56 @@ int tfs_destroy_after_all_closed();
  *  - name: absolute path name
  * Returns the inumber of the file, -1 if unsuccessful
  */
-int tfs_lookup(char const *name);
+int tfs_lookup(tfs_ctx *fs, char const *name);
+
+/*
+ * Lists a directory, many entries per call
+ * Input:
+ *  - dir: absolute path name of the directory (only "/" is supported)
+ *  - cursor: 0 before the first call, then passed unchanged to the next
+ *    ones; files created or removed during the listing may or may not be
+ *    returned, but every other file is returned exactly once
+ *  - entries: array where the entries (name and inumber) are copied
+ *  - n: length of the array
+ * Returns the number of entries copied, 0 once the whole directory was
+ * listed, -1 if unsuccessful
+ */
+ssize_t tfs_readdir(tfs_ctx *fs, char const *dir, size_t *cursor,
+                    dir_entry_t *entries, size_t n);
 
 /*
  * Opens a file
  * Input:
  *  - name: absolute path name
  *  - flags: can be a combination (with bitwise or) of the following flags:
- *    - append mode (TFS_O_APPEND)
+ *    - append mode (TFS_O_APPEND): every write goes to the end of the file,
+ *      atomically; appends through different handles copy their data in
+ *      parallel
  *    - truncate file contents (TFS_O_TRUNC)
  *    - create file if it does not exist (TFS_O_CREAT)
+ *    - store the data of a newly created file compressed (TFS_O_COMPRESS);
+ *      ignored if the file already exists
+ *    - share the full blocks of a newly created file with blocks of the same
+ *      contents (TFS_O_DEDUP); ignored if the file already exists or is
+ *      compressed
  */
-int tfs_open(char const *name, int flags);
+int tfs_open(tfs_ctx *fs, char const *name, int flags);
 
 /* Closes a file
  * Input:
  * 	- file handle (obtained from a previous call to tfs_open)
  * Returns 0 if successful, -1 otherwise.
  */
-int tfs_close(int fhandle);
+int tfs_close(tfs_ctx *fs, int fhandle);
+
+/* Removes a file from its directory. The file's contents stay readable
+ * through the handles already open to it; its blocks are reclaimed in the
+ * background once the last of them is closed.
+ * Input:
+ *      - path name of the file
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_unlink(tfs_ctx *fs, char const *name);
 
 /* Writes to an open file, starting at the current offset
  * Input:
@@ -66,7 +114,7 @@ int tfs_close(int fhandle);
  * 	Returns the number of bytes that were written (can be lower than
  * 	'len' if the maximum file size is exceeded), or -1 in case of error
  */
-ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
+ssize_t tfs_write(tfs_ctx *fs, int fhandle, void const *buffer, size_t len);
 
 /* Reads from an open file, starting at the current offset
  * * Input:
@@ -77,7 +125,210 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  * 	(can be lower than 'len' if the file size was reached), or -1 in case of
  * error
  */
-ssize_t tfs_read(int fhandle, void *buffer, size_t len);
+ssize_t tfs_read(tfs_ctx *fs, int fhandle, void *buffer, size_t len);
+
+/* Reads from an open file without copying, starting at the current offset
+ * (which advances as with tfs_read): returns buffers that point into the
+ * file's data blocks. The blocks stay pinned until the buffers are
+ * released: writes to the file copy them first, and truncating, unlinking
+ * or defragmenting the file does not free or move them. Only uncompressed
+ * files can be read this way.
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- maximum number of bytes to read
+ * 	- iov, iovcnt: set to the buffers holding the bytes read, in order
+ * 	(NULL and 0 if no byte was read)
+ * 	Returns the number of bytes read (can be lower than 'len' if the file
+ * 	size was reached), or -1 in case of error
+ */
+ssize_t tfs_read_zc(tfs_ctx *fs, int fhandle, size_t len, struct iovec **iov,
+                    size_t *iovcnt);
+
+/* Releases the buffers returned by a tfs_read_zc, unpinning their blocks
+ * Returns 0 if successful, -1 otherwise
+ */
+int tfs_read_zc_release(tfs_ctx *fs, struct iovec *iov);
+
+/* Sets the offset of an open file, where its next read or write starts
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- new offset (in bytes), which cannot be past the end of the file
+ * 	Returns 0 if successful, -1 otherwise
+ */
+int tfs_seek(tfs_ctx *fs, int fhandle, size_t offset);
+
+/* Copies data from an open file to another one inside TecnicoFS, without
+ * going through a user buffer, starting at each file's current offset and
+ * advancing both (like a tfs_read followed by a tfs_write)
+ * Input:
+ * 	- handle of the source file
+ * 	- handle of the destination file, which must be a different file
+ * 	- number of bytes to copy
+ * 	Returns the number of bytes copied (lower than 'len' if the end of the
+ * 	source or the maximum file size is reached, 0 if the source is at its
+ * 	end), or -1 in case of error
+ */
+ssize_t tfs_copy_range(tfs_ctx *fs, int source_fhandle, int dest_fhandle,
+                       size_t len);
+
+/* Copies a file inside TecnicoFS, without going through a user buffer
+ * Input:
+ *      - path name of the source file
+ *      - path name of the destination file, which is created if needed
+ *        and overwritten if it already exists
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_copy_file(tfs_ctx *fs, char const *source_path,
+                  char const *dest_path);
+
+/* Reserves the data blocks of a range of an open file, as a single run of
+ * consecutive blocks when possible, so that writes to the range need not
+ * allocate blocks. The file's size is not changed. Not supported for
+ * compressed files.
+ * Input:
+ * 	- file handle (obtained from a previous call to tfs_open)
+ * 	- offset of the range (in bytes)
+ * 	- length of the range (in bytes)
+ * 	Returns 0 if successful, -1 otherwise (e.g., if there are not enough
+ * 	free blocks, in which case none is reserved)
+ */
+int tfs_fallocate(tfs_ctx *fs, int fhandle, size_t offset, size_t len);
+
+/* Starts recording every tfs_* call on the instance (thread, arguments,
+ * start time, latency and result, but not the data written or read) to a
+ * trace file, which tfs_trace_replay can replay. tfs_destroy stops it.
+ * Input:
+ *      - path name of the trace file (in the main file system), which is
+ *        created if needed and overwritten if it already exists
+ *      Returns 0 if successful, -1 otherwise (e.g., if already recording).
+ */
+int tfs_trace_start(tfs_ctx *fs, char const *path);
+
+/* Stops recording the trace, once the calls being recorded return
+ * Returns 0 if successful, -1 if no trace was being recorded.
+ */
+int tfs_trace_stop(tfs_ctx *fs);
+
+/* Replays a trace against an instance (normally a fresh one). Each thread
+ * of the trace is replayed by a thread of its own, and calls start in the
+ * same order as in the trace; a call on a file handle uses the handle
+ * returned by the replayed open. Writes write a fixed pattern.
+ * Input:
+ *      - path name of the trace file
+ *      - whether calls also start at the same times as in the trace (the
+ *        inter-arrival times are kept), instead of as fast as possible
+ *      - where the number of calls, their latencies (traced and replayed)
+ *        and those whose result changed are stored, for each operation
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_trace_replay(tfs_ctx *fs, char const *path, bool timed,
+                     trace_replay_stats_t *stats);
+
+/* Prints, for each class of locks (e.g., all i-node locks), how many times
+ * they were taken and contended, and histograms of how long threads waited
+ * for and held them. Only available when built with make LOCKSTAT=yes,
+ * which also prints them when an instance is destroyed.
+ * Input:
+ *      - where to print the statistics
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_lockstat_dump(FILE *out);
+
+/* Clears the lock statistics (e.g., to profile only part of a workload) */
+void tfs_lockstat_reset();
+
+/* Sets when the checksums of data blocks are verified as they are read:
+ * never (VERIFY_OFF), on a sample of the reads (VERIFY_SAMPLED, the
+ * default) or on every read (VERIFY_ALWAYS). A read that finds a corrupted
+ * block stops before it.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_set_verify_mode(tfs_ctx *fs, verify_mode_t mode);
+
+/* Sets up the parallel copy mode: reads and writes of at least threshold
+ * bytes (of uncompressed files) resolve their blocks first and then split
+ * the copies among up to threads threads (the caller and the workers of a
+ * pool, started the first time the mode is enabled); 0 threads means one
+ * per CPU, up to COPY_POOL_THREADS. A threshold of 0 disables the mode,
+ * which is the default.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_set_parallel_copy(tfs_ctx *fs, size_t threshold,
+                          unsigned int threads);
+
+/* Starts a background thread that keeps verifying the checksums of all
+ * file blocks
+ * Input:
+ *      - maximum number of blocks checked per second
+ *      Returns 0 if successful, -1 otherwise (e.g., if already running).
+ */
+int tfs_scrubber_start(tfs_ctx *fs, unsigned int blocks_per_second);
+
+/* Stops the background scrubber
+ * Returns 0 if successful, -1 if it was not running.
+ */
+int tfs_scrubber_stop(tfs_ctx *fs);
+
+/* Returns the number of corrupted blocks found so far */
+size_t tfs_checksum_errors(tfs_ctx *fs);
+
+/* Moves the data blocks of a file into a single run of consecutive blocks,
+ * so that sequential reads and copies touch contiguous memory. The file
+ * stays readable while its blocks are copied; writes wait until the block
+ * map is switched. Files that share blocks (clones, deduplicated blocks)
+ * are left as they are.
+ * Input:
+ *      - path name of the file
+ *      Returns the number of blocks moved (0 if the file is not fragmented
+ *      or no free run is large enough), -1 otherwise.
+ */
+int tfs_defrag(tfs_ctx *fs, char const *path);
+
+/* Starts a background thread that keeps defragmenting files
+ * Input:
+ *      - maximum number of files defragmented per second
+ *      Returns 0 if successful, -1 otherwise (e.g., if already running).
+ */
+int tfs_defrag_start(tfs_ctx *fs, unsigned int files_per_second);
+
+/* Stops the background defragmenter
+ * Returns 0 if successful, -1 if it was not running.
+ */
+int tfs_defrag_stop(tfs_ctx *fs);
+
+/* Measures how fragmented a file is: how many data blocks it has and in
+ * how many runs of consecutive blocks (extents) they are, in file order
+ * Input:
+ *      - path name of the file
+ *      - where to store the measurements
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_fragmentation(tfs_ctx *fs, char const *path, fragmentation_t *frag);
+
+/* Writes the modified data blocks to the instance's block device and waits
+ * until they are stable (nothing to do with BLOCKDEV_RAM)
+ * Returns 0 if successful, -1 otherwise (e.g., if an earlier write of a
+ * batch of blocks failed).
+ */
+int tfs_sync(tfs_ctx *fs);
+
+/* Evicts all data blocks (and decompressed clusters) from memory, after
+ * writing the modified ones to the block device; they are read back as
+ * they are accessed. No other call on the instance may be running, nor the
+ * scrubber.
+ * Returns 0 if successful, -1 otherwise (e.g., with BLOCKDEV_RAM, or while
+ * buffers of a tfs_read_zc are not released).
+ */
+int tfs_drop_caches(tfs_ctx *fs);
+
+/* Creates a copy of a file that shares its data blocks; a block is only
+ * copied when one of the files first modifies it.
+ * Input:
+ *      - path name of the source file
+ *      - path name of the new file, which must not exist
+ *      Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(tfs_ctx *fs, char const *source_path, char const *dest_path);
 
 /* Copies the contents of a file that exists in TecnicoFS to the contents
  * of another file in the OS' file system tree (outside TecnicoFS).
@@ -88,6 +339,21 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len);
  *.       is created it needed, and overwritten if it already exists
  *.     Returns 0 if successful, -1 otherwise.
 */ 
-int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
+int tfs_copy_to_external_fs(tfs_ctx *fs, char const *source_path,
+                            char const *dest_path);
+
+/* Copies the contents of a file in the OS' file system tree (outside
+ * TecnicoFS) to a file in TecnicoFS. The external file is mapped into
+ * memory and the blocks of the new contents are reserved up front, then
+ * filled by several threads when the file is large.
+ * Input:
+ *      - path name of the source file (in the main file system)
+ *      - path name of the destination file (in TecnicoFS), which is
+ *        created if needed and overwritten if it already exists
+ *      Returns 0 if successful, -1 otherwise (e.g., if the source does not
+ *      fit in a TecnicoFS file).
+ */
+int tfs_copy_from_external_fs(tfs_ctx *fs, char const *source_path,
+                              char const *dest_path);
 
 #endif // OPERATIONS_H
@@ -0,0 +1,48 @@
+#include "rcu.h"
+#include "lockstat.h"
+
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Slot of each thread (plus one, 0 until it is picked) */
+static _Thread_local unsigned int thread_slot;
+static _Atomic unsigned int next_slot;
+
+/*
+ * Returns the slot of the calling thread; threads take the slots in turns
+ */
+unsigned int rcu_thread_slot() {
+    if (thread_slot == 0) {
+        thread_slot = atomic_fetch_add(&next_slot, 1) % RCU_SLOTS + 1;
+    }
+    return thread_slot - 1;
+}
+
+void rcu_init(rcu_domain_t *rcu) {
+    memset(rcu, 0, sizeof(*rcu));
+    pthread_mutex_init(&rcu->mutex, NULL);
+    lockstat_register(&rcu->mutex, sizeof(rcu->mutex), LOCK_RCU);
+}
+
+void rcu_destroy(rcu_domain_t *rcu) {
+    lockstat_unregister(&rcu->mutex, sizeof(rcu->mutex));
+    pthread_mutex_destroy(&rcu->mutex);
+}
+
+/*
+ * Waits for a grace period: every read-side critical section that started
+ * before the call has ended when it returns
+ */
+void rcu_synchronize(rcu_domain_t *rcu) {
+    pthread_mutex_lock(&rcu->mutex);
+    for (int flip = 0; flip < 2; flip++) {
+        unsigned int parity = atomic_fetch_add(&rcu->epoch, 1) & 1;
+        for (size_t i = 0; i < RCU_SLOTS; i++) {
+            while (atomic_load(&rcu->slots[i].readers[parity]) != 0) {
+                sched_yield();
+            }
+        }
+    }
+    pthread_mutex_unlock(&rcu->mutex);
+}
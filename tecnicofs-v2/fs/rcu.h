@@ -0,0 +1,61 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Read-copy-update
+ *
+ * Readers of a structure published through an atomic pointer take no
+ * lock: they only mark themselves as reading. Writers publish an updated
+ * copy and, before freeing the old one, wait for a grace period, after
+ * which no reader can still be using it.
+ *
+ * Each reader counts itself in its thread's slot (slots are on their own
+ * cache lines, so readers on different threads do not share any line they
+ * write), in the counter picked by the parity of the current epoch. A grace
+ * period flips the epoch twice, each time waiting until the counters of
+ * the previous parity drain, so that it does not wait for readers that
+ * start after it.
+ */
+
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic unsigned long readers[2];
+} rcu_slot_t;
+
+typedef struct {
+    rcu_slot_t slots[RCU_SLOTS];
+    _Alignas(CACHE_LINE_SIZE) _Atomic unsigned int epoch;
+    /* Serializes grace periods */
+    pthread_mutex_t mutex;
+} rcu_domain_t;
+
+void rcu_init(rcu_domain_t *rcu);
+void rcu_destroy(rcu_domain_t *rcu);
+void rcu_synchronize(rcu_domain_t *rcu);
+unsigned int rcu_thread_slot();
+
+/*
+ * Starts a read-side critical section, in which pointers loaded from
+ * structures published by RCU stay valid
+ * Returns: the token to pass to rcu_read_unlock
+ */
+static inline unsigned int rcu_read_lock(rcu_domain_t *rcu) {
+    unsigned int token =
+        (rcu_thread_slot() << 1) | (atomic_load(&rcu->epoch) & 1);
+    atomic_fetch_add(&rcu->slots[token >> 1].readers[token & 1], 1);
+    return token;
+}
+
+/*
+ * Ends a read-side critical section
+ */
+static inline void rcu_read_unlock(rcu_domain_t *rcu, unsigned int token) {
+    atomic_fetch_sub_explicit(&rcu->slots[token >> 1].readers[token & 1], 1,
+                              memory_order_release);
+}
+
+#endif // RCU_H
@@ -1,428 +1,2428 @@
-#include "state.h"
-
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
-#include <pthread.h>
-
-/* Persistent FS state  (in reality, it should be maintained in secondary
- * memory; for simplicity, this project maintains it in primary memory) */
-
-/* I-node table */
-static inode_table_struct inode_table; 
-static freeinode_ts_struct freeinode_ts;
-
-/* Data blocks */
-static fs_data_struct fs_data; 
-static free_blocks_struct free_blocks; 
-
-/* Volatile FS state */
-
-static open_file_table_struct open_file_table; 
-static free_open_file_entries_struct free_open_file_entries; 
-
-static inline bool valid_inumber(int inumber) {
-    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
-}
-
-static inline bool valid_block_number(int block_number) {
-    return block_number >= 0 && block_number < DATA_BLOCKS;
-}
-
-static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
-}
-
-/**
- * We need to defeat the optimizer for the insert_delay() function.
- * Under optimization, the empty loop would be completely optimized away.
- * This function tells the compiler that the assembly code being run (which is
- * none) might potentially change *all memory in the process*.
- *
- * This prevents the optimizer from optimizing this code away, because it does
- * not know what it does and it may have side effects.
- *
- * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
- *
- * Exercise: try removing this function and look at the assembly generated to
- * compare.
- */
-static void touch_all_memory() { __asm volatile("" : : : "memory"); }
-
-/*
- * Auxiliary function to insert a delay.
- * Used in accesses to persistent FS state as a way of emulating access
- * latencies as if such data structures were really stored in secondary memory.
- */
-static void insert_delay() {
-    for (int i = 0; i < DELAY; i++) {
-        touch_all_memory();
-    }
-}
-
-/*
- * Initializes FS state
- */
-void state_init() {
-    // Initializes the mutexes
-    pthread_mutex_init(&freeinode_ts.mutex, NULL);
-    pthread_mutex_init(&free_blocks.mutex, NULL);
-    pthread_mutex_init(&free_open_file_entries.mutex, NULL);
-    pthread_mutex_init(&fs_data.mutex, NULL);
-    pthread_mutex_init(&inode_table.mutex, NULL);
-    pthread_mutex_init(&open_file_table.mutex, NULL);
-    pthread_rwlock_init(&inode_table.table[ROOT_DIR_INUM].rwlock, NULL);
-
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts.table[i] = FREE;
-    }
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks.table[i] = FREE;
-    }
-
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries.table[i] = FREE;
-    }
-}
-
-void state_destroy() { 
-    // destroys the mutexes
-    pthread_mutex_destroy(&inode_table.mutex);
-    pthread_mutex_destroy(&freeinode_ts.mutex);
-    pthread_mutex_destroy(&fs_data.mutex);
-    pthread_mutex_destroy(&free_blocks.mutex);
-    pthread_mutex_destroy(&open_file_table.mutex);
-    pthread_mutex_destroy(&free_open_file_entries.mutex);
-}
-
-/*
- * Creates a new i-node in the i-node table.
- * Input:
- *  - n_type: the type of the node (file or directory)
- * Returns:
- *  new i-node's number if successfully created, -1 otherwise
- */
-int inode_create(inode_type n_type) {
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-        if ((inumber * (int) sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
-            insert_delay(); // simulate storage access delay (to freeinode_ts)
-        }
-        /* Finds first free entry in i-node table */
-        pthread_mutex_lock(&freeinode_ts.mutex);
-        if (freeinode_ts.table[inumber] == FREE) {
-            /* Found a free entry, so takes it for the new i-node*/
-            freeinode_ts.table[inumber] = TAKEN;
-            insert_delay(); // simulate storage access delay (to i-node)
-
-            pthread_rwlock_init(&inode_table.table[inumber].rwlock, NULL);
-            pthread_rwlock_wrlock(&inode_table.table[inumber].rwlock);
-            inode_table.table[inumber].i_node_type = n_type;
-
-            if (n_type == T_DIRECTORY) {
-            /* Initializes directory (filling its block with empty
-             * entries, labeled with inumber==-1) */
-
-                int b = data_block_alloc();
-                if (b == -1) {
-                    freeinode_ts.table[inumber] = FREE;
-                    pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-                    pthread_mutex_unlock(&freeinode_ts.mutex);
-                    return -1;
-                }
-
-                inode_table.table[inumber].i_size = BLOCK_SIZE;
-                // The root directory has only one block
-                inode_table.table[inumber].direct_blocks[0] = b;
-
-                pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-
-                dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-                if (dir_entry == NULL) {
-                    freeinode_ts.table[inumber] = FREE;
-                    pthread_mutex_unlock(&freeinode_ts.mutex);
-                    return -1;
-                }
-
-                pthread_mutex_unlock(&freeinode_ts.mutex);
-                
-                for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    dir_entry[i].d_inumber = -1;
-                }
-
-
-            } else {
-
-                /* In case of a new file, simply sets its size to 0 */
-                inode_table.table[inumber].i_size = 0;
-                // DIRECT BLOCKS
-                for (int i = 0; i < DIRECT_BLOCKS; i++) {
-                    inode_table.table[inumber].direct_blocks[i] = -1;
-                }
-                // INDIRECT BLOCK
-                inode_table.table[inumber].indirect_block = -1;
-
-                pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-                pthread_mutex_unlock(&freeinode_ts.mutex);
-            }
-            return inumber;
-        }
-        pthread_mutex_unlock(&freeinode_ts.mutex);
-    }
-    return -1;
-}
-
-/*
- * Deletes the i-node.
- * Input:
- *  - inumber: i-node's number
- * Returns: 0 if successful, -1 if failed
- */
-int inode_delete(int inumber) {
-    // simulate storage access delay (to i-node and freeinode_ts)
-    insert_delay();
-    insert_delay();
-
-    pthread_mutex_lock(&freeinode_ts.mutex);
-    if (!valid_inumber(inumber) || freeinode_ts.table[inumber] == FREE) {
-        pthread_mutex_unlock(&freeinode_ts.mutex);    
-        return -1;
-    }
-
-    freeinode_ts.table[inumber] = FREE;
-    pthread_mutex_unlock(&freeinode_ts.mutex);
-
-    pthread_rwlock_wrlock(&inode_table.table[inumber].rwlock);
-    if (inode_table.table[inumber].i_size > 0) {
-        // DIRECT BLOCKS
-        for (int i = 0; i < DIRECT_BLOCKS; i++) {
-            if (inode_table.table[inumber].direct_blocks[i] != -1) {
-                if (data_block_free(inode_table.table[inumber].direct_blocks[i]) == -1) {
-                    pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-                    return -1;
-                }
-            }
-        }
-        // INDIRECT BLOCKS
-        if (inode_table.table[inumber].indirect_block!=-1) {
-            int* indirect_block = data_block_get(inode_table.table[inumber].indirect_block); 
-            for (int i = 0; i < INDIRECT_BLOCKS; i++) {
-                if (indirect_block[i] != -1) {
-                    if (data_block_free(indirect_block[i]) == -1) {
-                        pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-                        return -1;
-                    }
-                }
-            }
-            if (data_block_free(inode_table.table[inumber].indirect_block) == -1) {
-                pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-                return -1;
-            }
-        }
-    }
-    pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-    pthread_rwlock_destroy(&inode_table.table[inumber].rwlock);
-
-    return 0;
-}
-
-/*
- * Returns a pointer to an existing i-node.
- * Input:
- *  - inumber: identifier of the i-node
- * Returns: pointer if successful, NULL if failed
- */
-inode_t *inode_get(int inumber) {
-    if (!valid_inumber(inumber)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node
-    return &inode_table.table[inumber];
-}
-
-/*
- * Adds an entry to the i-node directory data.
- * Input:
- *  - inumber: identifier of the i-node
- *  - sub_inumber: identifier of the sub i-node entry
- *  - sub_name: name of the sub i-node entry
- * Returns: SUCCESS or FAIL
- */
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name) {
-    if (!valid_inumber(inumber) || !valid_inumber(sub_inumber)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to i-node with inumber
-
-    if (inode_table.table[inumber].i_node_type != T_DIRECTORY) {
-        return -1;
-    }
-
-    if (strlen(sub_name) == 0) {
-        return -1;
-    }
-
-    /* Locates the block containing the directory's entries */
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table.table[inumber].direct_blocks[0]);
-    if (dir_entry == NULL) {
-        return -1;
-    }
-
-    /* Finds and fills the first empty entry */
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = 0;
-            
-            return 0;
-        }
-    }
-    return -1;
-}
-
-/* Looks for a given name inside a directory
- * Input:
- * 	- parent directory's i-node number
- * 	- name to search
- * 	Returns i-number linked to the target name, -1 if not found
- */
-int find_in_dir(int inumber, char const *sub_name) {
-    insert_delay(); // simulate storage access delay to i-node with inumber
-    
-    pthread_rwlock_rdlock(&inode_table.table[inumber].rwlock);
-    if (!valid_inumber(inumber) ||
-        inode_table.table[inumber].i_node_type != T_DIRECTORY) {
-            pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-            return -1;
-    }
-    /* Locates the block containing the directory's entries */
-    dir_entry_t *dir_entry =
-        (dir_entry_t *)data_block_get(inode_table.table[inumber].direct_blocks[0]);
-    if (dir_entry == NULL) {
-        pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-        return -1;
-    }
-
-    pthread_rwlock_unlock(&inode_table.table[inumber].rwlock);
-
-    /* Iterates over the directory entries looking for one that has the target
-     * name */
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
-            return dir_entry[i].d_inumber;
-        }
-    return -1;
-}
-
-/*
- * Allocated a new data block
- * Returns: block index if successful, -1 otherwise
- */
-int data_block_alloc() {
-    pthread_mutex_lock(&free_blocks.mutex);
-    for (int i = 0; i < DATA_BLOCKS; i++) {
-        if (i * (int) sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
-
-        if (free_blocks.table[i] == FREE) {
-            free_blocks.table[i] = TAKEN;
-            pthread_mutex_unlock(&free_blocks.mutex);
-            return i;
-        }
-    }
-    pthread_mutex_unlock(&free_blocks.mutex);
-    return -1;
-}
-
-/* Frees a data block
- * Input
- * 	- the block index
- * Returns: 0 if success, -1 otherwise
- */
-int data_block_free(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return -1;
-    }
-
-    insert_delay(); // simulate storage access delay to free_blocks
-    pthread_mutex_lock(&free_blocks.mutex);
-    free_blocks.table[block_number] = FREE;
-    pthread_mutex_unlock(&free_blocks.mutex);
-    return 0;
-}
-
-/* Returns a pointer to the contents of a given block
- * Input:
- * 	- Block's index
- * Returns: pointer to the first byte of the block, NULL otherwise
- */
-void *data_block_get(int block_number) {
-    if (!valid_block_number(block_number)) {
-        return NULL;
-    }
-
-    insert_delay(); // simulate storage access delay to block
-    return &fs_data.table[block_number * BLOCK_SIZE];
-}
-
-/* Add new entry to the open file table
- * Inputs:
- * 	- I-node number of the file to open
- * 	- Initial offset
- * Returns: file handle if successful, -1 otherwise
- */
-int add_to_open_file_table(int inumber, size_t offset) {
-    pthread_mutex_lock(&free_open_file_entries.mutex);
-    pthread_mutex_lock(&open_file_table.mutex);
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (free_open_file_entries.table[i] == FREE) {
-            free_open_file_entries.table[i] = TAKEN;
-            open_file_table.table[i].of_inumber = inumber;
-            open_file_table.table[i].of_offset = offset;
-            pthread_mutex_init(&open_file_table.table[i].mutex,NULL);
-            pthread_mutex_unlock(&open_file_table.mutex);
-            pthread_mutex_unlock(&free_open_file_entries.mutex);
-            return i;
-        }
-    }
-    pthread_mutex_unlock(&open_file_table.mutex);
-    pthread_mutex_unlock(&free_open_file_entries.mutex);
-    return -1;
-}
-
-/* Frees an entry from the open file table
- * Inputs:
- * 	- file handle to free/close
- * Returns 0 is success, -1 otherwise
- */
-int remove_from_open_file_table(int fhandle) {
-    pthread_mutex_lock(&free_open_file_entries.mutex);
-    if (!valid_file_handle(fhandle) ||
-        free_open_file_entries.table[fhandle] != TAKEN) {
-        pthread_mutex_unlock(&free_open_file_entries.mutex);
-        return -1;
-    }
-    free_open_file_entries.table[fhandle] = FREE;
-    pthread_mutex_destroy(&open_file_table.table[fhandle].mutex);
-    pthread_mutex_unlock(&free_open_file_entries.mutex);
-    return 0;
-}
-
-/* Returns pointer to a given entry in the open file table
- * Inputs:
- * 	 - file handle
- * Returns: pointer to the entry if sucessful, NULL otherwise
- */
-open_file_entry_t *get_open_file_entry(int fhandle) {
-    if (!valid_file_handle(fhandle)) {
-        return NULL;
-    }
-    return &open_file_table.table[fhandle];
-}
+/* for MAP_ANONYMOUS and the huge page flags */
+#define _DEFAULT_SOURCE
+
+#include "state.h"
+#include "crc32c.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/* An append waiting for the ones before it waits on the condition variable
+ * picked by the offset it starts at, so that each publication only wakes
+ * the append that comes next (and those that happen to share its
+ * variable) */
+static inline pthread_cond_t *append_cond(tfs_ctx *fs, size_t offset) {
+    /* Fibonacci hashing, as offsets often share their low bits */
+    return &fs->append_conds[((uint64_t)offset * 0x9E3779B97F4A7C15ull) >>
+                         (64 - APPEND_WAIT_SLOTS_LOG2)];
+}
+
+/*
+ * Returns the i-node with the given number, NULL if the number is out of
+ * range or was never created (its slot, lock included, is uninitialized)
+ */
+static inline inode_t *inode_slot(tfs_ctx *fs, int inumber) {
+    if (inumber < 0 ||
+        (size_t)inumber >= atomic_load_explicit(&fs->inode_table.initialized,
+                                                memory_order_acquire)) {
+        return NULL;
+    }
+    inode_t *chunk = atomic_load_explicit(
+        &fs->inode_table.chunks[(size_t)inumber / INODE_CHUNK_INODES],
+        memory_order_relaxed);
+    return &chunk[(size_t)inumber % INODE_CHUNK_INODES];
+}
+
+/*
+ * Returns the i-node with the given number, which must be known to have
+ * been created (e.g., below inode_table_extent)
+ */
+static inline inode_t *inode_at(tfs_ctx *fs, int inumber) {
+    inode_t *chunk = atomic_load_explicit(
+        &fs->inode_table.chunks[(size_t)inumber / INODE_CHUNK_INODES],
+        memory_order_acquire);
+    return &chunk[(size_t)inumber % INODE_CHUNK_INODES];
+}
+
+static inline bool valid_block_number(tfs_ctx *fs, int block_number) {
+    return block_number >= 0 && (size_t)block_number < fs->fs_data.block_count;
+}
+
+static inline bool valid_file_handle(int file_handle) {
+    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
+}
+
+/**
+ * We need to defeat the optimizer for the insert_delay() function.
+ * Under optimization, the empty loop would be completely optimized away.
+ * This function tells the compiler that the assembly code being run (which is
+ * none) might potentially change *all memory in the process*.
+ *
+ * This prevents the optimizer from optimizing this code away, because it does
+ * not know what it does and it may have side effects.
+ *
+ * Reference with more information: https://youtu.be/nXaxk27zwlk?t=2775
+ *
+ * Exercise: try removing this function and look at the assembly generated to
+ * compare.
+ */
+static void touch_all_memory() { __asm volatile("" : : : "memory"); }
+
+/*
+ * Auxiliary function to insert a delay.
+ * Used in accesses to persistent FS state as a way of emulating access
+ * latencies as if such data structures were really stored in secondary memory.
+ */
+static void insert_delay() {
+    for (int i = 0; i < DELAY; i++) {
+        touch_all_memory();
+    }
+}
+
+static void reclaimer_stop(tfs_ctx *fs);
+
+/*
+ * Index of a directory's entries: a copy of the entries in use, each with
+ * a hash of its name. It is never modified once published; each change to
+ * the directory publishes a new one.
+ */
+typedef struct dir_index {
+    size_t count;
+    struct {
+        uint32_t hash;
+        int inumber;
+        char name[MAX_FILE_NAME];
+    } entries[MAX_DIR_ENTRIES];
+} dir_index_t;
+
+/* FNV-1a hash of a name (of up to MAX_FILE_NAME characters) */
+static uint32_t name_hash(char const *name) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < MAX_FILE_NAME && name[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Publishes a new index of a directory, built from the entries in its
+ * block, and frees the previous one once no lookup can be reading it (if
+ * the new one cannot be allocated, none is published and lookups lock the
+ * directory instead)
+ * The caller must hold the directory i-node's lock for writing.
+ */
+static void dir_index_update(tfs_ctx *fs, inode_t *dir,
+                             dir_entry_t const *entries) {
+    dir_index_t *index = malloc(sizeof(dir_index_t));
+    if (index != NULL) {
+        index->count = 0;
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            if (entries[i].d_inumber != -1) {
+                index->entries[index->count].hash =
+                    name_hash(entries[i].d_name);
+                index->entries[index->count].inumber = entries[i].d_inumber;
+                memcpy(index->entries[index->count].name, entries[i].d_name,
+                       MAX_FILE_NAME);
+                index->count++;
+            }
+        }
+    }
+
+    dir_index_t *old = atomic_exchange(&dir->i_dir_index, index);
+    if (old != NULL) {
+        rcu_synchronize(&fs->rcu);
+        free(old);
+    }
+}
+
+static void data_region_destroy(tfs_ctx *fs);
+
+/* Number of data blocks whose state fits in each word of the bitmap */
+#define BLOCKS_PER_WORD (64)
+
+/*
+ * Allocates the tables indexed by block number and opens the block device,
+ * if any. The data region itself is only mapped as blocks are allocated;
+ * the tables are zero-filled by calloc, so their pages also only become
+ * resident when they are used.
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int data_region_init(tfs_ctx *fs, tfs_params const *params) {
+    size_t block_count = params->max_block_count;
+    if (block_count == 0 || block_count > INT_MAX) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < DATA_LOAD_STRIPES; i++) {
+        pthread_mutex_init(&fs->fs_data.load_mutexes[i], NULL);
+    }
+    lockstat_register(fs->fs_data.load_mutexes,
+                      sizeof(fs->fs_data.load_mutexes), LOCK_DATA_LOAD);
+    if (params->device != BLOCKDEV_RAM) {
+        fs->fs_data.device =
+            blockdev_open(params->device, params->device_path, block_count);
+        fs->fs_data.resident =
+            calloc(block_count, sizeof(*fs->fs_data.resident));
+        if (fs->fs_data.device == NULL || fs->fs_data.resident == NULL) {
+            data_region_destroy(fs);
+            return -1;
+        }
+    }
+
+    fs->fs_data.block_count = block_count;
+    fs->fs_data.chunk_count = (block_count + CHUNK_BLOCKS - 1) / CHUNK_BLOCKS;
+    fs->fs_data.chunks =
+        calloc(fs->fs_data.chunk_count, sizeof(*fs->fs_data.chunks));
+    size_t words = (block_count + BLOCKS_PER_WORD - 1) / BLOCKS_PER_WORD;
+    fs->free_blocks.bitmap = calloc(words, sizeof(uint64_t));
+    fs->free_blocks.refs = calloc(block_count, sizeof(*fs->free_blocks.refs));
+    fs->block_checksums.crc =
+        calloc(block_count, sizeof(*fs->block_checksums.crc));
+    fs->block_checksums.valid =
+        calloc(block_count, sizeof(*fs->block_checksums.valid));
+    fs->dedup_index.buckets =
+        malloc(block_count * sizeof(*fs->dedup_index.buckets));
+    fs->dedup_index.next = calloc(block_count, sizeof(*fs->dedup_index.next));
+    fs->dedup_index.fingerprint =
+        calloc(block_count, sizeof(*fs->dedup_index.fingerprint));
+    fs->dedup_index.indexed =
+        calloc(block_count, sizeof(*fs->dedup_index.indexed));
+    if (fs->fs_data.chunks == NULL || fs->free_blocks.bitmap == NULL ||
+        fs->free_blocks.refs == NULL || fs->block_checksums.crc == NULL ||
+        fs->block_checksums.valid == NULL || fs->dedup_index.buckets == NULL ||
+        fs->dedup_index.next == NULL || fs->dedup_index.fingerprint == NULL ||
+        fs->dedup_index.indexed == NULL) {
+        data_region_destroy(fs);
+        return -1;
+    }
+
+    for (size_t i = 0; i < block_count; i++) {
+        fs->dedup_index.buckets[i] = -1;
+    }
+    /* The blocks past the capacity are never free */
+    if (block_count % BLOCKS_PER_WORD != 0) {
+        fs->free_blocks.bitmap[words - 1] = UINT64_MAX
+                                            << block_count % BLOCKS_PER_WORD;
+    }
+    return 0;
+}
+
+static void data_region_destroy(tfs_ctx *fs) {
+    if (fs->fs_data.chunks != NULL) {
+        for (size_t i = 0; i < fs->fs_data.chunk_count; i++) {
+            char *chunk = atomic_load(&fs->fs_data.chunks[i]);
+            if (chunk != NULL) {
+                munmap(chunk, DATA_CHUNK_SIZE);
+            }
+        }
+    }
+    free(fs->fs_data.chunks);
+    free(fs->free_blocks.bitmap);
+    free(fs->free_blocks.refs);
+    free(fs->block_checksums.crc);
+    free(fs->block_checksums.valid);
+    free(fs->dedup_index.buckets);
+    free(fs->dedup_index.next);
+    free(fs->dedup_index.fingerprint);
+    free(fs->dedup_index.indexed);
+    if (fs->fs_data.device != NULL) {
+        blockdev_close(fs->fs_data.device);
+    }
+    free((void *)fs->fs_data.resident);
+    lockstat_unregister(fs->fs_data.load_mutexes,
+                        sizeof(fs->fs_data.load_mutexes));
+    for (size_t i = 0; i < DATA_LOAD_STRIPES; i++) {
+        pthread_mutex_destroy(&fs->fs_data.load_mutexes[i]);
+    }
+    memset(&fs->fs_data, 0, sizeof(fs->fs_data));
+}
+
+/*
+ * Maps the chunk of the data region that holds a block, if it is not
+ * mapped yet (free_blocks.mutex must be held)
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int data_chunk_map(tfs_ctx *fs, int block_number) {
+    size_t chunk = (size_t)block_number / CHUNK_BLOCKS;
+    if (atomic_load_explicit(&fs->fs_data.chunks[chunk],
+                             memory_order_relaxed) != NULL) {
+        return 0;
+    }
+
+    /* Prefers a huge page, then a regular mapping that the kernel may back
+     * with transparent huge pages */
+    void *addr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    addr = mmap(NULL, DATA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (addr == MAP_FAILED) {
+        addr = mmap(NULL, DATA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            return -1;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(addr, DATA_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+
+    atomic_store_explicit(&fs->fs_data.chunks[chunk], addr,
+                          memory_order_release);
+    return 0;
+}
+
+static inline pthread_mutex_t *data_load_mutex(tfs_ctx *fs,
+                                               int block_number) {
+    return &fs->fs_data.load_mutexes[(size_t)block_number / DATA_LOAD_BLOCKS %
+                                     DATA_LOAD_STRIPES];
+}
+
+/*
+ * Reads a block that is not resident from the block device (threads that
+ * need it meanwhile wait for the first one to read it), along with the
+ * blocks after it in its group that are not resident either, which are
+ * likely to be read next
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int data_block_load(tfs_ctx *fs, int block_number, char *block) {
+    pthread_mutex_t *mutex = data_load_mutex(fs, block_number);
+    int result = 0;
+    pthread_mutex_lock(mutex);
+    if (!atomic_load_explicit(&fs->fs_data.resident[block_number],
+                              memory_order_relaxed)) {
+        /* Groups never cross chunks, so the run is contiguous in memory */
+        size_t first = (size_t)block_number, end = first + 1;
+        size_t group_end = (first / DATA_LOAD_BLOCKS + 1) * DATA_LOAD_BLOCKS;
+        while (end < group_end && end < fs->fs_data.block_count &&
+               !atomic_load_explicit(&fs->fs_data.resident[end],
+                                     memory_order_relaxed)) {
+            end++;
+        }
+        result = blockdev_read(fs->fs_data.device, first, end - first, block);
+        for (size_t i = first; result == 0 && i < end; i++) {
+            atomic_store_explicit(&fs->fs_data.resident[i], true,
+                                  memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(mutex);
+    return result;
+}
+
+/*
+ * Marks a newly allocated block as resident: its previous contents are
+ * not needed, so it is not read from the block device (nor may a load of
+ * its group overwrite it)
+ * (free_blocks.mutex must be held)
+ */
+static inline void data_block_set_resident(tfs_ctx *fs, int block_number) {
+    if (fs->fs_data.device != NULL) {
+        pthread_mutex_t *mutex = data_load_mutex(fs, block_number);
+        pthread_mutex_lock(mutex);
+        atomic_store_explicit(&fs->fs_data.resident[block_number], true,
+                              memory_order_release);
+        pthread_mutex_unlock(mutex);
+    }
+}
+
+/*
+ * Returns a pointer to the contents of a block, NULL if its chunk is not
+ * mapped (or, with a block device, if it could not be read)
+ */
+static inline char *data_block_address(tfs_ctx *fs, int block_number) {
+    char *chunk = atomic_load_explicit(
+        &fs->fs_data.chunks[(size_t)block_number / CHUNK_BLOCKS],
+        memory_order_acquire);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    char *block = chunk + (size_t)block_number % CHUNK_BLOCKS * BLOCK_SIZE;
+    if (fs->fs_data.device != NULL &&
+        !atomic_load_explicit(&fs->fs_data.resident[block_number],
+                              memory_order_acquire) &&
+        data_block_load(fs, block_number, block) == -1) {
+        return NULL;
+    }
+    return block;
+}
+
+/* Number of i-nodes whose state fits in each word of the bitmap */
+#define INODES_PER_WORD (64)
+
+static void inode_table_destroy(tfs_ctx *fs);
+
+/*
+ * Allocates the chunk directory and the bitmap of the i-node table, for
+ * the capacity given; like the data region's tables, they are zero-filled
+ * by calloc, so that their pages only become resident when they are used
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_table_init(tfs_ctx *fs, tfs_params const *params) {
+    size_t inode_count = params->max_inode_count;
+    if (inode_count == 0 || inode_count > INT_MAX) {
+        return -1;
+    }
+
+    size_t words = (inode_count + INODES_PER_WORD - 1) / INODES_PER_WORD;
+    fs->inode_table.inode_count = inode_count;
+    fs->inode_table.chunk_count =
+        (inode_count + INODE_CHUNK_INODES - 1) / INODE_CHUNK_INODES;
+    fs->inode_table.chunks =
+        calloc(fs->inode_table.chunk_count, sizeof(*fs->inode_table.chunks));
+    fs->freeinode_ts.bitmap = calloc(words, sizeof(uint64_t));
+    if (fs->inode_table.chunks == NULL || fs->freeinode_ts.bitmap == NULL) {
+        inode_table_destroy(fs);
+        return -1;
+    }
+    /* The numbers past the capacity are never free */
+    if (inode_count % INODES_PER_WORD != 0) {
+        fs->freeinode_ts.bitmap[words - 1] = UINT64_MAX
+                                             << inode_count % INODES_PER_WORD;
+    }
+    return 0;
+}
+
+static void inode_table_destroy(tfs_ctx *fs) {
+    if (fs->inode_table.chunks != NULL) {
+        size_t initialized = atomic_load(&fs->inode_table.initialized);
+        for (size_t i = 0; i < initialized; i++) {
+            inode_t *inode = inode_at(fs, (int)i);
+            pthread_rwlock_destroy(&inode->rwlock);
+            free(atomic_load(&inode->i_dir_index));
+        }
+        for (size_t i = 0; i < fs->inode_table.chunk_count; i++) {
+            inode_t *chunk = atomic_load(&fs->inode_table.chunks[i]);
+            if (chunk == NULL) {
+                continue;
+            }
+            lockstat_unregister(chunk, INODE_CHUNK_INODES * sizeof(inode_t));
+            free(chunk);
+        }
+    }
+    free(fs->inode_table.chunks);
+    free(fs->freeinode_ts.bitmap);
+    fs->inode_table.chunks = NULL;
+    fs->freeinode_ts.bitmap = NULL;
+}
+
+/*
+ * Initializes the slot of an i-node that is created for the first time,
+ * allocating the chunk that holds it if needed; the other slots of the
+ * chunk are left untouched, so that their memory only becomes resident
+ * (and their locks initialized) once they are used
+ * (freeinode_ts.mutex must be held)
+ * Returns: 0 if successful, -1 otherwise
+ */
+static int inode_slot_init(tfs_ctx *fs, int inumber) {
+    size_t initialized = atomic_load_explicit(&fs->inode_table.initialized,
+                                              memory_order_relaxed);
+    if ((size_t)inumber < initialized) {
+        return 0;
+    }
+
+    size_t chunk = (size_t)inumber / INODE_CHUNK_INODES;
+    inode_t *inodes = atomic_load_explicit(&fs->inode_table.chunks[chunk],
+                                           memory_order_relaxed);
+    if (inodes == NULL) {
+        inodes = aligned_alloc(CACHE_LINE_SIZE,
+                               INODE_CHUNK_INODES * sizeof(inode_t));
+        if (inodes == NULL) {
+            return -1;
+        }
+        lockstat_register(inodes, INODE_CHUNK_INODES * sizeof(inode_t),
+                          LOCK_INODE);
+        atomic_store_explicit(&fs->inode_table.chunks[chunk], inodes,
+                              memory_order_relaxed);
+    }
+
+    inode_t *inode = &inodes[(size_t)inumber % INODE_CHUNK_INODES];
+    memset(inode, 0, sizeof(inode_t));
+    pthread_rwlock_init(&inode->rwlock, NULL);
+    for (size_t j = 0; j < DIRECT_BLOCKS; j++) {
+        inode->direct_blocks[j] = -1;
+    }
+    inode->indirect_block = -1;
+    inode->i_reclaim_next = -1;
+
+    /* Publishes the slot (and its chunk) to inode_slot and the scans */
+    atomic_store_explicit(&fs->inode_table.initialized, (size_t)inumber + 1,
+                          memory_order_release);
+    return 0;
+}
+
+/*
+ * Returns the number of i-nodes initialized so far: every i-node ever
+ * created has a lower number, and every lower number was created
+ */
+size_t inode_table_extent(tfs_ctx *fs) {
+    return atomic_load_explicit(&fs->inode_table.initialized,
+                                memory_order_acquire);
+}
+
+/*
+ * Takes the lowest free i-node number, initializing its slot if needed
+ * (freeinode_ts.mutex must be held)
+ * Returns: the i-node number if successful, -1 otherwise
+ */
+static int inumber_alloc(tfs_ctx *fs) {
+    size_t words = (fs->inode_table.inode_count + INODES_PER_WORD - 1) /
+                   INODES_PER_WORD;
+    size_t first = fs->freeinode_ts.first_free;
+    for (size_t w = first; w < words; w++) {
+        if (w == first || w * sizeof(uint64_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay (to freeinode_ts)
+        }
+        uint64_t word = fs->freeinode_ts.bitmap[w];
+        if (word != UINT64_MAX) {
+            size_t bit = (size_t)__builtin_ctzll(~word);
+            int inumber = (int)(w * INODES_PER_WORD + bit);
+            fs->freeinode_ts.first_free = w;
+            if (inode_slot_init(fs, inumber) == -1) {
+                return -1;
+            }
+            fs->freeinode_ts.bitmap[w] = word | 1ull << bit;
+            return inumber;
+        }
+    }
+    fs->freeinode_ts.first_free = words;
+    return -1;
+}
+
+/*
+ * Returns an i-node number to the free ones
+ * (freeinode_ts.mutex must be held)
+ */
+static void inumber_free(tfs_ctx *fs, int inumber) {
+    size_t w = (size_t)inumber / INODES_PER_WORD;
+    fs->freeinode_ts.bitmap[w] &= ~(1ull << (size_t)inumber % INODES_PER_WORD);
+    if (w < fs->freeinode_ts.first_free) {
+        fs->freeinode_ts.first_free = w;
+    }
+}
+
+/*
+ * Returns whether an i-node number is in use
+ * (freeinode_ts.mutex must be held)
+ */
+static inline bool inumber_taken(tfs_ctx *fs, int inumber) {
+    uint64_t word = fs->freeinode_ts.bitmap[(size_t)inumber / INODES_PER_WORD];
+    return (word >> (size_t)inumber % INODES_PER_WORD & 1) != 0;
+}
+
+/*
+ * Creates the state of a new FS instance
+ * Input:
+ *  - params: the FS parameters
+ * Returns: the instance if successful, NULL otherwise
+ */
+tfs_ctx *state_init(tfs_params params) {
+    tfs_ctx *fs = aligned_alloc(CACHE_LINE_SIZE, sizeof(tfs_ctx));
+    if (fs == NULL) {
+        return NULL;
+    }
+    memset(fs, 0, sizeof(tfs_ctx));
+    if (data_region_init(fs, &params) == -1) {
+        free(fs);
+        return NULL;
+    }
+    if (inode_table_init(fs, &params) == -1) {
+        data_region_destroy(fs);
+        free(fs);
+        return NULL;
+    }
+
+    // Initializes the mutexes
+    pthread_mutex_init(&fs->freeinode_ts.mutex, NULL);
+    pthread_mutex_init(&fs->free_blocks.mutex, NULL);
+    pthread_mutex_init(&fs->free_open_file_entries.mutex, NULL);
+    pthread_mutex_init(&fs->inode_table.mutex, NULL);
+    pthread_mutex_init(&fs->open_file_table.mutex, NULL);
+    pthread_mutex_init(&fs->reclaim_queue.mutex, NULL);
+    pthread_cond_init(&fs->reclaim_queue.cond, NULL);
+    fs->reclaim_queue.head = -1;
+    fs->reclaim_queue.tail = -1;
+    fs->reclaim_queue.count = 0;
+    fs->reclaim_queue.running = false;
+    fs->reclaim_queue.stop = false;
+    pthread_mutex_init(&fs->scrubber.mutex, NULL);
+    pthread_cond_init(&fs->scrubber.cond, NULL);
+    pthread_mutex_init(&fs->defragmenter.mutex, NULL);
+    pthread_cond_init(&fs->defragmenter.cond, NULL);
+    pthread_mutex_init(&fs->append_mutex, NULL);
+    rcu_init(&fs->rcu);
+    for (size_t i = 0; i < APPEND_WAIT_SLOTS; i++) {
+        pthread_cond_init(&fs->append_conds[i], NULL);
+    }
+    atomic_init(&fs->verify_mode, VERIFY_SAMPLED);
+
+    lockstat_register(&fs->inode_table.mutex, sizeof(pthread_mutex_t),
+                      LOCK_INODE_TABLE);
+    lockstat_register(&fs->freeinode_ts.mutex, sizeof(pthread_mutex_t),
+                      LOCK_FREEINODE_TS);
+    lockstat_register(&fs->free_blocks.mutex, sizeof(pthread_mutex_t),
+                      LOCK_FREE_BLOCKS);
+    lockstat_register(fs->open_file_table.table,
+                      sizeof(fs->open_file_table.table), LOCK_OPEN_FILE);
+    lockstat_register(&fs->open_file_table.mutex, sizeof(pthread_mutex_t),
+                      LOCK_OPEN_FILE_TABLE);
+    lockstat_register(&fs->free_open_file_entries.mutex,
+                      sizeof(pthread_mutex_t), LOCK_FREE_OPEN_FILE_ENTRIES);
+    lockstat_register(&fs->reclaim_queue.mutex, sizeof(pthread_mutex_t),
+                      LOCK_RECLAIM_QUEUE);
+    lockstat_register(&fs->scrubber.mutex, sizeof(pthread_mutex_t),
+                      LOCK_SCRUBBER);
+    lockstat_register(&fs->defragmenter.mutex, sizeof(pthread_mutex_t),
+                      LOCK_DEFRAGMENTER);
+    lockstat_register(&fs->append_mutex, sizeof(pthread_mutex_t),
+                      LOCK_APPEND);
+
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        fs->free_open_file_entries.table[i] = FREE;
+    }
+    return fs;
+}
+
+/*
+ * Destroys the state of a FS instance, stopping its background threads
+ */
+void state_destroy(tfs_ctx *fs) {
+    defragmenter_stop(fs);
+    scrubber_stop(fs);
+    reclaimer_stop(fs);
+
+    // destroys the mutexes
+    inode_table_destroy(fs);
+    pthread_mutex_destroy(&fs->inode_table.mutex);
+    pthread_mutex_destroy(&fs->freeinode_ts.mutex);
+    pthread_mutex_destroy(&fs->free_blocks.mutex);
+    pthread_mutex_destroy(&fs->open_file_table.mutex);
+    pthread_mutex_destroy(&fs->free_open_file_entries.mutex);
+    pthread_mutex_destroy(&fs->reclaim_queue.mutex);
+    pthread_cond_destroy(&fs->reclaim_queue.cond);
+    pthread_mutex_destroy(&fs->scrubber.mutex);
+    pthread_cond_destroy(&fs->scrubber.cond);
+    pthread_mutex_destroy(&fs->defragmenter.mutex);
+    pthread_cond_destroy(&fs->defragmenter.cond);
+    pthread_mutex_destroy(&fs->append_mutex);
+    rcu_destroy(&fs->rcu);
+    for (size_t i = 0; i < APPEND_WAIT_SLOTS; i++) {
+        pthread_cond_destroy(&fs->append_conds[i]);
+    }
+
+    lockstat_unregister(fs, sizeof(tfs_ctx));
+    data_region_destroy(fs);
+    free(fs);
+}
+
+/*
+ * Creates a new i-node in the i-node table.
+ * Input:
+ *  - n_type: the type of the node (file or directory)
+ * Returns:
+ *  new i-node's number if successfully created, -1 otherwise
+ */
+int inode_create(tfs_ctx *fs, inode_type n_type) {
+    /* Finds the first free entry in the i-node table and takes it for the
+     * new i-node */
+    pthread_mutex_lock(&fs->freeinode_ts.mutex);
+    int inumber = inumber_alloc(fs);
+    if (inumber == -1) {
+        pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+        return -1;
+    }
+    insert_delay(); // simulate storage access delay (to i-node)
+
+    inode_t *inode = inode_at(fs, inumber);
+    pthread_rwlock_wrlock(&inode->rwlock);
+    inode->i_node_type = n_type;
+    inode->i_flags = 0;
+
+    if (n_type == T_DIRECTORY) {
+        /* Initializes directory (filling its block with empty entries,
+         * labeled with inumber==-1) */
+
+        int b = data_block_alloc(fs);
+        if (b == -1) {
+            inumber_free(fs, inumber);
+            pthread_rwlock_unlock(&inode->rwlock);
+            pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+            return -1;
+        }
+
+        inode->i_size = BLOCK_SIZE;
+        // The root directory has only one block
+        inode->direct_blocks[0] = b;
+
+        pthread_rwlock_unlock(&inode->rwlock);
+
+        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(fs, b);
+        if (dir_entry == NULL) {
+            inumber_free(fs, inumber);
+            pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+            return -1;
+        }
+
+        pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+
+        for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+            dir_entry[i].d_inumber = -1;
+        }
+        data_block_dirty(fs, b);
+        /* Not visible to lookups yet */
+        dir_index_update(fs, inode, dir_entry);
+    } else {
+        /* In case of a new file, simply sets its size to 0 */
+        inode->i_size = 0;
+        pthread_mutex_lock(&fs->append_mutex);
+        atomic_store(&inode->i_append_end, 0);
+        inode->i_append_published = 0;
+        pthread_mutex_unlock(&fs->append_mutex);
+        // DIRECT BLOCKS
+        for (int i = 0; i < DIRECT_BLOCKS; i++) {
+            inode->direct_blocks[i] = -1;
+        }
+        // INDIRECT BLOCK
+        inode->indirect_block = -1;
+
+        pthread_rwlock_unlock(&inode->rwlock);
+        pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+    }
+    return inumber;
+}
+
+/*
+ * Deletes the i-node.
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_delete(tfs_ctx *fs, int inumber) {
+    // simulate storage access delay (to i-node and freeinode_ts)
+    insert_delay();
+    insert_delay();
+
+    inode_t *inode = inode_slot(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&fs->freeinode_ts.mutex);
+    if (!inumber_taken(fs, inumber)) {
+        pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+
+    /* The blocks are freed before the i-node, so that a new file cannot
+     * take the i-node while they are still in its block map */
+    pthread_rwlock_wrlock(&inode->rwlock);
+    if (inode_truncate(fs, inode) == -1) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        return -1;
+    }
+    inode->i_unlinked = false;
+    pthread_rwlock_unlock(&inode->rwlock);
+
+    pthread_mutex_lock(&fs->freeinode_ts.mutex);
+    inumber_free(fs, inumber);
+    pthread_mutex_unlock(&fs->freeinode_ts.mutex);
+
+    return 0;
+}
+
+/*
+ * Reclaims the i-nodes in the reclaim queue, returning the blocks of each
+ * one in a single batch
+ */
+static void *reclaimer_run(void *arg) {
+    tfs_ctx *fs = arg;
+    pthread_mutex_lock(&fs->reclaim_queue.mutex);
+    for (;;) {
+        while (fs->reclaim_queue.count == 0 && !fs->reclaim_queue.stop) {
+            pthread_cond_wait(&fs->reclaim_queue.cond,
+                              &fs->reclaim_queue.mutex);
+        }
+        if (fs->reclaim_queue.count == 0) {
+            break;
+        }
+        int inumber = fs->reclaim_queue.head;
+        inode_t *inode = inode_at(fs, inumber);
+        fs->reclaim_queue.head = inode->i_reclaim_next;
+        fs->reclaim_queue.count--;
+        pthread_mutex_unlock(&fs->reclaim_queue.mutex);
+
+        /* The file may have been reopened through a stale lookup since it
+         * was queued; it is queued again when that handle is closed */
+        pthread_rwlock_wrlock(&inode->rwlock);
+        inode->i_reclaim_pending = false;
+        bool reclaim = inode->i_unlinked && inode->i_open_count == 0;
+        pthread_rwlock_unlock(&inode->rwlock);
+        if (reclaim) {
+            inode_delete(fs, inumber);
+        }
+
+        pthread_mutex_lock(&fs->reclaim_queue.mutex);
+    }
+    pthread_mutex_unlock(&fs->reclaim_queue.mutex);
+    return NULL;
+}
+
+/*
+ * Queues an i-node for reclamation, starting the reclaimer if needed
+ * (the caller must hold the i-node's lock for writing)
+ */
+static void reclaim_enqueue(tfs_ctx *fs, int inumber) {
+    inode_t *inode = inode_at(fs, inumber);
+    if (inode->i_reclaim_pending) {
+        return;
+    }
+    inode->i_reclaim_pending = true;
+
+    pthread_mutex_lock(&fs->reclaim_queue.mutex);
+    if (!fs->reclaim_queue.running) {
+        if (pthread_create(&fs->reclaim_queue.thread, NULL, reclaimer_run,
+                           fs) != 0) {
+            /* No reclaimer, so the i-node is leaked */
+            pthread_mutex_unlock(&fs->reclaim_queue.mutex);
+            return;
+        }
+        fs->reclaim_queue.running = true;
+    }
+    inode->i_reclaim_next = -1;
+    if (fs->reclaim_queue.count == 0) {
+        fs->reclaim_queue.head = inumber;
+    } else {
+        inode_at(fs, fs->reclaim_queue.tail)->i_reclaim_next = inumber;
+    }
+    fs->reclaim_queue.tail = inumber;
+    fs->reclaim_queue.count++;
+    pthread_cond_signal(&fs->reclaim_queue.cond);
+    pthread_mutex_unlock(&fs->reclaim_queue.mutex);
+}
+
+/*
+ * Stops the reclaimer, after it reclaims the i-nodes already queued
+ */
+static void reclaimer_stop(tfs_ctx *fs) {
+    pthread_mutex_lock(&fs->reclaim_queue.mutex);
+    if (!fs->reclaim_queue.running) {
+        pthread_mutex_unlock(&fs->reclaim_queue.mutex);
+        return;
+    }
+    fs->reclaim_queue.stop = true;
+    pthread_cond_signal(&fs->reclaim_queue.cond);
+    pthread_mutex_unlock(&fs->reclaim_queue.mutex);
+
+    pthread_join(fs->reclaim_queue.thread, NULL);
+    fs->reclaim_queue.running = false;
+}
+
+/*
+ * Registers a new open file handle to an i-node
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if the file was unlinked
+ */
+int inode_open(tfs_ctx *fs, int inumber) {
+    inode_t *inode = inode_slot(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&inode->rwlock);
+    if (inode->i_unlinked) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        return -1;
+    }
+    inode->i_open_count++;
+    pthread_rwlock_unlock(&inode->rwlock);
+    return 0;
+}
+
+/*
+ * Unregisters an open file handle to an i-node; when the last handle to an
+ * unlinked file is closed, the file is queued for reclamation
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_close(tfs_ctx *fs, int inumber) {
+    inode_t *inode = inode_slot(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&inode->rwlock);
+    if (--inode->i_open_count == 0 && inode->i_unlinked) {
+        reclaim_enqueue(fs, inumber);
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+    return 0;
+}
+
+/*
+ * Marks an i-node as removed from its directory. It is reclaimed in the
+ * background once it has no open file handles.
+ * Input:
+ *  - inumber: i-node's number
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_unlink(tfs_ctx *fs, int inumber) {
+    inode_t *inode = inode_slot(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&inode->rwlock);
+    inode->i_unlinked = true;
+    if (inode->i_open_count == 0) {
+        reclaim_enqueue(fs, inumber);
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+    return 0;
+}
+
+/*
+ * Frees all the data blocks of a file (in a single batch) and sets its size
+ * to 0.
+ * The caller must hold the i-node's lock for writing.
+ * Input:
+ *  - inode: the file's i-node
+ * Returns: 0 if successful, -1 if failed
+ */
+int inode_truncate(tfs_ctx *fs, inode_t *inode) {
+    int blocks[MAX_FILE_BLOCKS + 1];
+    size_t n = 0;
+
+    // DIRECT BLOCKS
+    for (size_t i = 0; i < DIRECT_BLOCKS; i++) {
+        if (inode->direct_blocks[i] != -1) {
+            blocks[n++] = inode->direct_blocks[i];
+        }
+    }
+    // INDIRECT BLOCKS
+    if (inode->indirect_block != -1) {
+        int *indirect_block = data_block_get(fs, inode->indirect_block);
+        if (indirect_block == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < INDIRECT_BLOCKS; i++) {
+            if (indirect_block[i] != -1) {
+                blocks[n++] = indirect_block[i];
+            }
+        }
+        blocks[n++] = inode->indirect_block;
+    }
+
+    if (data_blocks_free_batch(fs, blocks, n) == -1) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < DIRECT_BLOCKS; i++) {
+        inode->direct_blocks[i] = -1;
+    }
+    inode->indirect_block = -1;
+    inode->i_size = 0;
+    inode->i_map_gen++;
+
+    /* Pending appends are dropped (they wake up and find the new
+     * generation) */
+    pthread_mutex_lock(&fs->append_mutex);
+    atomic_store(&inode->i_append_end, 0);
+    inode->i_append_published = 0;
+    inode->i_append_gen++;
+    for (size_t i = 0; i < APPEND_WAIT_SLOTS; i++) {
+        pthread_cond_broadcast(&fs->append_conds[i]);
+    }
+    pthread_mutex_unlock(&fs->append_mutex);
+    return 0;
+}
+
+/*
+ * Allocates (in a single batch) the missing data blocks in a range of a
+ * file's blocks, including the indirect block if needed.
+ * The caller must hold the i-node's lock for writing.
+ * Input:
+ *  - inode: the file's i-node
+ *  - first: index of the first block of the range within the file
+ *  - count: number of blocks in the range
+ *  - contiguous: whether the blocks should be a single run of consecutive
+ *    data blocks (when one is free)
+ * Returns: 0 if successful, -1 if failed (in which case no block is
+ *  allocated)
+ */
+int inode_blocks_alloc(tfs_ctx *fs, inode_t *inode, size_t first, size_t count,
+                       bool contiguous) {
+    int blocks[MAX_FILE_BLOCKS + 1];
+    int *indirect_block = NULL;
+    size_t end = first + count, missing = 0, next = 0;
+
+    if (end > MAX_FILE_BLOCKS) {
+        return -1;
+    }
+    bool needs_indirect = end > DIRECT_BLOCKS && inode->indirect_block == -1;
+    if (end > DIRECT_BLOCKS && !needs_indirect) {
+        indirect_block = data_block_get(fs, inode->indirect_block);
+        if (indirect_block == NULL) {
+            return -1;
+        }
+    }
+
+    for (size_t i = first; i < end; i++) {
+        if (i < DIRECT_BLOCKS ? inode->direct_blocks[i] == -1
+                              : indirect_block == NULL ||
+                                    indirect_block[i - DIRECT_BLOCKS] == -1) {
+            missing++;
+        }
+    }
+    if (missing == 0) {
+        return 0;
+    }
+    if ((contiguous ? data_blocks_alloc_contiguous(fs, blocks,
+                                                   missing + needs_indirect)
+                    : data_blocks_alloc_batch(fs, blocks,
+                                              missing + needs_indirect)) == -1) {
+        return -1;
+    }
+
+    if (needs_indirect) {
+        inode->indirect_block = blocks[next++];
+        indirect_block = data_block_get(fs, inode->indirect_block);
+        for (size_t i = 0; i < INDIRECT_BLOCKS; i++) {
+            indirect_block[i] = -1;
+        }
+    }
+    for (size_t i = first; i < end; i++) {
+        int *slot = i < DIRECT_BLOCKS ? &inode->direct_blocks[i]
+                                      : &indirect_block[i - DIRECT_BLOCKS];
+        if (*slot == -1) {
+            *slot = blocks[next++];
+        }
+    }
+    if (end > DIRECT_BLOCKS) {
+        data_block_dirty(fs, inode->indirect_block);
+    }
+    return 0;
+}
+
+/*
+ * Reserves a range at the end of a file for an append.
+ * The caller must hold the i-node's lock for reading.
+ * Input:
+ *  - inode: the file's i-node
+ *  - len: length of the range
+ *  - gen: where to store the append generation the range belongs to
+ * Returns: the offset of the range
+ */
+size_t inode_append_reserve(inode_t *inode, size_t len, unsigned int *gen) {
+    /* Truncations need the lock for writing, so the generation is stable */
+    *gen = inode->i_append_gen;
+    return atomic_fetch_add(&inode->i_append_end, len);
+}
+
+/*
+ * Publishes an append once every range reserved before it is published:
+ * extends the file's size over the bytes written and stores the checksums
+ * of the blocks it shares with the neighbouring ranges.
+ * Input:
+ *  - inode: the file's i-node (the caller must not hold its lock)
+ *  - start: offset of the reserved range
+ *  - reserved_end: end of the reserved range
+ *  - written_end: end of the bytes written (less than reserved_end if the
+ *    append was cut short)
+ *  - gen: the append generation the range belongs to
+ * Returns: 0 if successful, -1 if the file was truncated in the meantime
+ */
+int inode_append_publish(tfs_ctx *fs, inode_t *inode, size_t start,
+                         size_t reserved_end, size_t written_end,
+                         unsigned int gen) {
+    pthread_mutex_lock(&fs->append_mutex);
+    while (inode->i_append_gen == gen && inode->i_append_published != start) {
+        pthread_cond_wait(append_cond(fs, start), &fs->append_mutex);
+    }
+    bool truncated = inode->i_append_gen != gen;
+    pthread_mutex_unlock(&fs->append_mutex);
+    if (truncated) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&inode->rwlock);
+    if (inode->i_append_gen != gen) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        return -1;
+    }
+
+    if (written_end > start) {
+        size_t first = start / BLOCK_SIZE, last = (written_end - 1) / BLOCK_SIZE;
+        if (start % BLOCK_SIZE != 0) {
+            data_block_seal(fs, inode_block_get(fs, inode, first, false));
+        }
+        if (last != first && written_end % BLOCK_SIZE != 0) {
+            data_block_seal(fs, inode_block_get(fs, inode, last, false));
+        }
+    }
+    if (written_end > inode->i_size) {
+        inode->i_size = written_end;
+    }
+
+    pthread_mutex_lock(&fs->append_mutex);
+    inode->i_append_published = reserved_end;
+    pthread_cond_broadcast(append_cond(fs, reserved_end));
+    pthread_mutex_unlock(&fs->append_mutex);
+    pthread_rwlock_unlock(&inode->rwlock);
+    return 0;
+}
+
+/*
+ * Moves the end of the file for appends to its size, after a write other
+ * than an append extended it (unless appends are pending)
+ * The caller must hold the i-node's lock for writing.
+ */
+void inode_append_sync(tfs_ctx *fs, inode_t *inode) {
+    pthread_mutex_lock(&fs->append_mutex);
+    size_t end = atomic_load(&inode->i_append_end);
+    if (end == inode->i_append_published && inode->i_size > end) {
+        atomic_store(&inode->i_append_end, inode->i_size);
+        inode->i_append_published = inode->i_size;
+    }
+    pthread_mutex_unlock(&fs->append_mutex);
+}
+
+/*
+ * Whether a block of a file is its last block and is not full: appends may
+ * be writing the rest of it while holding the lock for reading, so its
+ * checksum cannot be verified.
+ * The caller must hold the i-node's lock.
+ */
+bool inode_block_is_tail(inode_t const *inode, size_t index) {
+    return index * BLOCK_SIZE < inode->i_size &&
+           (index + 1) * BLOCK_SIZE > inode->i_size;
+}
+
+/*
+ * Returns a pointer to an existing i-node.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: pointer if successful, NULL if failed
+ */
+inode_t *inode_get(tfs_ctx *fs, int inumber) {
+    inode_t *inode = inode_slot(fs, inumber);
+    if (inode == NULL) {
+        return NULL;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node
+    return inode;
+}
+
+/*
+ * Returns the data block holding a given block of a file.
+ * The caller must hold the i-node's lock (for writing, if alloc is set).
+ * Input:
+ *  - inode: the file's i-node
+ *  - index: index of the block within the file
+ *  - alloc: whether a missing block (and indirect block) should be allocated
+ * Returns: block index if successful, -1 if the block does not exist
+ */
+int inode_block_get(tfs_ctx *fs, inode_t *inode, size_t index, bool alloc) {
+    // DIRECT BLOCKS
+    if (index < DIRECT_BLOCKS) {
+        if (inode->direct_blocks[index] == -1 && alloc) {
+            inode->direct_blocks[index] = data_block_alloc(fs);
+        }
+        return inode->direct_blocks[index];
+    }
+
+    // INDIRECT BLOCKS
+    index -= DIRECT_BLOCKS;
+    if (index >= INDIRECT_BLOCKS) {
+        return -1;
+    }
+    if (inode->indirect_block == -1) {
+        if (!alloc ||
+            inode_block_set(fs, inode, DIRECT_BLOCKS + index, -1) == -1) {
+            return -1;
+        }
+    }
+    int *indirect_block = data_block_get(fs, inode->indirect_block);
+    if (indirect_block == NULL) {
+        return -1;
+    }
+    if (indirect_block[index] == -1 && alloc) {
+        indirect_block[index] = data_block_alloc(fs);
+        data_block_dirty(fs, inode->indirect_block);
+    }
+    return indirect_block[index];
+}
+
+/*
+ * Returns the data block holding a given block of a file, using (and
+ * updating) a cursor with the last lookup made through an open file: a
+ * lookup in the indirect range only reads the i-node's indirect block once
+ * while the map generation stays the same.
+ * The caller must hold the i-node's lock and own the cursor.
+ * Input:
+ *  - inode: the file's i-node
+ *  - cursor: the cursor of the open file
+ *  - index: index of the block within the file
+ * Returns: block index if successful, -1 if the block does not exist
+ */
+int inode_block_lookup(tfs_ctx *fs, inode_t *inode, block_cursor_t *cursor,
+                       size_t index) {
+    if (cursor->gen != inode->i_map_gen) {
+        cursor->gen = inode->i_map_gen;
+        cursor->index = SIZE_MAX;
+        cursor->indirect_block = NULL;
+    }
+    if (index == cursor->index) {
+        return cursor->block_number;
+    }
+
+    int b;
+    if (index < DIRECT_BLOCKS) {
+        b = inode->direct_blocks[index];
+    } else if (index < MAX_FILE_BLOCKS) {
+        /* Holes filled later are seen through the pinned indirect block;
+         * replacing or freeing it changes the map generation */
+        if (cursor->indirect_block == NULL) {
+            cursor->indirect_block = data_block_get(fs, inode->indirect_block);
+            if (cursor->indirect_block == NULL) {
+                return -1;
+            }
+        }
+        b = cursor->indirect_block[index - DIRECT_BLOCKS];
+    } else {
+        return -1;
+    }
+
+    if (b != -1) {
+        cursor->index = index;
+        cursor->block_number = b;
+    }
+    return b;
+}
+
+/*
+ * Sets the data block holding a given block of a file, allocating the
+ * indirect block if needed. The previous block (if any) is not freed.
+ * The caller must hold the i-node's lock for writing.
+ * Input:
+ *  - inode: the file's i-node
+ *  - index: index of the block within the file
+ *  - block_number: the new data block (-1 to leave the block unmapped)
+ * Returns: 0 if successful, -1 otherwise
+ */
+int inode_block_set(tfs_ctx *fs, inode_t *inode, size_t index,
+                    int block_number) {
+    inode->i_map_gen++;
+    if (index < DIRECT_BLOCKS) {
+        inode->direct_blocks[index] = block_number;
+        return 0;
+    }
+
+    index -= DIRECT_BLOCKS;
+    if (index >= INDIRECT_BLOCKS) {
+        return -1;
+    }
+    if (inode->indirect_block == -1) {
+        int b = data_block_alloc(fs);
+        int *indirect_block = data_block_get(fs, b);
+        if (indirect_block == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < INDIRECT_BLOCKS; i++) {
+            indirect_block[i] = -1;
+        }
+        inode->indirect_block = b;
+    }
+    int *indirect_block = data_block_get(fs, inode->indirect_block);
+    if (indirect_block == NULL) {
+        return -1;
+    }
+    indirect_block[index] = block_number;
+    data_block_dirty(fs, inode->indirect_block);
+    return 0;
+}
+
+/*
+ * Returns the data block holding a given block of a file, ready to be
+ * modified: a missing block is allocated, and a block shared with other
+ * files is first copied (copy-on-write).
+ * The caller must hold the i-node's lock for writing.
+ * Input:
+ *  - inode: the file's i-node
+ *  - index: index of the block within the file
+ *  - cursor: cursor of the open file used to find the block (may be NULL)
+ * Returns: block index if successful, -1 otherwise
+ */
+int inode_block_get_private(tfs_ctx *fs, inode_t *inode, size_t index,
+                            block_cursor_t *cursor) {
+    int b = cursor != NULL ? inode_block_lookup(fs, inode, cursor, index) : -1;
+    if (b == -1) {
+        b = inode_block_get(fs, inode, index, true);
+    }
+    int refs = data_block_unindex(fs, b);
+    if (refs <= 1) {
+        return refs == -1 ? -1 : b;
+    }
+
+    int copy = data_block_alloc(fs);
+    void *dst = data_block_get(fs, copy);
+    void *src = data_block_get(fs, b);
+    if (dst == NULL || src == NULL) {
+        data_block_free(fs, copy);
+        return -1;
+    }
+    memcpy(dst, src, BLOCK_SIZE);
+    data_block_dirty(fs, copy);
+    inode_block_set(fs, inode, index, copy);
+    data_block_free(fs, b);
+    return copy;
+}
+
+/*
+ * Makes a file share all the data blocks of another file, which become
+ * copy-on-write for both.
+ * The caller must hold the lock of the source i-node (for reading) and of
+ * the destination i-node (for writing), which must be an empty file.
+ * Input:
+ *  - inode: the destination i-node
+ *  - source: the source i-node
+ * Returns: 0 if successful, -1 otherwise
+ */
+int inode_share_blocks(tfs_ctx *fs, inode_t *inode, inode_t const *source) {
+    int blocks[MAX_FILE_BLOCKS];
+    int *source_entries = NULL, *entries = NULL;
+    size_t n = 0;
+
+    for (size_t i = 0; i < DIRECT_BLOCKS; i++) {
+        if (source->direct_blocks[i] != -1) {
+            blocks[n++] = source->direct_blocks[i];
+        }
+    }
+    if (source->indirect_block != -1) {
+        source_entries = data_block_get(fs, source->indirect_block);
+        if (source_entries == NULL) {
+            return -1;
+        }
+        for (size_t i = 0; i < INDIRECT_BLOCKS; i++) {
+            if (source_entries[i] != -1) {
+                blocks[n++] = source_entries[i];
+            }
+        }
+
+        /* The indirect block itself is copied, as it is part of the block
+         * map */
+        if (inode_block_set(fs, inode, DIRECT_BLOCKS, -1) == -1) {
+            return -1;
+        }
+        entries = data_block_get(fs, inode->indirect_block);
+    }
+
+    if (data_blocks_ref_batch(fs, blocks, n) == -1) {
+        return -1;
+    }
+
+    inode->i_flags = source->i_flags;
+    inode->i_size = source->i_size;
+    inode_append_sync(fs, inode);
+    memcpy(inode->direct_blocks, source->direct_blocks,
+           sizeof(inode->direct_blocks));
+    if (source_entries != NULL) {
+        memcpy(entries, source_entries, INDIRECT_BLOCKS * sizeof(int));
+        data_block_dirty(fs, inode->indirect_block);
+    }
+    return 0;
+}
+
+/*
+ * Lists the data blocks mapped by a file, in file order (holes are
+ * skipped; the indirect block itself is not included)
+ * The caller must hold the i-node's lock.
+ * Input:
+ *  - inode: the file's i-node
+ *  - blocks: where to store the data blocks
+ *  - indexes: where to store the index of each block within the file
+ * Returns: the number of blocks, -1 if failed
+ */
+static ssize_t inode_mapped_blocks(tfs_ctx *fs, inode_t *inode, int *blocks,
+                                   size_t *indexes) {
+    int *indirect_block = NULL;
+    if (inode->indirect_block != -1) {
+        indirect_block = data_block_get(fs, inode->indirect_block);
+        if (indirect_block == NULL) {
+            return -1;
+        }
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < MAX_FILE_BLOCKS; i++) {
+        int b = i < DIRECT_BLOCKS ? inode->direct_blocks[i]
+                : indirect_block != NULL ? indirect_block[i - DIRECT_BLOCKS]
+                                         : -1;
+        if (b != -1) {
+            blocks[n] = b;
+            indexes[n++] = i;
+        }
+    }
+    return (ssize_t)n;
+}
+
+static size_t count_extents(int const *blocks, size_t n) {
+    size_t extents = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || blocks[i] != blocks[i - 1] + 1) {
+            extents++;
+        }
+    }
+    return extents;
+}
+
+/*
+ * Measures how fragmented a file is
+ * The caller must hold the i-node's lock.
+ * Input:
+ *  - inode: the file's i-node
+ *  - frag: where to store the number of blocks and of extents
+ * Returns: 0 if successful, -1 otherwise
+ */
+int inode_fragmentation(tfs_ctx *fs, inode_t *inode, fragmentation_t *frag) {
+    int blocks[MAX_FILE_BLOCKS];
+    size_t indexes[MAX_FILE_BLOCKS];
+    ssize_t n = inode_mapped_blocks(fs, inode, blocks, indexes);
+    if (n == -1) {
+        return -1;
+    }
+    frag->blocks = (size_t)n;
+    frag->extents = count_extents(blocks, (size_t)n);
+    return 0;
+}
+
+/*
+ * Whether any of several blocks is shared with another block map
+ */
+static bool data_blocks_shared(tfs_ctx *fs, int const *blocks, size_t n) {
+    bool shared = false;
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    for (size_t i = 0; i < n && !shared; i++) {
+        shared = fs->free_blocks.refs[blocks[i]] > 1;
+    }
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return shared;
+}
+
+/*
+ * Moves the data blocks of a file into a single run of consecutive blocks.
+ * The blocks are copied holding the i-node's lock for reading, so the file
+ * stays readable; the block map is then switched holding it for writing,
+ * after copying again whatever was written meanwhile.
+ * Files that share blocks with others are left alone (moving their blocks
+ * would take the space they save).
+ * The caller must not hold the i-node's lock.
+ * Input:
+ *  - inumber: the file's i-node number
+ * Returns: the number of blocks moved (0 if the file is not fragmented or
+ *  there is no free run large enough), -1 if failed
+ */
+int inode_defrag(tfs_ctx *fs, int inumber) {
+    int old[MAX_FILE_BLOCKS], new[MAX_FILE_BLOCKS];
+    size_t indexes[MAX_FILE_BLOCKS];
+    inode_t *inode = inode_slot(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    pthread_rwlock_rdlock(&inode->rwlock);
+    unsigned int gen = inode->i_map_gen;
+    size_t size = inode->i_size;
+    ssize_t found = inode->i_node_type == T_FILE
+                        ? inode_mapped_blocks(fs, inode, old, indexes)
+                        : 0;
+    if (found <= 0) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        return found == -1 ? -1 : 0;
+    }
+    size_t n = (size_t)found;
+    if (count_extents(old, n) <= 1 || data_blocks_shared(fs, old, n) ||
+        data_blocks_alloc_contiguous(fs, new, n) == -1) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        return 0;
+    }
+    if (count_extents(new, n) != 1) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        data_blocks_free_batch(fs, new, n);
+        return 0;
+    }
+
+    /* Blocks past the file's size (or holding its last bytes) may be
+     * written by appends meanwhile, so they are only copied below */
+    int result = 0;
+    for (size_t i = 0; i < n && result == 0; i++) {
+        if ((indexes[i] + 1) * BLOCK_SIZE <= size) {
+            void *dst = data_block_get(fs, new[i]);
+            void const *src = data_block_get(fs, old[i]);
+            if (dst == NULL || src == NULL) {
+                result = -1;
+            } else {
+                memcpy(dst, src, BLOCK_SIZE);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+
+    pthread_rwlock_wrlock(&inode->rwlock);
+    /* Every map change that frees a block changes the generation; holes
+     * filled meanwhile are simply left where they are */
+    if (result == 0 && inode->i_map_gen != gen) {
+        result = 1;
+    }
+    for (size_t i = 0; i < n && result == 0; i++) {
+        char *dst = data_block_get(fs, new[i]);
+        char const *src = data_block_get(fs, old[i]);
+        if (dst == NULL || src == NULL) {
+            result = -1;
+            break;
+        }
+        if ((indexes[i] + 1) * BLOCK_SIZE > size ||
+            memcmp(dst, src, BLOCK_SIZE) != 0) {
+            memcpy(dst, src, BLOCK_SIZE);
+        }
+        fs->block_checksums.crc[new[i]] = fs->block_checksums.crc[old[i]];
+        fs->block_checksums.valid[new[i]] =
+            fs->block_checksums.valid[old[i]];
+        data_block_dirty(fs, new[i]);
+    }
+    /* Cannot fail, as the blocks are already mapped (and the indirect
+     * block, if needed, exists) */
+    for (size_t i = 0; i < n && result == 0; i++) {
+        inode_block_set(fs, inode, indexes[i], new[i]);
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+
+    if (result != 0) {
+        data_blocks_free_batch(fs, new, n);
+        return result == 1 ? 0 : -1;
+    }
+    data_blocks_free_batch(fs, old, n);
+    return (int)n;
+}
+
+/*
+ * Adds an entry to the i-node directory data.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
+ * Returns: SUCCESS or FAIL
+ */
+int add_dir_entry(tfs_ctx *fs, int inumber, int sub_inumber,
+                  char const *sub_name) {
+    inode_t *dir = inode_slot(fs, inumber);
+    if (dir == NULL || inode_slot(fs, sub_inumber) == NULL) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+
+    if (dir->i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    if (strlen(sub_name) == 0) {
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries */
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, dir->direct_blocks[0]);
+    if (dir_entry == NULL) {
+        return -1;
+    }
+
+    /* Finds and fills the first empty entry */
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber == -1) {
+            dir_entry[i].d_inumber = sub_inumber;
+            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
+            dir_entry[i].d_name[MAX_FILE_NAME - 1] = 0;
+            data_block_dirty(fs, dir->direct_blocks[0]);
+            dir_index_update(fs, dir, dir_entry);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Removes an entry from the i-node directory data.
+ * The caller must hold the directory i-node's lock for writing.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - sub_name: name of the sub i-node entry
+ * Returns: the removed entry's i-node number, -1 if not found
+ */
+int clear_dir_entry(tfs_ctx *fs, int inumber, char const *sub_name) {
+    inode_t *dir = inode_slot(fs, inumber);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+
+    if (dir->i_node_type != T_DIRECTORY) {
+        return -1;
+    }
+
+    /* Locates the block containing the directory's entries */
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, dir->direct_blocks[0]);
+    if (dir_entry == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if ((dir_entry[i].d_inumber != -1) &&
+            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
+            int sub_inumber = dir_entry[i].d_inumber;
+            dir_entry[i].d_inumber = -1;
+            data_block_dirty(fs, dir->direct_blocks[0]);
+            dir_index_update(fs, dir, dir_entry);
+            return sub_inumber;
+        }
+    }
+    return -1;
+}
+
+/* Looks for a given name inside a directory
+ * Input:
+ * 	- parent directory's i-node number
+ * 	- name to search
+ * 	Returns i-number linked to the target name, -1 if not found
+ */
+int find_in_dir(tfs_ctx *fs, int inumber, char const *sub_name) {
+    insert_delay(); // simulate storage access delay to i-node with inumber
+
+    inode_t *dir = inode_slot(fs, inumber);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    /* Looks the name up in the directory's index, without locking it (only
+     * directories have an index) */
+    unsigned int token = rcu_read_lock(&fs->rcu);
+    dir_index_t const *index = atomic_load(&dir->i_dir_index);
+    if (index != NULL) {
+        uint32_t hash = name_hash(sub_name);
+        int sub_inumber = -1;
+        for (size_t i = 0; i < index->count; i++) {
+            if (index->entries[i].hash == hash &&
+                strncmp(index->entries[i].name, sub_name, MAX_FILE_NAME) ==
+                    0) {
+                sub_inumber = index->entries[i].inumber;
+                break;
+            }
+        }
+        rcu_read_unlock(&fs->rcu, token);
+        return sub_inumber;
+    }
+    rcu_read_unlock(&fs->rcu, token);
+
+    pthread_rwlock_rdlock(&dir->rwlock);
+    if (dir->i_node_type != T_DIRECTORY) {
+        pthread_rwlock_unlock(&dir->rwlock);
+        return -1;
+    }
+    /* Locates the block containing the directory's entries */
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(fs, dir->direct_blocks[0]);
+    if (dir_entry == NULL) {
+        pthread_rwlock_unlock(&dir->rwlock);
+        return -1;
+    }
+
+    /* Iterates over the directory entries looking for one that has the target
+     * name (holding the lock, as entries can be removed concurrently) */
+    int sub_inumber = -1;
+    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
+        if ((dir_entry[i].d_inumber != -1) &&
+            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
+            sub_inumber = dir_entry[i].d_inumber;
+            break;
+        }
+    pthread_rwlock_unlock(&dir->rwlock);
+    return sub_inumber;
+}
+
+/* Copies the entries of a directory, in batches: each call continues
+ * where the previous one (with the same cursor) stopped
+ * Input:
+ * 	- directory's i-node number
+ * 	- cursor, 0 before the first call; entries never move, so an entry
+ * 	  that is in the directory during the whole enumeration is returned
+ * 	  exactly once, even if others are added or removed meanwhile
+ * 	- destination array and its length
+ * 	Returns the number of entries copied (0 once all were returned), -1 if
+ * 	unsuccessful
+ */
+ssize_t read_dir_entries(tfs_ctx *fs, int inumber, size_t *cursor,
+                         dir_entry_t *entries, size_t n) {
+    inode_t *inode = inode_slot(fs, inumber);
+    if (inode == NULL) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to i-node with inumber
+
+    pthread_rwlock_rdlock(&inode->rwlock);
+    dir_entry_t *dir_entry = inode->i_node_type == T_DIRECTORY
+                                 ? data_block_get(fs, inode->direct_blocks[0])
+                                 : NULL;
+    if (dir_entry == NULL) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        return -1;
+    }
+
+    size_t count = 0;
+    size_t i = *cursor;
+    for (; i < MAX_DIR_ENTRIES && count < n; i++) {
+        if (dir_entry[i].d_inumber != -1) {
+            entries[count++] = dir_entry[i];
+        }
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+
+    *cursor = i;
+    return (ssize_t)count;
+}
+
+/*
+ * Returns whether a data block is in use
+ * (free_blocks.mutex must be held)
+ */
+static inline bool block_taken(tfs_ctx *fs, int block_number) {
+    uint64_t word =
+        fs->free_blocks.bitmap[(size_t)block_number / BLOCKS_PER_WORD];
+    return (word >> (size_t)block_number % BLOCKS_PER_WORD & 1) != 0;
+}
+
+/*
+ * Finds up to n free data blocks, in increasing order, and maps the chunks
+ * that hold them. The scan starts at the first word with a free bit and
+ * skips words whose blocks are all taken, so allocating on a filling
+ * volume does not go over the blocks already taken.
+ * (free_blocks.mutex must be held)
+ * Returns: the number of blocks found
+ */
+static size_t free_blocks_find(tfs_ctx *fs, int *blocks, size_t n) {
+    size_t words =
+        (fs->fs_data.block_count + BLOCKS_PER_WORD - 1) / BLOCKS_PER_WORD;
+    size_t first = fs->free_blocks.first_free;
+    size_t found = 0;
+    bool hinted = false;
+    for (size_t w = first; w < words && found < n; w++) {
+        if (w == first || w * sizeof(uint64_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to free_blocks
+        }
+        uint64_t word = fs->free_blocks.bitmap[w];
+        if (word != UINT64_MAX && !hinted) {
+            fs->free_blocks.first_free = w;
+            hinted = true;
+        }
+        while (word != UINT64_MAX && found < n) {
+            size_t bit = (size_t)__builtin_ctzll(~word);
+            int b = (int)(w * BLOCKS_PER_WORD + bit);
+            if (data_chunk_map(fs, b) == -1) {
+                return found;
+            }
+            blocks[found++] = b;
+            word |= 1ull << bit;
+        }
+    }
+    if (!hinted) {
+        fs->free_blocks.first_free = words;
+    }
+    return found;
+}
+
+/*
+ * Marks a free data block as taken by a single block map
+ * (free_blocks.mutex must be held)
+ */
+static void block_take(tfs_ctx *fs, int block_number) {
+    fs->free_blocks.bitmap[(size_t)block_number / BLOCKS_PER_WORD] |=
+        1ull << (size_t)block_number % BLOCKS_PER_WORD;
+    fs->free_blocks.refs[block_number] = 1;
+    fs->block_checksums.valid[block_number] = false;
+    data_block_set_resident(fs, block_number);
+}
+
+/*
+ * Allocated a new data block
+ * Returns: block index if successful, -1 otherwise
+ */
+int data_block_alloc(tfs_ctx *fs) {
+    int block_number;
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    if (free_blocks_find(fs, &block_number, 1) == 0) {
+        pthread_mutex_unlock(&fs->free_blocks.mutex);
+        return -1;
+    }
+    block_take(fs, block_number);
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return block_number;
+}
+
+/*
+ * Allocates several data blocks at once, paying for a single pass over
+ * free_blocks
+ * Input:
+ *  - blocks: where to store the indexes of the allocated blocks
+ *  - n: number of blocks to allocate
+ * Returns: 0 if successful, -1 otherwise (in which case no block is
+ *  allocated)
+ */
+int data_blocks_alloc_batch(tfs_ctx *fs, int *blocks, size_t n) {
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    if (free_blocks_find(fs, blocks, n) < n) {
+        pthread_mutex_unlock(&fs->free_blocks.mutex);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        block_take(fs, blocks[i]);
+    }
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return 0;
+}
+
+/*
+ * Allocates several data blocks at once as a single run of consecutive
+ * blocks (the first run that is large enough); if there is none, the
+ * blocks are allocated as by data_blocks_alloc_batch
+ * Input:
+ *  - blocks: where to store the indexes of the allocated blocks
+ *  - n: number of blocks to allocate
+ * Returns: 0 if successful, -1 otherwise (in which case no block is
+ *  allocated)
+ */
+int data_blocks_alloc_contiguous(tfs_ctx *fs, int *blocks, size_t n) {
+    size_t words =
+        (fs->fs_data.block_count + BLOCKS_PER_WORD - 1) / BLOCKS_PER_WORD;
+    size_t run = 0, start = 0;
+
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    size_t first = fs->free_blocks.first_free;
+    for (size_t w = first; w < words && run < n; w++) {
+        if (w == first || w * sizeof(uint64_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to free_blocks
+        }
+        /* Whole words of free or taken blocks are skipped at once */
+        uint64_t word = fs->free_blocks.bitmap[w];
+        if (word == UINT64_MAX) {
+            run = 0;
+        } else if (word == 0) {
+            if (run == 0) {
+                start = w * BLOCKS_PER_WORD;
+            }
+            run += BLOCKS_PER_WORD;
+        } else {
+            for (size_t bit = 0; bit < BLOCKS_PER_WORD && run < n; bit++) {
+                if (word >> bit & 1) {
+                    run = 0;
+                } else if (run++ == 0) {
+                    start = w * BLOCKS_PER_WORD + bit;
+                }
+            }
+        }
+    }
+    if (run < n) {
+        pthread_mutex_unlock(&fs->free_blocks.mutex);
+        return data_blocks_alloc_batch(fs, blocks, n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (data_chunk_map(fs, (int)(start + i)) == -1) {
+            pthread_mutex_unlock(&fs->free_blocks.mutex);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        blocks[i] = (int)(start + i);
+        block_take(fs, blocks[i]);
+    }
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return 0;
+}
+
+/*
+ * Removes a block from the dedup index, if it is there
+ * (free_blocks.mutex must be held)
+ */
+static void dedup_index_remove(tfs_ctx *fs, int block_number) {
+    if (!fs->dedup_index.indexed[block_number]) {
+        return;
+    }
+    int *link =
+        &fs->dedup_index.buckets[fs->dedup_index.fingerprint[block_number] %
+                                 fs->fs_data.block_count];
+    while (*link != block_number) {
+        link = &fs->dedup_index.next[*link];
+    }
+    *link = fs->dedup_index.next[block_number];
+    fs->dedup_index.indexed[block_number] = false;
+}
+
+/*
+ * Drops a reference to a block, freeing it if it was the last one
+ * (free_blocks.mutex must be held)
+ */
+static void block_release(tfs_ctx *fs, int block_number) {
+    if (--fs->free_blocks.refs[block_number] <= 0) {
+        size_t w = (size_t)block_number / BLOCKS_PER_WORD;
+        fs->free_blocks.refs[block_number] = 0;
+        fs->free_blocks.bitmap[w] &=
+            ~(1ull << (size_t)block_number % BLOCKS_PER_WORD);
+        if (w < fs->free_blocks.first_free) {
+            fs->free_blocks.first_free = w;
+        }
+        dedup_index_remove(fs, block_number);
+    }
+}
+
+/* Frees a data block
+ * (a block shared by several files is only freed once all of them have
+ * released it)
+ * Input
+ * 	- the block index
+ * Returns: 0 if success, -1 otherwise
+ */
+int data_block_free(tfs_ctx *fs, int block_number) {
+    if (!valid_block_number(fs, block_number)) {
+        return -1;
+    }
+
+    insert_delay(); // simulate storage access delay to free_blocks
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    block_release(fs, block_number);
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return 0;
+}
+
+/* Frees several data blocks at once, paying for a single access to
+ * free_blocks
+ * Input
+ * 	- blocks: the block indexes
+ * 	- n: number of blocks
+ * Returns: 0 if success, -1 otherwise (in which case no block is freed)
+ */
+int data_blocks_free_batch(tfs_ctx *fs, int const *blocks, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!valid_block_number(fs, blocks[i])) {
+            return -1;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    insert_delay(); // simulate storage access delay to free_blocks
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    for (size_t i = 0; i < n; i++) {
+        block_release(fs, blocks[i]);
+    }
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return 0;
+}
+
+/* Adds a reference to each of several data blocks that are being shared
+ * Input
+ * 	- blocks: the block indexes
+ * 	- n: number of blocks
+ * Returns: 0 if success, -1 otherwise (in which case no reference is added)
+ */
+int data_blocks_ref_batch(tfs_ctx *fs, int const *blocks, size_t n) {
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    for (size_t i = 0; i < n; i++) {
+        if (!valid_block_number(fs, blocks[i]) ||
+            !block_taken(fs, blocks[i])) {
+            pthread_mutex_unlock(&fs->free_blocks.mutex);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        fs->free_blocks.refs[blocks[i]]++;
+    }
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return 0;
+}
+
+/* Removes a data block from the dedup index, so that no other file starts
+ * sharing it; must be called before modifying the block's contents
+ * Input
+ * 	- the block index
+ * Returns: the block's reference count, -1 if failed
+ */
+int data_block_unindex(tfs_ctx *fs, int block_number) {
+    if (!valid_block_number(fs, block_number)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    dedup_index_remove(fs, block_number);
+    int refs = fs->free_blocks.refs[block_number];
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return refs;
+}
+
+/* Computes the fingerprint of a block's contents (64-bit FNV-1a over
+ * 8-byte words) */
+static uint64_t block_fingerprint(void const *block) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < BLOCK_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, (char const *)block + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+    }
+    return hash ^ (hash >> 32);
+}
+
+/* Deduplicates a data block: looks for another block with the same
+ * contents and, if none exists, indexes this one.
+ * Input
+ * 	- the block index
+ * Returns: the index of the block with the same contents, with a new
+ *   reference that the caller should use instead of its block (which it
+ *   must then free); the block itself if there is none; -1 if failed
+ */
+int data_block_dedup(tfs_ctx *fs, int block_number) {
+    void *block = data_block_get(fs, block_number);
+    if (block == NULL) {
+        return -1;
+    }
+    uint64_t fingerprint = block_fingerprint(block);
+    int *bucket =
+        &fs->dedup_index.buckets[fingerprint % fs->fs_data.block_count];
+
+    insert_delay(); // simulate storage access delay to the dedup index
+    pthread_mutex_lock(&fs->free_blocks.mutex);
+    for (int b = *bucket; b != -1; b = fs->dedup_index.next[b]) {
+        /* Indexed blocks are not modified while they remain in the index,
+         * so their contents can be compared here */
+        if (b == block_number ||
+            fs->dedup_index.fingerprint[b] != fingerprint) {
+            continue;
+        }
+        char const *candidate = data_block_address(fs, b);
+        if (candidate != NULL && memcmp(candidate, block, BLOCK_SIZE) == 0) {
+            fs->free_blocks.refs[b]++;
+            pthread_mutex_unlock(&fs->free_blocks.mutex);
+            return b;
+        }
+    }
+    if (!fs->dedup_index.indexed[block_number]) {
+        fs->dedup_index.fingerprint[block_number] = fingerprint;
+        fs->dedup_index.next[block_number] = *bucket;
+        fs->dedup_index.indexed[block_number] = true;
+        *bucket = block_number;
+    }
+    pthread_mutex_unlock(&fs->free_blocks.mutex);
+    return block_number;
+}
+
+/* Stores the checksum of a file data block, after it is modified
+ * Input
+ * 	- the block index
+ */
+void data_block_seal(tfs_ctx *fs, int block_number) {
+    void *block = data_block_get(fs, block_number);
+    if (block == NULL) {
+        return;
+    }
+    fs->block_checksums.crc[block_number] = crc32c(block, BLOCK_SIZE);
+    fs->block_checksums.valid[block_number] = true;
+    data_block_dirty(fs, block_number);
+}
+
+/* Stages a data block that was modified to be written to the block device
+ * (if any); the caller must still hold the lock that keeps the block from
+ * being modified. Write errors are reported by the next data_region_sync.
+ * Input
+ * 	- the block index
+ */
+void data_block_dirty(tfs_ctx *fs, int block_number) {
+    if (fs->fs_data.device == NULL ||
+        !valid_block_number(fs, block_number)) {
+        return;
+    }
+    char const *block = data_block_address(fs, block_number);
+    if (block != NULL) {
+        blockdev_stage(fs->fs_data.device, (size_t)block_number, block);
+    }
+}
+
+/* Writes the modified data blocks to the block device and waits until they
+ * are stable
+ * Returns: 0 if successful (or if there is no block device), -1 otherwise
+ */
+int data_region_sync(tfs_ctx *fs) {
+    if (fs->fs_data.device == NULL) {
+        return 0;
+    }
+    return blockdev_flush(fs->fs_data.device);
+}
+
+/* Evicts every data block from memory, after writing the modified ones to
+ * the block device; blocks are read back as they are accessed. Pointers
+ * into the data region are invalidated, so no other call may be running
+ * (cursors into indirect blocks are invalidated here).
+ * Returns: 0 if successful, -1 otherwise (or if there is no block device)
+ */
+int data_region_drop(tfs_ctx *fs) {
+    if (fs->fs_data.device == NULL || data_region_sync(fs) == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i < fs->fs_data.block_count; i++) {
+        atomic_store_explicit(&fs->fs_data.resident[i], false,
+                              memory_order_relaxed);
+    }
+    for (size_t i = 0; i < fs->fs_data.chunk_count; i++) {
+        char *chunk = atomic_load(&fs->fs_data.chunks[i]);
+        if (chunk != NULL) {
+            madvise(chunk, DATA_CHUNK_SIZE, MADV_DONTNEED);
+        }
+    }
+    size_t extent = inode_table_extent(fs);
+    for (int i = 0; (size_t)i < extent; i++) {
+        inode_t *inode = inode_at(fs, i);
+        pthread_rwlock_wrlock(&inode->rwlock);
+        inode->i_map_gen++;
+        pthread_rwlock_unlock(&inode->rwlock);
+    }
+    return 0;
+}
+
+static int data_block_check(tfs_ctx *fs, int block_number) {
+    char const *block = data_block_address(fs, block_number);
+    if (block == NULL) {
+        atomic_fetch_add(&fs->checksum_errors, 1);
+        return -1;
+    }
+    if (!fs->block_checksums.valid[block_number] ||
+        crc32c(block, BLOCK_SIZE) == fs->block_checksums.crc[block_number]) {
+        return 0;
+    }
+    atomic_fetch_add(&fs->checksum_errors, 1);
+    return -1;
+}
+
+/* Checks the contents of a data block against its checksum, according to
+ * the verify mode (blocks without a checksum always pass)
+ * Input
+ * 	- the block index
+ * Returns: 0 if the block is (assumed) correct, -1 if it is corrupted
+ */
+int data_block_verify(tfs_ctx *fs, int block_number) {
+    if (!valid_block_number(fs, block_number)) {
+        return -1;
+    }
+
+    switch (atomic_load(&fs->verify_mode)) {
+    case VERIFY_OFF:
+        return 0;
+    case VERIFY_SAMPLED:
+        if (atomic_fetch_add(&fs->verify_count, 1) % VERIFY_SAMPLE_RATE != 0) {
+            return 0;
+        }
+        break;
+    case VERIFY_ALWAYS:
+        break;
+    default:
+        break;
+    }
+    return data_block_check(fs, block_number);
+}
+
+void data_block_set_verify_mode(tfs_ctx *fs, verify_mode_t mode) {
+    atomic_store(&fs->verify_mode, mode);
+}
+
+/* Returns the number of corrupted blocks found so far (by reads and by the
+ * scrubber) */
+size_t data_block_checksum_errors(tfs_ctx *fs) {
+    return atomic_load(&fs->checksum_errors);
+}
+
+/*
+ * Waits for 1/per_second seconds, unless a background thread is asked to
+ * stop meanwhile (stop is protected by mutex and signalled through cond)
+ * Returns: true if the thread should stop, false otherwise
+ */
+static bool background_wait(pthread_mutex_t *mutex, pthread_cond_t *cond,
+                            bool const *stop, unsigned int per_second) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    long delay = 1000000000L / (long)per_second;
+    until.tv_nsec += delay;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(mutex);
+    while (!*stop && pthread_cond_timedwait(cond, mutex, &until) == 0) {
+    }
+    bool stopping = *stop;
+    pthread_mutex_unlock(mutex);
+    return stopping;
+}
+
+/*
+ * Waits between two blocks checked by the scrubber
+ * Returns: true if the scrubber should stop, false otherwise
+ */
+static bool scrubber_wait(tfs_ctx *fs) {
+    return background_wait(&fs->scrubber.mutex, &fs->scrubber.cond,
+                           &fs->scrubber.stop,
+                           fs->scrubber.blocks_per_second);
+}
+
+/*
+ * Checks one block of a file, if the i-node still holds a file
+ * (free i-nodes have an empty block map, so they need not be skipped)
+ * Returns: true if the file has more blocks to check, false otherwise
+ */
+static bool scrub_file_block(tfs_ctx *fs, int inumber, size_t index) {
+    inode_t *inode = inode_at(fs, inumber);
+    bool more = false;
+
+    pthread_rwlock_rdlock(&inode->rwlock);
+    if (inode->i_node_type == T_FILE && index * BLOCK_SIZE < inode->i_size) {
+        int b = inode_block_get(fs, inode, index, false);
+        if (b != -1 && !inode_block_is_tail(inode, index)) {
+            data_block_check(fs, b);
+        }
+        more = true;
+    }
+    pthread_rwlock_unlock(&inode->rwlock);
+    return more;
+}
+
+static void *scrubber_run(void *arg) {
+    tfs_ctx *fs = arg;
+    for (;;) {
+        size_t extent = inode_table_extent(fs);
+        for (int inumber = 0; (size_t)inumber < extent; inumber++) {
+            for (size_t index = 0; scrub_file_block(fs, inumber, index);
+                 index++) {
+                if (scrubber_wait(fs)) {
+                    return NULL;
+                }
+            }
+        }
+        if (scrubber_wait(fs)) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Starts the background scrubber, which keeps verifying the checksums of
+ * all file blocks
+ * Input:
+ *  - blocks_per_second: maximum rate at which blocks are checked
+ * Returns: 0 if successful, -1 otherwise (e.g., if it is already running)
+ */
+int scrubber_start(tfs_ctx *fs, unsigned int blocks_per_second) {
+    if (blocks_per_second == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&fs->scrubber.mutex);
+    if (fs->scrubber.running) {
+        pthread_mutex_unlock(&fs->scrubber.mutex);
+        return -1;
+    }
+    fs->scrubber.blocks_per_second = blocks_per_second;
+    fs->scrubber.stop = false;
+    if (pthread_create(&fs->scrubber.thread, NULL, scrubber_run, fs) != 0) {
+        pthread_mutex_unlock(&fs->scrubber.mutex);
+        return -1;
+    }
+    fs->scrubber.running = true;
+    pthread_mutex_unlock(&fs->scrubber.mutex);
+    return 0;
+}
+
+/*
+ * Stops the background scrubber
+ * Returns: 0 if successful, -1 if it was not running
+ */
+int scrubber_stop(tfs_ctx *fs) {
+    pthread_mutex_lock(&fs->scrubber.mutex);
+    if (!fs->scrubber.running || fs->scrubber.stop) {
+        pthread_mutex_unlock(&fs->scrubber.mutex);
+        return -1;
+    }
+    fs->scrubber.stop = true;
+    pthread_cond_signal(&fs->scrubber.cond);
+    pthread_mutex_unlock(&fs->scrubber.mutex);
+
+    pthread_join(fs->scrubber.thread, NULL);
+
+    pthread_mutex_lock(&fs->scrubber.mutex);
+    fs->scrubber.running = false;
+    pthread_mutex_unlock(&fs->scrubber.mutex);
+    return 0;
+}
+
+static void *defragmenter_run(void *arg) {
+    tfs_ctx *fs = arg;
+    for (;;) {
+        size_t extent = inode_table_extent(fs);
+        for (int inumber = 0; (size_t)inumber < extent; inumber++) {
+            if (inode_defrag(fs, inumber) > 0 &&
+                background_wait(&fs->defragmenter.mutex,
+                                &fs->defragmenter.cond,
+                                &fs->defragmenter.stop,
+                                fs->defragmenter.files_per_second)) {
+                return NULL;
+            }
+        }
+        if (background_wait(&fs->defragmenter.mutex, &fs->defragmenter.cond,
+                            &fs->defragmenter.stop,
+                            fs->defragmenter.files_per_second)) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Starts the background defragmenter, which keeps moving the blocks of
+ * fragmented files into contiguous runs
+ * Input:
+ *  - files_per_second: maximum rate at which files are defragmented
+ * Returns: 0 if successful, -1 otherwise (e.g., if it is already running)
+ */
+int defragmenter_start(tfs_ctx *fs, unsigned int files_per_second) {
+    if (files_per_second == 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&fs->defragmenter.mutex);
+    if (fs->defragmenter.running) {
+        pthread_mutex_unlock(&fs->defragmenter.mutex);
+        return -1;
+    }
+    fs->defragmenter.files_per_second = files_per_second;
+    fs->defragmenter.stop = false;
+    if (pthread_create(&fs->defragmenter.thread, NULL, defragmenter_run,
+                       fs) != 0) {
+        pthread_mutex_unlock(&fs->defragmenter.mutex);
+        return -1;
+    }
+    fs->defragmenter.running = true;
+    pthread_mutex_unlock(&fs->defragmenter.mutex);
+    return 0;
+}
+
+/*
+ * Stops the background defragmenter
+ * Returns: 0 if successful, -1 if it was not running
+ */
+int defragmenter_stop(tfs_ctx *fs) {
+    pthread_mutex_lock(&fs->defragmenter.mutex);
+    if (!fs->defragmenter.running || fs->defragmenter.stop) {
+        pthread_mutex_unlock(&fs->defragmenter.mutex);
+        return -1;
+    }
+    fs->defragmenter.stop = true;
+    pthread_cond_signal(&fs->defragmenter.cond);
+    pthread_mutex_unlock(&fs->defragmenter.mutex);
+
+    pthread_join(fs->defragmenter.thread, NULL);
+
+    pthread_mutex_lock(&fs->defragmenter.mutex);
+    fs->defragmenter.running = false;
+    pthread_mutex_unlock(&fs->defragmenter.mutex);
+    return 0;
+}
+
+/* Returns a pointer to the contents of a given block
+ * Input:
+ * 	- Block's index
+ * Returns: pointer to the first byte of the block, NULL otherwise
+ */
+void *data_block_get(tfs_ctx *fs, int block_number) {
+    if (!valid_block_number(fs, block_number)) {
+        return NULL;
+    }
+
+    /* With a block device, accesses that miss pay for the actual reads */
+    if (fs->fs_data.device == NULL) {
+        insert_delay(); // simulate storage access delay to block
+    }
+    return data_block_address(fs, block_number);
+}
+
+/* Add new entry to the open file table
+ * Inputs:
+ * 	- I-node number of the file to open
+ * 	- Initial offset
+ * 	- Whether writes append to the file
+ * Returns: file handle if successful, -1 otherwise
+ */
+int add_to_open_file_table(tfs_ctx *fs, int inumber, size_t offset,
+                           bool append) {
+    pthread_mutex_lock(&fs->free_open_file_entries.mutex);
+    pthread_mutex_lock(&fs->open_file_table.mutex);
+    for (int i = 0; i < MAX_OPEN_FILES; i++) {
+        if (fs->free_open_file_entries.table[i] == FREE) {
+            fs->free_open_file_entries.table[i] = TAKEN;
+            fs->open_file_table.table[i].of_inumber = inumber;
+            fs->open_file_table.table[i].of_offset = offset;
+            fs->open_file_table.table[i].of_append = append;
+            fs->open_file_table.table[i].of_cursor.index = SIZE_MAX;
+            fs->open_file_table.table[i].of_cursor.indirect_block = NULL;
+            pthread_mutex_init(&fs->open_file_table.table[i].mutex,NULL);
+            pthread_mutex_unlock(&fs->open_file_table.mutex);
+            pthread_mutex_unlock(&fs->free_open_file_entries.mutex);
+            return i;
+        }
+    }
+    pthread_mutex_unlock(&fs->open_file_table.mutex);
+    pthread_mutex_unlock(&fs->free_open_file_entries.mutex);
+    return -1;
+}
+
+/* Frees an entry from the open file table
+ * Inputs:
+ * 	- file handle to free/close
+ * Returns 0 is success, -1 otherwise
+ */
+int remove_from_open_file_table(tfs_ctx *fs, int fhandle) {
+    pthread_mutex_lock(&fs->free_open_file_entries.mutex);
+    if (!valid_file_handle(fhandle) ||
+        fs->free_open_file_entries.table[fhandle] != TAKEN) {
+        pthread_mutex_unlock(&fs->free_open_file_entries.mutex);
+        return -1;
+    }
+    fs->free_open_file_entries.table[fhandle] = FREE;
+    pthread_mutex_destroy(&fs->open_file_table.table[fhandle].mutex);
+    pthread_mutex_unlock(&fs->free_open_file_entries.mutex);
+    return 0;
+}
+
+/* Returns pointer to a given entry in the open file table
+ * Inputs:
+ * 	 - file handle
+ * Returns: pointer to the entry if sucessful, NULL otherwise
+ */
+open_file_entry_t *get_open_file_entry(tfs_ctx *fs, int fhandle) {
+    if (!valid_file_handle(fhandle)) {
+        return NULL;
+    }
+    return &fs->open_file_table.table[fhandle];
+}
@@ -1,101 +1,374 @@
-#ifndef STATE_H
-#define STATE_H
-
-#include "config.h"
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <pthread.h>
-#include <sys/types.h>
-
-/*
- * Directory entry
- */
-typedef struct {
-    char d_name[MAX_FILE_NAME];
-    int d_inumber;
-} dir_entry_t;
-
-typedef enum { T_FILE, T_DIRECTORY } inode_type;
-
-
-/*
- * I-node
- */
-typedef struct {
-    inode_type i_node_type;
-    size_t i_size;
-    int direct_blocks[DIRECT_BLOCKS];
-    int indirect_block;
-    pthread_rwlock_t rwlock;
-    /* in a real FS, more fields would exist here */
-} inode_t;
-
-typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
-
-typedef struct {
-    inode_t table[INODE_TABLE_SIZE];
-    pthread_mutex_t mutex;
-} inode_table_struct;
-
-
-typedef struct {
-    char table[INODE_TABLE_SIZE];
-    pthread_mutex_t mutex;
-} freeinode_ts_struct;
-
-
-typedef struct {
-    char table[BLOCK_SIZE * DATA_BLOCKS];
-    pthread_mutex_t mutex;
-} fs_data_struct;
-
-
-typedef struct {
-    char table[DATA_BLOCKS];
-    pthread_mutex_t mutex;
-} free_blocks_struct;
-
-
-typedef struct {
-    char table[MAX_OPEN_FILES];
-    pthread_mutex_t mutex;
-} free_open_file_entries_struct;
-
-
-/*
- * Open file entry (in open file table)
- */
-typedef struct {
-    int of_inumber;
-    size_t of_offset;
-    pthread_mutex_t mutex;
-} open_file_entry_t;
-
-typedef struct {
-    open_file_entry_t table[MAX_OPEN_FILES]; 
-    pthread_mutex_t mutex;
-} open_file_table_struct;
-
-#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
-
-void state_init();
-void state_destroy();
-
-int inode_create(inode_type n_type);
-int inode_delete(int inumber);
-inode_t *inode_get(int inumber);
-
-int clear_dir_entry(int inumber, int sub_inumber);
-int add_dir_entry(int inumber, int sub_inumber, char const *sub_name);
-int find_in_dir(int inumber, char const *sub_name);
-
-int data_block_alloc();
-int data_block_free(int block_number);
-void *data_block_get(int block_number);
-
-int add_to_open_file_table(int inumber, size_t offset);
-int remove_from_open_file_table(int fhandle);
-open_file_entry_t *get_open_file_entry(int fhandle);
-
-#endif // STATE_H
+#ifndef STATE_H
+#define STATE_H
+
+#include "blockdev.h"
+#include "config.h"
+#include "lockstat.h"
+#include "rcu.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Directory entry
+ */
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    int d_inumber;
+} dir_entry_t;
+
+typedef enum { T_FILE, T_DIRECTORY } inode_type;
+
+/*
+ * FS parameters, chosen when it is initialized
+ */
+typedef struct {
+    size_t max_block_count; /* capacity of the data region, in blocks */
+    size_t max_inode_count; /* capacity of the i-node table */
+    blockdev_type_t device; /* where the data blocks are stored */
+    char const *device_path; /* file of the device (if not BLOCKDEV_RAM) */
+} tfs_params;
+
+/*
+ * I-node flags
+ */
+enum {
+    I_COMPRESSED = 0b1, /* file data is stored in compressed clusters */
+    I_DEDUP = 0b10,     /* full data blocks are deduplicated */
+};
+
+
+/*
+ * I-node
+ * Each i-node starts on its own cache line, so that threads using different
+ * files do not write to the same line. The lock and the size, which every
+ * read and write touches, share the first line; the block map and the rest
+ * follow in the next ones.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_rwlock_t rwlock;
+    size_t i_size;
+    /* Appends reserve ranges at the end of the file by advancing
+     * i_append_end (while holding the lock for reading) and publish them,
+     * extending i_size, in the same order; i_append_published and
+     * i_append_gen (changed by truncations) are also protected by the
+     * append mutex */
+    _Atomic size_t i_append_end;
+    size_t i_append_published;
+    unsigned int i_append_gen;
+    inode_type i_node_type;
+    int i_flags;
+    int i_open_count;       /* number of open file handles */
+    bool i_unlinked;        /* removed from its directory */
+    bool i_reclaim_pending; /* queued for reclamation */
+    int i_reclaim_next;     /* next i-node in the reclaim queue */
+    unsigned int i_map_gen; /* changed whenever a mapped block is replaced */
+    int direct_blocks[DIRECT_BLOCKS];
+    int indirect_block;
+    /* Index of a directory's entries, which lookups read without locking
+     * the directory (replaced through RCU, see dir_index_update) */
+    struct dir_index *_Atomic i_dir_index;
+    /* Writes waiting for the lock, for its holder to apply (see
+     * write_combine) */
+    struct write_request *_Atomic i_write_requests;
+    /* in a real FS, more fields would exist here */
+} inode_t;
+
+typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
+
+/*
+ * The locks of the global tables below are kept on their own cache lines,
+ * apart from the entries and from each other
+ */
+
+
+/*
+ * I-node table, allocated in chunks of INODE_CHUNK_INODES i-nodes; the
+ * directory holds the address of each chunk, NULL until one of its i-nodes
+ * is first created. Each i-node (and its lock) is only initialized when it
+ * is first created; as i-nodes are created lowest number first, those are
+ * always the first ones. Chunks are only freed with the FS, so that a
+ * thread may safely lock an i-node that is being deleted.
+ */
+typedef struct {
+    inode_t *_Atomic *chunks;
+    size_t chunk_count;
+    size_t inode_count;          /* capacity */
+    _Atomic size_t initialized;  /* number of i-nodes ever created */
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+} inode_table_struct;
+
+
+/*
+ * Bitmap of the i-nodes in use; no word before first_free has a free bit
+ */
+typedef struct {
+    uint64_t *bitmap;
+    size_t first_free;
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+} freeinode_ts_struct;
+
+
+/*
+ * Queue of unlinked i-nodes waiting to be reclaimed by a background thread,
+ * linked through their i_reclaim_next
+ */
+typedef struct {
+    int head;
+    int tail;
+    size_t count;
+    bool running;
+    bool stop;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} reclaim_queue_struct;
+
+
+/*
+ * Data region, mapped one chunk at a time; the directory holds the address
+ * of each chunk, NULL until one of its blocks is allocated.
+ * With a block device, the region caches the device's blocks: a block that
+ * is not resident is read from the device when first accessed (under one of
+ * the load mutexes), and blocks are staged to the device when modified.
+ */
+typedef struct {
+    char *_Atomic *chunks;
+    size_t chunk_count;
+    size_t block_count;
+    blockdev_t *device; /* NULL with BLOCKDEV_RAM */
+    _Atomic bool *resident;
+    pthread_mutex_t load_mutexes[DATA_LOAD_STRIPES];
+} fs_data_struct;
+
+
+/*
+ * Bitmap of the data blocks in use; no word before first_free has a free
+ * bit
+ */
+typedef struct {
+    uint64_t *bitmap;
+    size_t first_free;
+    int *refs; /* number of block maps pointing to each block */
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+} free_blocks_struct;
+
+
+/*
+ * Checksums (CRC32C) of the contents of data blocks
+ */
+typedef struct {
+    uint32_t *crc;
+    bool *valid; /* only file data blocks have a checksum */
+} block_checksums_struct;
+
+/*
+ * When to verify the checksum of a data block that is read
+ */
+typedef enum { VERIFY_OFF, VERIFY_SAMPLED, VERIFY_ALWAYS } verify_mode_t;
+
+
+/*
+ * Index of the contents of data blocks, used for deduplication
+ * (protected by the mutex of free_blocks)
+ */
+typedef struct {
+    int *buckets;
+    int *next;
+    uint64_t *fingerprint;
+    bool *indexed;
+} dedup_index_struct;
+
+
+typedef struct {
+    char table[MAX_OPEN_FILES];
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+} free_open_file_entries_struct;
+
+
+/*
+ * Last block map lookup made through an open file, so that the next one
+ * does not have to go through the i-node (and its indirect block) again.
+ * It is only valid while the i-node's map generation stays the same.
+ */
+typedef struct {
+    unsigned int gen;
+    size_t index;        /* block index within the file, SIZE_MAX if none */
+    int block_number;    /* data block holding that block */
+    int *indirect_block; /* contents of the indirect block, NULL if unknown */
+} block_cursor_t;
+
+/*
+ * Open file entry (in open file table)
+ * Each entry starts on its own cache line, as the offset is updated by
+ * every read and write through the handle
+ */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+    size_t of_offset;
+    int of_inumber;
+    bool of_append; /* opened with TFS_O_APPEND */
+    block_cursor_t of_cursor;
+} open_file_entry_t;
+
+typedef struct {
+    open_file_entry_t table[MAX_OPEN_FILES]; 
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+} open_file_table_struct;
+
+/*
+ * Background thread that verifies the checksums of all file blocks
+ */
+typedef struct {
+    pthread_t thread;
+    bool running;
+    bool stop;
+    unsigned int blocks_per_second;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} scrubber_struct;
+
+/*
+ * Background thread that defragments files
+ */
+typedef struct {
+    pthread_t thread;
+    bool running;
+    bool stop;
+    unsigned int files_per_second;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} defragmenter_struct;
+
+/*
+ * How fragmented a file is: its data blocks are stored in this many runs
+ * of consecutive blocks (extents), in file order; 1 is ideal
+ */
+typedef struct {
+    size_t blocks;
+    size_t extents;
+} fragmentation_t;
+
+/* Number of condition variables appends wait on (log2) */
+#define APPEND_WAIT_SLOTS_LOG2 (4)
+#define APPEND_WAIT_SLOTS (1 << APPEND_WAIT_SLOTS_LOG2)
+
+struct cluster_cache;
+struct copy_pool;
+
+/*
+ * A FS instance: all of its state, so that a process can host several
+ * independent instances that share no locks
+ */
+typedef struct tfs_ctx {
+    /* Persistent FS state  (in reality, it should be maintained in
+     * secondary memory; for simplicity, this project maintains it in
+     * primary memory) */
+    inode_table_struct inode_table;
+    freeinode_ts_struct freeinode_ts;
+    fs_data_struct fs_data;
+    free_blocks_struct free_blocks;
+    dedup_index_struct dedup_index;
+    block_checksums_struct block_checksums;
+
+    /* Volatile FS state */
+    open_file_table_struct open_file_table;
+    free_open_file_entries_struct free_open_file_entries;
+    reclaim_queue_struct reclaim_queue;
+    scrubber_struct scrubber;
+    defragmenter_struct defragmenter;
+    _Atomic int verify_mode;
+    _Atomic unsigned int verify_count;
+    _Atomic size_t checksum_errors;
+    /* Protects the publication of appends (of all files) */
+    pthread_mutex_t append_mutex;
+    pthread_cond_t append_conds[APPEND_WAIT_SLOTS];
+    /* Protects the directory indexes read by lookups */
+    rcu_domain_t rcu;
+    /* Decompressed clusters of compressed files (see compress.c) */
+    struct cluster_cache *cluster_cache;
+    /* Parallel copy mode (see tfs_set_parallel_copy): reads and writes of
+     * at least copy_threshold bytes (if not 0) split their block copies
+     * among copy_threads threads, those of the pool and the caller */
+    _Atomic size_t copy_threshold;
+    _Atomic unsigned int copy_threads;
+    struct copy_pool *_Atomic copy_pool;
+    /* Data blocks pinned by zero-copy reads (see tfs_read_zc) */
+    _Atomic size_t zc_pinned;
+    /* Trace being recorded, if any, and the calls recording to it (see
+     * trace.c) */
+    struct trace *_Atomic trace;
+    _Atomic unsigned int trace_users;
+} tfs_ctx;
+
+#define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
+
+tfs_ctx *state_init(tfs_params params);
+void state_destroy(tfs_ctx *fs);
+
+int inode_create(tfs_ctx *fs, inode_type n_type);
+size_t inode_table_extent(tfs_ctx *fs);
+int inode_delete(tfs_ctx *fs, int inumber);
+inode_t *inode_get(tfs_ctx *fs, int inumber);
+int inode_block_get(tfs_ctx *fs, inode_t *inode, size_t index, bool alloc);
+int inode_block_set(tfs_ctx *fs, inode_t *inode, size_t index,
+                    int block_number);
+int inode_block_lookup(tfs_ctx *fs, inode_t *inode, block_cursor_t *cursor,
+                       size_t index);
+int inode_block_get_private(tfs_ctx *fs, inode_t *inode, size_t index,
+                            block_cursor_t *cursor);
+int inode_share_blocks(tfs_ctx *fs, inode_t *inode, inode_t const *source);
+int inode_truncate(tfs_ctx *fs, inode_t *inode);
+int inode_fragmentation(tfs_ctx *fs, inode_t *inode, fragmentation_t *frag);
+int inode_defrag(tfs_ctx *fs, int inumber);
+int inode_blocks_alloc(tfs_ctx *fs, inode_t *inode, size_t first, size_t count,
+                       bool contiguous);
+size_t inode_append_reserve(inode_t *inode, size_t len, unsigned int *gen);
+int inode_append_publish(tfs_ctx *fs, inode_t *inode, size_t start,
+                         size_t reserved_end, size_t written_end,
+                         unsigned int gen);
+void inode_append_sync(tfs_ctx *fs, inode_t *inode);
+bool inode_block_is_tail(inode_t const *inode, size_t index);
+int inode_open(tfs_ctx *fs, int inumber);
+int inode_close(tfs_ctx *fs, int inumber);
+int inode_unlink(tfs_ctx *fs, int inumber);
+
+int clear_dir_entry(tfs_ctx *fs, int inumber, char const *sub_name);
+int add_dir_entry(tfs_ctx *fs, int inumber, int sub_inumber,
+                  char const *sub_name);
+int find_in_dir(tfs_ctx *fs, int inumber, char const *sub_name);
+ssize_t read_dir_entries(tfs_ctx *fs, int inumber, size_t *cursor,
+                         dir_entry_t *entries, size_t n);
+
+int data_block_alloc(tfs_ctx *fs);
+int data_block_free(tfs_ctx *fs, int block_number);
+void *data_block_get(tfs_ctx *fs, int block_number);
+int data_blocks_alloc_batch(tfs_ctx *fs, int *blocks, size_t n);
+int data_blocks_alloc_contiguous(tfs_ctx *fs, int *blocks, size_t n);
+int data_blocks_free_batch(tfs_ctx *fs, int const *blocks, size_t n);
+int data_blocks_ref_batch(tfs_ctx *fs, int const *blocks, size_t n);
+int data_block_unindex(tfs_ctx *fs, int block_number);
+int data_block_dedup(tfs_ctx *fs, int block_number);
+void data_block_seal(tfs_ctx *fs, int block_number);
+void data_block_dirty(tfs_ctx *fs, int block_number);
+int data_region_sync(tfs_ctx *fs);
+int data_region_drop(tfs_ctx *fs);
+int data_block_verify(tfs_ctx *fs, int block_number);
+void data_block_set_verify_mode(tfs_ctx *fs, verify_mode_t mode);
+size_t data_block_checksum_errors(tfs_ctx *fs);
+
+int scrubber_start(tfs_ctx *fs, unsigned int blocks_per_second);
+int scrubber_stop(tfs_ctx *fs);
+int defragmenter_start(tfs_ctx *fs, unsigned int files_per_second);
+int defragmenter_stop(tfs_ctx *fs);
+
+int add_to_open_file_table(tfs_ctx *fs, int inumber, size_t offset,
+                           bool append);
+int remove_from_open_file_table(tfs_ctx *fs, int fhandle);
+open_file_entry_t *get_open_file_entry(tfs_ctx *fs, int fhandle);
+
+#endif // STATE_H
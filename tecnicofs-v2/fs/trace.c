@@ -0,0 +1,661 @@
+#include "trace.h"
+#include "operations.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_MAGIC "TFSTRACE"
+#define TRACE_VERSION (1)
+/* Paths are cut at this length, which is longer than any file name */
+#define TRACE_MAX_PATH (255)
+/* Marks a handle that was not opened during the trace */
+#define TRACE_NO_DEP UINT32_MAX
+
+char const *const trace_op_names[TRACE_OPS] = {
+    [TRACE_LOOKUP] = "lookup",
+    [TRACE_READDIR] = "readdir",
+    [TRACE_OPEN] = "open",
+    [TRACE_CLOSE] = "close",
+    [TRACE_UNLINK] = "unlink",
+    [TRACE_WRITE] = "write",
+    [TRACE_READ] = "read",
+    [TRACE_SEEK] = "seek",
+    [TRACE_COPY_RANGE] = "copy_range",
+    [TRACE_COPY_FILE] = "copy_file",
+    [TRACE_FALLOCATE] = "fallocate",
+    [TRACE_CLONE] = "clone",
+    [TRACE_COPY_TO_EXTERNAL] = "copy_to_external",
+    [TRACE_COPY_FROM_EXTERNAL] = "copy_from_external",
+    [TRACE_DEFRAG] = "defrag",
+    [TRACE_FRAGMENTATION] = "fragmentation",
+};
+
+/* Number of file handles each operation takes */
+static uint8_t const op_handles[TRACE_OPS] = {
+    [TRACE_CLOSE] = 1, [TRACE_WRITE] = 1,      [TRACE_READ] = 1,
+    [TRACE_SEEK] = 1,  [TRACE_COPY_RANGE] = 2, [TRACE_FALLOCATE] = 1,
+};
+
+/*
+ * Trace file format (in the host's byte order): a header, then one record
+ * per call, in the order the calls returned, each followed by its paths
+ * (without terminators)
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} trace_header_t;
+
+typedef struct {
+    /* Since the trace started */
+    uint64_t start_ns;
+    uint64_t latency_ns;
+    uint64_t arg[2];
+    int64_t result;
+    /* Order in which the calls started */
+    uint32_t seq;
+    /* Threads are numbered from 0, in the order of their first call */
+    uint32_t thread;
+    int32_t fhandle[2];
+    /* seq of the calls that opened the handles (TRACE_NO_DEP if none) */
+    uint32_t dep[2];
+    uint16_t op;
+    uint16_t path_len[2];
+    uint16_t unused;
+} trace_record_t;
+
+struct trace {
+    FILE *out;
+    uint64_t start_ns;
+    uint64_t generation;
+    _Atomic uint32_t seq;
+    _Atomic uint32_t threads;
+    /* seq of the call that opened each handle */
+    _Atomic uint32_t open_seq[MAX_OPEN_FILES];
+};
+
+/* Each trace has a new generation, so that threads number themselves again
+ * for it */
+static _Atomic uint64_t trace_generation;
+static _Thread_local uint64_t thread_generation;
+static _Thread_local uint32_t thread_number;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Starts recording the calls on an instance to a (new) file
+ * Returns 0 if successful, -1 otherwise (e.g., if already recording)
+ */
+int trace_start(tfs_ctx *fs, char const *path) {
+    if (atomic_load(&fs->trace) != NULL) {
+        return -1;
+    }
+    struct trace *trace = malloc(sizeof(struct trace));
+    if (trace == NULL) {
+        return -1;
+    }
+    trace->out = fopen(path, "wb");
+    if (trace->out == NULL) {
+        free(trace);
+        return -1;
+    }
+    trace_header_t header = {.magic = TRACE_MAGIC,
+                             .version = TRACE_VERSION,
+                             .record_size = sizeof(trace_record_t)};
+    if (fwrite(&header, sizeof(header), 1, trace->out) != 1) {
+        fclose(trace->out);
+        free(trace);
+        return -1;
+    }
+
+    trace->start_ns = now_ns();
+    trace->generation = atomic_fetch_add(&trace_generation, 1) + 1;
+    atomic_init(&trace->seq, 0);
+    atomic_init(&trace->threads, 0);
+    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
+        atomic_init(&trace->open_seq[i], TRACE_NO_DEP);
+    }
+
+    struct trace *none = NULL;
+    if (!atomic_compare_exchange_strong(&fs->trace, &none, trace)) {
+        fclose(trace->out);
+        free(trace);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Stops recording, once the calls being recorded have returned, and
+ * closes the trace file
+ * Returns 0 if successful, -1 otherwise (e.g., if not recording)
+ */
+int trace_stop(tfs_ctx *fs) {
+    struct trace *trace = atomic_exchange(&fs->trace, NULL);
+    if (trace == NULL) {
+        return -1;
+    }
+    while (atomic_load(&fs->trace_users) > 0) {
+        sched_yield();
+    }
+    int result = fclose(trace->out) == 0 ? 0 : -1;
+    free(trace);
+    return result;
+}
+
+void trace_enter(tfs_ctx *fs, trace_call_t *call) {
+    /* Counted before the trace is read, so that trace_stop waits for us */
+    atomic_fetch_add(&fs->trace_users, 1);
+    struct trace *trace = atomic_load(&fs->trace);
+    if (trace == NULL) {
+        atomic_fetch_sub(&fs->trace_users, 1);
+        return;
+    }
+    call->trace = trace;
+    call->seq = atomic_fetch_add(&trace->seq, 1);
+    call->start_ns = now_ns();
+}
+
+static uint32_t thread_in(struct trace *trace) {
+    if (thread_generation != trace->generation) {
+        thread_generation = trace->generation;
+        thread_number = atomic_fetch_add(&trace->threads, 1);
+    }
+    return thread_number;
+}
+
+void trace_record(tfs_ctx *fs, trace_call_t *call, trace_op_t op,
+                  trace_args_t const *args, int64_t result) {
+    struct trace *trace = call->trace;
+    char buffer[sizeof(trace_record_t) + 2 * TRACE_MAX_PATH];
+    trace_record_t record = {
+        .start_ns = call->start_ns - trace->start_ns,
+        .latency_ns = now_ns() - call->start_ns,
+        .arg = {args->arg[0], args->arg[1]},
+        .result = result,
+        .seq = call->seq,
+        .thread = thread_in(trace),
+        .op = (uint16_t)op};
+
+    size_t len = sizeof(record);
+    for (size_t i = 0; i < 2; i++) {
+        int fhandle = i < op_handles[op] ? args->fhandle[i] : -1;
+        record.fhandle[i] = fhandle;
+        record.dep[i] = fhandle >= 0 && fhandle < MAX_OPEN_FILES
+                            ? atomic_load(&trace->open_seq[fhandle])
+                            : TRACE_NO_DEP;
+
+        size_t path_len = args->path[i] == NULL ? 0 : strlen(args->path[i]);
+        if (path_len > TRACE_MAX_PATH) {
+            path_len = TRACE_MAX_PATH;
+        }
+        if (path_len > 0) {
+            memcpy(buffer + len, args->path[i], path_len);
+        }
+        record.path_len[i] = (uint16_t)path_len;
+        len += path_len;
+    }
+    memcpy(buffer, &record, sizeof(record));
+
+    /* A call on the handle can only start after the open returned */
+    if (op == TRACE_OPEN && result >= 0 && result < MAX_OPEN_FILES) {
+        atomic_store(&trace->open_seq[result], call->seq);
+    }
+    /* stdio writes each record at once, even with several threads */
+    fwrite(buffer, len, 1, trace->out);
+
+    atomic_fetch_sub(&fs->trace_users, 1);
+}
+
+/* A call being replayed */
+typedef struct {
+    trace_record_t record;
+    char *path[2];
+    /* Calls that opened the handles (SIZE_MAX if none) */
+    size_t dep[2];
+    /* Result of the replayed call */
+    int64_t result;
+    bool done;
+} replay_call_t;
+
+typedef struct {
+    tfs_ctx *fs;
+    replay_call_t *calls;
+    bool timed;
+    uint64_t start_ns;
+    /* Calls start in the order they started in the trace: turn is the
+     * index of the next one; waiting threads are woken by cond */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    size_t turn;
+    /* Set if not every thread could be started */
+    bool aborted;
+} replay_t;
+
+/* A thread of the trace, replayed by its own thread */
+typedef struct {
+    replay_t *replay;
+    size_t *calls;
+    size_t call_count;
+    /* Data written and read by the calls */
+    char *buffer;
+    size_t buffer_size;
+    /* External file created to replay an import */
+    char import_path[32];
+    trace_op_stats_t ops[TRACE_OPS];
+    bool failed;
+} replay_thread_t;
+
+static int compare_seq(void const *a, void const *b) {
+    uint32_t seq_a = ((replay_call_t const *)a)->record.seq;
+    uint32_t seq_b = ((replay_call_t const *)b)->record.seq;
+    return (seq_a > seq_b) - (seq_a < seq_b);
+}
+
+static void free_calls(replay_call_t *calls, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(calls[i].path[0]);
+        free(calls[i].path[1]);
+    }
+    free(calls);
+}
+
+/*
+ * Reads the calls of a trace file, sorted by the order in which they
+ * started
+ * Returns the calls (and their count) if successful, NULL otherwise
+ */
+static replay_call_t *read_trace(char const *path, size_t *count) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return NULL;
+    }
+    trace_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != TRACE_VERSION ||
+        header.record_size != sizeof(trace_record_t)) {
+        fclose(in);
+        return NULL;
+    }
+
+    replay_call_t *calls = NULL;
+    size_t n = 0, capacity = 0;
+    trace_record_t record;
+    bool failed = false;
+    while (!failed && fread(&record, sizeof(record), 1, in) == 1) {
+        if (n == capacity) {
+            capacity = capacity == 0 ? 1024 : 2 * capacity;
+            replay_call_t *grown = realloc(calls, capacity * sizeof(*calls));
+            if (grown == NULL) {
+                failed = true;
+                break;
+            }
+            calls = grown;
+        }
+        replay_call_t *call = &calls[n++];
+        call->record = record;
+        call->path[0] = call->path[1] = NULL;
+        call->done = false;
+        failed = record.op >= TRACE_OPS;
+        for (size_t i = 0; i < 2 && !failed; i++) {
+            size_t len = record.path_len[i];
+            call->path[i] = malloc(len + 1);
+            if (call->path[i] == NULL ||
+                (len > 0 && fread(call->path[i], len, 1, in) != 1)) {
+                failed = true;
+            } else {
+                call->path[i][len] = '\0';
+            }
+        }
+    }
+    if (ferror(in)) {
+        failed = true;
+    }
+    fclose(in);
+    if (failed) {
+        free_calls(calls, n);
+        return NULL;
+    }
+
+    qsort(calls, n, sizeof(*calls), compare_seq);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j < 2; j++) {
+            calls[i].dep[j] = SIZE_MAX;
+            replay_call_t key = {.record.seq = calls[i].record.dep[j]};
+            replay_call_t *dep =
+                calls[i].record.dep[j] == TRACE_NO_DEP
+                    ? NULL
+                    : bsearch(&key, calls, n, sizeof(*calls), compare_seq);
+            if (dep != NULL) {
+                calls[i].dep[j] = (size_t)(dep - calls);
+            }
+        }
+    }
+    *count = n;
+    return calls;
+}
+
+/*
+ * Grows the buffer of a replaying thread to at least size bytes
+ * Returns the buffer if successful, NULL otherwise
+ */
+static char *replay_buffer(replay_thread_t *thread, size_t size) {
+    if (size > thread->buffer_size) {
+        char *grown = realloc(thread->buffer, size);
+        if (grown == NULL) {
+            return NULL;
+        }
+        /* Written data is not traced; writes replay this pattern */
+        for (size_t i = thread->buffer_size; i < size; i++) {
+            grown[i] = (char)('a' + i % 26);
+        }
+        thread->buffer = grown;
+        thread->buffer_size = size;
+    }
+    return thread->buffer;
+}
+
+/*
+ * Creates an external file of the given size, to replay an import
+ * Returns 0 if successful, -1 otherwise
+ */
+static int replay_import_source(replay_thread_t *thread, size_t size) {
+    strcpy(thread->import_path, "/tmp/tfs_replay_XXXXXX");
+    int fd = mkstemp(thread->import_path);
+    if (fd == -1) {
+        return -1;
+    }
+    char *data = replay_buffer(thread, size);
+    int result = data == NULL && size > 0 ? -1 : 0;
+    for (size_t done = 0; result == 0 && done < size;) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n <= 0) {
+            result = -1;
+        } else {
+            done += (size_t)n;
+        }
+    }
+    close(fd);
+    if (result == -1) {
+        unlink(thread->import_path);
+    }
+    return result;
+}
+
+/*
+ * Makes a call of the trace on the replay's volume
+ * Returns the call's result
+ */
+static int64_t replay_call(replay_thread_t *thread, replay_call_t *call,
+                           int fhandle[2]) {
+    tfs_ctx *fs = thread->replay->fs;
+    trace_record_t const *record = &call->record;
+    char *buffer;
+
+    switch ((trace_op_t)record->op) {
+    case TRACE_LOOKUP:
+        return tfs_lookup(fs, call->path[0]);
+    case TRACE_READDIR: {
+        size_t cursor = record->arg[0];
+        buffer = replay_buffer(thread, record->arg[1] * sizeof(dir_entry_t));
+        if (buffer == NULL) {
+            return -1;
+        }
+        return tfs_readdir(fs, call->path[0], &cursor,
+                           (dir_entry_t *)(void *)buffer, record->arg[1]);
+    }
+    case TRACE_OPEN:
+        return tfs_open(fs, call->path[0], (int)record->arg[0]);
+    case TRACE_CLOSE:
+        return tfs_close(fs, fhandle[0]);
+    case TRACE_UNLINK:
+        return tfs_unlink(fs, call->path[0]);
+    case TRACE_WRITE:
+        buffer = replay_buffer(thread, record->arg[0]);
+        return buffer == NULL
+                   ? -1
+                   : tfs_write(fs, fhandle[0], buffer, record->arg[0]);
+    case TRACE_READ:
+        buffer = replay_buffer(thread, record->arg[0]);
+        return buffer == NULL
+                   ? -1
+                   : tfs_read(fs, fhandle[0], buffer, record->arg[0]);
+    case TRACE_SEEK:
+        return tfs_seek(fs, fhandle[0], record->arg[0]);
+    case TRACE_COPY_RANGE:
+        return tfs_copy_range(fs, fhandle[0], fhandle[1], record->arg[0]);
+    case TRACE_COPY_FILE:
+        return tfs_copy_file(fs, call->path[0], call->path[1]);
+    case TRACE_FALLOCATE:
+        return tfs_fallocate(fs, fhandle[0], record->arg[0], record->arg[1]);
+    case TRACE_CLONE:
+        return tfs_clone(fs, call->path[0], call->path[1]);
+    case TRACE_COPY_TO_EXTERNAL:
+        /* The external file is not part of the workload */
+        return tfs_copy_to_external_fs(fs, call->path[0], "/dev/null");
+    case TRACE_COPY_FROM_EXTERNAL:
+        return tfs_copy_from_external_fs(fs, thread->import_path,
+                                         call->path[1]);
+    case TRACE_DEFRAG:
+        return tfs_defrag(fs, call->path[0]);
+    case TRACE_FRAGMENTATION: {
+        fragmentation_t frag;
+        return tfs_fragmentation(fs, call->path[0], &frag);
+    }
+    case TRACE_OPS:
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Waits for a call's turn (and, if timed, for its time) to start it
+ * Returns false if the replay was aborted
+ */
+static bool replay_wait_turn(replay_t *replay, size_t index) {
+    pthread_mutex_lock(&replay->mutex);
+    while (replay->turn != index && !replay->aborted) {
+        pthread_cond_wait(&replay->cond, &replay->mutex);
+    }
+    bool aborted = replay->aborted;
+    pthread_mutex_unlock(&replay->mutex);
+    if (aborted) {
+        return false;
+    }
+
+    if (replay->timed) {
+        uint64_t at = replay->start_ns + replay->calls[index].record.start_ns;
+        struct timespec ts = {.tv_sec = (time_t)(at / 1000000000u),
+                              .tv_nsec = (long)(at % 1000000000u)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+               EINTR) {
+        }
+    }
+
+    pthread_mutex_lock(&replay->mutex);
+    replay->turn++;
+    pthread_cond_broadcast(&replay->cond);
+    /* Calls on a handle wait for the open that returned it */
+    replay_call_t *call = &replay->calls[index];
+    for (size_t i = 0; i < 2; i++) {
+        while (call->dep[i] != SIZE_MAX && !replay->calls[call->dep[i]].done) {
+            pthread_cond_wait(&replay->cond, &replay->mutex);
+        }
+    }
+    pthread_mutex_unlock(&replay->mutex);
+    return true;
+}
+
+static void *replay_thread(void *arg) {
+    replay_thread_t *thread = arg;
+    replay_t *replay = thread->replay;
+
+    for (size_t i = 0; i < thread->call_count; i++) {
+        size_t index = thread->calls[i];
+        replay_call_t *call = &replay->calls[index];
+        trace_record_t const *record = &call->record;
+
+        /* The external file is created before the call's turn */
+        bool import = record->op == TRACE_COPY_FROM_EXTERNAL;
+        if (import && replay_import_source(thread, record->arg[0]) == -1) {
+            thread->failed = true;
+            strcpy(thread->import_path, "");
+            import = false;
+        }
+
+        if (!replay_wait_turn(replay, index)) {
+            break;
+        }
+
+        int fhandle[2];
+        for (size_t j = 0; j < 2; j++) {
+            fhandle[j] = call->dep[j] == SIZE_MAX
+                             ? record->fhandle[j]
+                             : (int)replay->calls[call->dep[j]].result;
+        }
+        uint64_t start = now_ns();
+        int64_t result = replay_call(thread, call, fhandle);
+        uint64_t latency = now_ns() - start;
+        if (import) {
+            unlink(thread->import_path);
+        }
+
+        trace_op_stats_t *stats = &thread->ops[record->op];
+        stats->calls++;
+        stats->trace_ns += record->latency_ns;
+        stats->replay_ns += latency;
+        /* Handles may differ, as long as the open succeeds or fails alike */
+        if (record->op == TRACE_OPEN ? (result == -1) != (record->result == -1)
+                                     : result != record->result) {
+            stats->mismatches++;
+        }
+
+        pthread_mutex_lock(&replay->mutex);
+        call->result = result;
+        call->done = true;
+        pthread_cond_broadcast(&replay->cond);
+        pthread_mutex_unlock(&replay->mutex);
+    }
+    return NULL;
+}
+
+/*
+ * Replays a trace against a volume: each thread of the trace is replayed
+ * by its own thread, and calls start in the order they started in the
+ * trace
+ * Input:
+ *  - path: the trace file
+ *  - timed: whether calls also start at the same times as in the trace
+ *    (otherwise, as fast as possible)
+ *  - stats: where the replay's statistics are stored
+ * Returns 0 if successful, -1 otherwise
+ */
+int trace_replay(tfs_ctx *fs, char const *path, bool timed,
+                 trace_replay_stats_t *stats) {
+    size_t count;
+    replay_call_t *calls = read_trace(path, &count);
+    if (calls == NULL) {
+        return -1;
+    }
+
+    size_t n_threads = 0;
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < count; i++) {
+        trace_record_t const *record = &calls[i].record;
+        if (record->thread >= n_threads) {
+            n_threads = (size_t)record->thread + 1;
+        }
+        if (record->start_ns + record->latency_ns > stats->trace_ns) {
+            stats->trace_ns = record->start_ns + record->latency_ns;
+        }
+    }
+    if (count > 0) {
+        stats->trace_ns -= calls[0].record.start_ns;
+    }
+    stats->threads = n_threads;
+
+    replay_thread_t *threads = calloc(n_threads, sizeof(*threads));
+    size_t *thread_calls = malloc(count * sizeof(size_t));
+    pthread_t *tids = malloc(n_threads * sizeof(pthread_t));
+    if ((n_threads > 0 && (threads == NULL || tids == NULL)) ||
+        (count > 0 && thread_calls == NULL)) {
+        free(threads);
+        free(thread_calls);
+        free(tids);
+        free_calls(calls, count);
+        return -1;
+    }
+
+    replay_t replay = {.fs = fs, .calls = calls, .timed = timed, .turn = 0};
+    pthread_mutex_init(&replay.mutex, NULL);
+    pthread_cond_init(&replay.cond, NULL);
+
+    /* Splits the calls among the threads, keeping their order */
+    for (size_t i = 0; i < count; i++) {
+        threads[calls[i].record.thread].call_count++;
+    }
+    size_t next = 0;
+    for (size_t t = 0; t < n_threads; t++) {
+        threads[t].replay = &replay;
+        threads[t].calls = thread_calls + next;
+        next += threads[t].call_count;
+        threads[t].call_count = 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        replay_thread_t *thread = &threads[calls[i].record.thread];
+        thread->calls[thread->call_count++] = i;
+    }
+
+    /* The replay starts at the trace's first call */
+    replay.start_ns = now_ns() - (count > 0 ? calls[0].record.start_ns : 0);
+    uint64_t start = now_ns();
+    size_t started = 0;
+    int result = 0;
+    for (; started < n_threads; started++) {
+        if (pthread_create(&tids[started], NULL, replay_thread,
+                           &threads[started]) != 0) {
+            /* The threads that were started stop at their next call */
+            pthread_mutex_lock(&replay.mutex);
+            replay.aborted = true;
+            pthread_cond_broadcast(&replay.cond);
+            pthread_mutex_unlock(&replay.mutex);
+            result = -1;
+            break;
+        }
+    }
+    for (size_t t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    stats->replay_ns = now_ns() - start;
+
+    for (size_t t = 0; t < n_threads; t++) {
+        for (size_t op = 0; op < TRACE_OPS; op++) {
+            stats->ops[op].calls += threads[t].ops[op].calls;
+            stats->ops[op].mismatches += threads[t].ops[op].mismatches;
+            stats->ops[op].trace_ns += threads[t].ops[op].trace_ns;
+            stats->ops[op].replay_ns += threads[t].ops[op].replay_ns;
+        }
+        if (threads[t].failed) {
+            result = -1;
+        }
+        free(threads[t].buffer);
+    }
+
+    pthread_cond_destroy(&replay.cond);
+    pthread_mutex_destroy(&replay.mutex);
+    free(threads);
+    free(thread_calls);
+    free(tids);
+    free_calls(calls, count);
+    return result;
+}
@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "state.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Operation traces
+ *
+ * While a trace is recorded, every tfs_* call on the instance is logged to
+ * a binary file: its thread, arguments, start time, latency and result.
+ * A trace can then be replayed against another volume (see trace_replay).
+ * Written and read data are not recorded.
+ */
+
+typedef enum {
+    TRACE_LOOKUP,
+    TRACE_READDIR,
+    TRACE_OPEN,
+    TRACE_CLOSE,
+    TRACE_UNLINK,
+    TRACE_WRITE,
+    TRACE_READ,
+    TRACE_SEEK,
+    TRACE_COPY_RANGE,
+    TRACE_COPY_FILE,
+    TRACE_FALLOCATE,
+    TRACE_CLONE,
+    TRACE_COPY_TO_EXTERNAL,
+    TRACE_COPY_FROM_EXTERNAL,
+    TRACE_DEFRAG,
+    TRACE_FRAGMENTATION,
+    TRACE_OPS
+} trace_op_t;
+
+extern char const *const trace_op_names[TRACE_OPS];
+
+/* Arguments of a traced call (those an operation does not take are left
+ * zero) */
+typedef struct {
+    int fhandle[2];
+    uint64_t arg[2];
+    char const *path[2];
+} trace_args_t;
+
+/* A call being traced; trace is NULL if the call is not recorded */
+typedef struct {
+    struct trace *trace;
+    uint32_t seq;
+    uint64_t start_ns;
+} trace_call_t;
+
+/* Replay statistics of one operation */
+typedef struct {
+    size_t calls;
+    /* Calls whose result differs from the traced one */
+    size_t mismatches;
+    /* Total latency of the calls, in the trace and when replayed */
+    uint64_t trace_ns;
+    uint64_t replay_ns;
+} trace_op_stats_t;
+
+typedef struct {
+    trace_op_stats_t ops[TRACE_OPS];
+    /* Threads that made calls in the trace */
+    size_t threads;
+    /* Time from the first call to the end of the last one, in the trace and
+     * when replayed */
+    uint64_t trace_ns;
+    uint64_t replay_ns;
+} trace_replay_stats_t;
+
+int trace_start(tfs_ctx *fs, char const *path);
+int trace_stop(tfs_ctx *fs);
+int trace_replay(tfs_ctx *fs, char const *path, bool timed,
+                 trace_replay_stats_t *stats);
+
+void trace_enter(tfs_ctx *fs, trace_call_t *call);
+void trace_record(tfs_ctx *fs, trace_call_t *call, trace_op_t op,
+                  trace_args_t const *args, int64_t result);
+
+/*
+ * Starts tracing a call (this costs a single load when no trace is being
+ * recorded)
+ */
+static inline void trace_begin(tfs_ctx *fs, trace_call_t *call) {
+    call->trace = NULL;
+    if (atomic_load_explicit(&fs->trace, memory_order_relaxed) != NULL) {
+        trace_enter(fs, call);
+    }
+}
+
+/*
+ * Records a call started with trace_begin, once it has returned
+ */
+static inline void trace_end(tfs_ctx *fs, trace_call_t *call, trace_op_t op,
+                             trace_args_t const *args, int64_t result) {
+    if (call->trace != NULL) {
+        trace_record(fs, call, op, args, result);
+    }
+}
+
+#endif // TRACE_H
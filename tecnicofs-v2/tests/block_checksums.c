@@ -0,0 +1,71 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+static tfs_ctx *fs;
+
+#define FILE_SIZE (20 * BLOCK_SIZE)
+
+/**
+   This test corrupts a data block of a file behind the FS's back and checks
+   that reads verifying checksums stop at it, that reads not verifying them
+   do not, and that the background scrubber finds it.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+static ssize_t read_file(char const *path) {
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    ssize_t r = tfs_read(fs, fd, output, FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    return r;
+}
+
+int main() {
+    char *path = "/f1";
+
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + i % 26);
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+    assert(tfs_set_verify_mode(fs, VERIFY_ALWAYS) != -1);
+
+    int fd = tfs_open(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+
+    assert(read_file(path) == FILE_SIZE);
+    assert(memcmp(input, output, FILE_SIZE) == 0);
+    assert(tfs_checksum_errors(fs) == 0);
+
+    /* Flip a byte of the file's 13th block */
+    inode_t *inode = inode_get(fs, tfs_lookup(fs, path));
+    char *block = data_block_get(fs, inode_block_get(fs, inode, 12, false));
+    block[100] ^= 1;
+
+    assert(read_file(path) == 12 * BLOCK_SIZE);
+    assert(tfs_checksum_errors(fs) == 1);
+
+    assert(tfs_set_verify_mode(fs, VERIFY_OFF) != -1);
+    assert(read_file(path) == FILE_SIZE);
+    assert(tfs_checksum_errors(fs) == 1);
+
+    /* The scrubber eventually checks every block */
+    assert(tfs_scrubber_start(fs, 1000) != -1);
+    assert(tfs_scrubber_start(fs, 1000) == -1);
+    for (int i = 0; i < 100 && tfs_checksum_errors(fs) < 2; i++) {
+        nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+    }
+    assert(tfs_scrubber_stop(fs) != -1);
+    assert(tfs_checksum_errors(fs) >= 2);
+    assert(tfs_scrubber_stop(fs) == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_BLOCKS 20
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+#define READ_SIZE 100
+
+/**
+   This test streams a file through a handle with small reads while its
+   block map is changed through other handles (copy-on-write after a clone,
+   truncation), checking that the handle's cached lookups are invalidated
+   and it always reads the current contents.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+static void write_file(char const *path, int flags, char c) {
+    memset(input, c, FILE_SIZE);
+    int fd = tfs_open(fs, path, TFS_O_CREAT | flags);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+/* Reads a range of a file in small pieces, checking its contents */
+static void read_range(int fd, size_t len, char c) {
+    for (size_t i = 0; i < len; i += READ_SIZE) {
+        size_t n = len - i < READ_SIZE ? len - i : READ_SIZE;
+        assert(tfs_read(fs, fd, output, n) == n);
+        for (size_t j = 0; j < n; j++) {
+            assert(output[j] == c);
+        }
+    }
+}
+
+int main() {
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    write_file("/f", 0, 'A');
+
+    /* Blocks replaced by copy-on-write */
+    int fd = tfs_open(fs, "/f", 0);
+    assert(fd != -1);
+    read_range(fd, 15 * BLOCK_SIZE, 'A');
+    assert(tfs_clone(fs, "/f", "/g") != -1);
+    write_file("/f", 0, 'B');
+    read_range(fd, 5 * BLOCK_SIZE, 'B');
+    assert(tfs_close(fs, fd) != -1);
+
+    /* Blocks (and the indirect block) freed by a truncation and reused */
+    fd = tfs_open(fs, "/f", 0);
+    assert(fd != -1);
+    read_range(fd, 12 * BLOCK_SIZE, 'B');
+    int trunc_fd = tfs_open(fs, "/f", TFS_O_TRUNC);
+    assert(trunc_fd != -1);
+    assert(tfs_close(fs, trunc_fd) != -1);
+    write_file("/h", 0, 'D');
+    write_file("/f", 0, 'C');
+    read_range(fd, 8 * BLOCK_SIZE, 'C');
+    assert(tfs_close(fs, fd) != -1);
+
+    fd = tfs_open(fs, "/g", 0);
+    assert(fd != -1);
+    read_range(fd, FILE_SIZE, 'A');
+    assert(tfs_close(fs, fd) != -1);
+
+    assert(tfs_destroy(fs) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_SIZE (20 * BLOCK_SIZE)
+#define FILES 5
+
+/**
+   This test stores the data blocks of an instance in a file, through the
+   page cache and with O_DIRECT: it writes plain, compressed and cloned
+   files, evicts every block from memory and checks that they are read back
+   from the device (also after modifying them again), then corrupts a block
+   in the device file and checks that reading it back finds the corruption.
+ */
+
+static char const *device_path = "block_device.tmp";
+static tfs_ctx *fs;
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+static void write_file(char const *path, int flags, size_t offset,
+                       size_t len) {
+    int fd = tfs_open(fs, path, TFS_O_CREAT | flags);
+    assert(fd != -1);
+    assert(tfs_seek(fs, fd, offset) == 0);
+    assert(tfs_write(fs, fd, input + offset, len) == len);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+static ssize_t read_file(char const *path) {
+    memset(output, 0, sizeof(output));
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    ssize_t r = tfs_read(fs, fd, output, FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    return r;
+}
+
+static void check_files() {
+    char path[16];
+    for (int i = 0; i < FILES; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        assert(read_file(path) == FILE_SIZE);
+        assert(memcmp(input, output, FILE_SIZE) == 0);
+    }
+    assert(read_file("/compressed") == FILE_SIZE);
+    assert(memcmp(input, output, FILE_SIZE) == 0);
+    assert(read_file("/clone") == FILE_SIZE);
+    assert(memcmp(input, output, FILE_SIZE) == 0);
+}
+
+static void run(blockdev_type_t device) {
+    tfs_params params = tfs_default_params();
+    params.device = device;
+    params.device_path = device_path;
+    assert((fs = tfs_init(&params)) != NULL);
+    assert(tfs_set_verify_mode(fs, VERIFY_ALWAYS) != -1);
+
+    /* Written a piece at a time, so that blocks are staged several times */
+    char path[16];
+    for (int i = 0; i < FILES; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        write_file(path, 0, 0, FILE_SIZE / 2);
+        write_file(path, 0, FILE_SIZE / 2, FILE_SIZE / 2);
+    }
+    write_file("/compressed", TFS_O_COMPRESS, 0, FILE_SIZE);
+    assert(tfs_clone(fs, "/f0", "/clone") == 0);
+    assert(tfs_sync(fs) == 0);
+
+    assert(tfs_drop_caches(fs) == 0);
+    check_files();
+
+    /* Blocks modified after being read back are written again (and copied
+     * first, for the clone's shared blocks) */
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('A' + i % 26);
+    }
+    for (int i = 0; i < FILES; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        write_file(path, 0, 0, FILE_SIZE);
+    }
+    write_file("/compressed", TFS_O_COMPRESS, 0, FILE_SIZE);
+    write_file("/clone", 0, 0, FILE_SIZE);
+    assert(tfs_unlink(fs, "/f0") == 0);
+    write_file("/f0", 0, 0, FILE_SIZE);
+    assert(tfs_drop_caches(fs) == 0);
+    check_files();
+    assert(tfs_checksum_errors(fs) == 0);
+
+    /* Flip a byte of the 13th block of a file in the device file */
+    inode_t *inode = inode_get(fs, tfs_lookup(fs, "/f1"));
+    int b = inode_block_get(fs, inode, 12, false);
+    assert(b != -1);
+    int fd = open(device_path, O_RDWR);
+    assert(fd != -1);
+    char byte;
+    off_t offset = (off_t)b * BLOCK_SIZE + 100;
+    assert(pread(fd, &byte, 1, offset) == 1);
+    byte ^= 1;
+    assert(pwrite(fd, &byte, 1, offset) == 1);
+    assert(close(fd) == 0);
+
+    assert(tfs_drop_caches(fs) == 0);
+    assert(read_file("/f1") == 12 * BLOCK_SIZE);
+    assert(tfs_checksum_errors(fs) == 1);
+
+    assert(tfs_destroy(fs) == 0);
+    assert(unlink(device_path) == 0);
+}
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + i % 26);
+    }
+
+    /* Without a device, there is nothing to write back */
+    assert((fs = tfs_init(NULL)) != NULL);
+    assert(tfs_sync(fs) == 0);
+    assert(tfs_drop_caches(fs) == -1);
+    assert(tfs_destroy(fs) == 0);
+
+    tfs_params params = tfs_default_params();
+    params.device = BLOCKDEV_FILE;
+    assert(tfs_init(&params) == NULL);
+
+    run(BLOCKDEV_FILE);
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + i % 26);
+    }
+    run(BLOCKDEV_DIRECT);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_BLOCKS 50
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+
+/**
+   This test clones a file and checks that the clone has the same contents
+   while only using a new indirect block, and that later writes to either
+   file do not change the other one.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+/* Counts the free data blocks by allocating all of them */
+static int count_free_blocks() {
+    static int blocks[DATA_BLOCKS];
+    int n = 0;
+    while ((blocks[n] = data_block_alloc(fs)) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        assert(data_block_free(fs, blocks[i]) == 0);
+    }
+    return n;
+}
+
+static void write_at(char const *path, size_t offset, size_t len, char c) {
+    char buffer[FILE_SIZE];
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, buffer, offset) == offset);
+    memset(buffer, c, len);
+    assert(tfs_write(fs, fd, buffer, len) == len);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+static void check_file(char const *path, char const *contents) {
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(memcmp(contents, output, FILE_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + (i / BLOCK_SIZE + i) % 26);
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    int fd = tfs_open(fs, "/f1", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+
+    int before = count_free_blocks();
+    assert(tfs_clone(fs, "/f1", "/f2") != -1);
+    assert(before - count_free_blocks() == 1);
+    check_file("/f2", input);
+
+    assert(tfs_clone(fs, "/f1", "/f2") == -1);
+    assert(tfs_clone(fs, "/f3", "/f4") == -1);
+
+    /* Each file gets its own copy of the blocks it modifies */
+    char expected1[FILE_SIZE], expected2[FILE_SIZE];
+    memcpy(expected1, input, FILE_SIZE);
+    memcpy(expected2, input, FILE_SIZE);
+
+    write_at("/f2", 100, 2 * BLOCK_SIZE, 'X');
+    memset(expected2 + 100, 'X', 2 * BLOCK_SIZE);
+    write_at("/f1", 30 * BLOCK_SIZE, 10, 'Y');
+    memset(expected1 + 30 * BLOCK_SIZE, 'Y', 10);
+
+    check_file("/f1", expected1);
+    check_file("/f2", expected2);
+
+    /* Truncating the original leaves the clone intact */
+    fd = tfs_open(fs, "/f1", TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_close(fs, fd) != -1);
+    check_file("/f2", expected2);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
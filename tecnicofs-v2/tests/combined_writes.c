@@ -0,0 +1,114 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define THREADS 8
+#define WRITES 32
+#define RECORD_SIZE 100
+#define REGION_SIZE (WRITES * RECORD_SIZE)
+#define FILE_SIZE (THREADS * REGION_SIZE)
+
+/**
+   This test has several threads write to the same file at once, each
+   through its own handle, so that most writes find the i-node locked and
+   are applied by the thread holding it: first each thread fills its own
+   region of a file, then all of them append records to a compressed file.
+   It checks that every write lands where its handle's offset says, whole.
+ */
+
+static tfs_ctx *fs;
+static char output[FILE_SIZE];
+
+static void *region_writer(void *arg) {
+    int id = *(int *)arg;
+    char record[RECORD_SIZE];
+    memset(record, 'a' + id, sizeof(record));
+
+    int fd = tfs_open(fs, "/regions", 0);
+    assert(fd != -1);
+    assert(tfs_seek(fs, fd, (size_t)id * REGION_SIZE) == 0);
+    for (int i = 0; i < WRITES; i++) {
+        record[0] = (char)('0' + i % 10);
+        assert(tfs_write(fs, fd, record, RECORD_SIZE) == RECORD_SIZE);
+    }
+    assert(tfs_close(fs, fd) != -1);
+    return NULL;
+}
+
+static void *appender(void *arg) {
+    int id = *(int *)arg;
+    char record[RECORD_SIZE];
+    memset(record, 'a' + id, sizeof(record));
+
+    int fd = tfs_open(fs, "/log", TFS_O_APPEND);
+    assert(fd != -1);
+    for (int i = 0; i < WRITES; i++) {
+        assert(tfs_write(fs, fd, record, RECORD_SIZE) == RECORD_SIZE);
+    }
+    assert(tfs_close(fs, fd) != -1);
+    return NULL;
+}
+
+static void run(void *(*writer)(void *)) {
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, writer, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+}
+
+static void read_file(char const *path) {
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+int main() {
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    /* Filled with zeros first (output is still zeroed), so that every
+     * writer can seek to its region and all of them overwrite it at once */
+    int fd = tfs_open(fs, "/regions", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    run(region_writer);
+    read_file("/regions");
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        size_t id = i / REGION_SIZE, offset = i % REGION_SIZE;
+        char expected = offset % RECORD_SIZE == 0
+                            ? (char)('0' + offset / RECORD_SIZE % 10)
+                            : (char)('a' + id);
+        assert(output[i] == expected);
+    }
+
+    fd = tfs_open(fs, "/log", TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_close(fs, fd) != -1);
+    run(appender);
+    read_file("/log");
+    size_t records[THREADS] = {0};
+    for (size_t r = 0; r < FILE_SIZE / RECORD_SIZE; r++) {
+        char const *record = output + r * RECORD_SIZE;
+        int id = record[0] - 'a';
+        assert(id >= 0 && id < THREADS);
+        for (size_t i = 1; i < RECORD_SIZE; i++) {
+            assert(record[i] == record[0]);
+        }
+        records[id]++;
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(records[i] == WRITES);
+    }
+
+    assert(tfs_destroy(fs) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_SIZE (100 * BLOCK_SIZE)
+#define WRITE_SIZE 250
+#define READ_SIZE 300
+
+/**
+   This test writes the same text to a compressed and to an uncompressed
+   file, using writes that cross block and cluster boundaries, then checks
+   that both read back the same contents and that the compressed file uses
+   fewer data blocks.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+/* Counts the free data blocks by allocating all of them */
+static int count_free_blocks() {
+    static int blocks[DATA_BLOCKS];
+    int n = 0;
+    while ((blocks[n] = data_block_alloc(fs)) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        assert(data_block_free(fs, blocks[i]) == 0);
+    }
+    return n;
+}
+
+static int write_file(char const *path, int flags) {
+    int before = count_free_blocks();
+
+    int fd = tfs_open(fs, path, TFS_O_CREAT | flags);
+    assert(fd != -1);
+    for (size_t i = 0; i < FILE_SIZE; i += WRITE_SIZE) {
+        size_t len = FILE_SIZE - i < WRITE_SIZE ? FILE_SIZE - i : WRITE_SIZE;
+        assert(tfs_write(fs, fd, input + i, len) == len);
+    }
+    assert(tfs_close(fs, fd) != -1);
+
+    return before - count_free_blocks();
+}
+
+static void check_file(char const *path) {
+    memset(output, 0, FILE_SIZE);
+
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    for (size_t i = 0; i < FILE_SIZE; i += READ_SIZE) {
+        size_t len = FILE_SIZE - i < READ_SIZE ? FILE_SIZE - i : READ_SIZE;
+        assert(tfs_read(fs, fd, output + i, len) == len);
+    }
+    assert(tfs_read(fs, fd, output, READ_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+
+    assert(memcmp(input, output, FILE_SIZE) == 0);
+}
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE;) {
+        char line[64];
+        int n = snprintf(line, sizeof(line), "line %zu: the quick brown fox\n",
+                         i / 32);
+        for (int j = 0; j < n && i < FILE_SIZE; j++) {
+            input[i++] = line[j];
+        }
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    int plain_blocks = write_file("/plain", 0);
+    int compressed_blocks = write_file("/compressed", TFS_O_COMPRESS);
+
+    check_file("/plain");
+    check_file("/compressed");
+
+    assert(compressed_blocks < plain_blocks / 2);
+
+    /* Overwriting part of the compressed file keeps the rest intact */
+    int fd = tfs_open(fs, "/compressed", 0);
+    assert(fd != -1);
+    memset(input + BLOCK_SIZE, 'x', 3 * BLOCK_SIZE);
+    assert(tfs_write(fs, fd, input, 4 * BLOCK_SIZE) == 4 * BLOCK_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    check_file("/compressed");
+
+    /* Truncating the compressed file frees its blocks */
+    int before = count_free_blocks();
+    fd = tfs_open(fs, "/compressed", TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, READ_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+    assert(count_free_blocks() > before);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define THREADS 8
+#define RECORDS 200
+#define RECORD_SIZE 50
+#define FILE_SIZE (THREADS * RECORDS * RECORD_SIZE)
+
+/**
+   This test has several threads appending records to the same file, each
+   through its own handle, while another thread reads the file, and then
+   checks that no record was lost or overwritten and that the records of
+   each thread are in order.
+ */
+
+static char output[FILE_SIZE];
+
+static void *append(void *arg) {
+    int id = *(int *)arg;
+    char record[RECORD_SIZE];
+
+    int fd = tfs_open(fs, "/log", TFS_O_APPEND);
+    assert(fd != -1);
+    for (int i = 0; i < RECORDS; i++) {
+        memset(record, 'a' + id, RECORD_SIZE);
+        memcpy(record, &i, sizeof(i));
+        assert(tfs_write(fs, fd, record, RECORD_SIZE) == RECORD_SIZE);
+    }
+    assert(tfs_close(fs, fd) != -1);
+    return NULL;
+}
+
+static void *read_all(void *arg) {
+    (void)arg;
+    char buffer[RECORD_SIZE];
+
+    int fd = tfs_open(fs, "/log", 0);
+    assert(fd != -1);
+    ssize_t n = 0;
+    for (int i = 0; i < RECORDS; i++) {
+        ssize_t r = tfs_read(fs, fd, buffer, sizeof(buffer));
+        assert(r >= 0);
+        n += r;
+    }
+    assert(n <= FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[THREADS], reader;
+    int ids[THREADS];
+
+    assert((fs = tfs_init(NULL)) != NULL);
+    int fd = tfs_open(fs, "/log", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fs, fd) != -1);
+
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&threads[i], NULL, append, &ids[i]) == 0);
+    }
+    assert(pthread_create(&reader, NULL, read_all, NULL) == 0);
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(pthread_join(reader, NULL) == 0);
+
+    fd = tfs_open(fs, "/log", 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_read(fs, fd, output, 1) == 0);
+    assert(tfs_close(fs, fd) != -1);
+
+    int next[THREADS] = {0};
+    for (size_t r = 0; r < THREADS * RECORDS; r++) {
+        char *record = output + r * RECORD_SIZE;
+        int id = record[RECORD_SIZE - 1] - 'a';
+        assert(id >= 0 && id < THREADS);
+        for (size_t j = sizeof(int); j < RECORD_SIZE; j++) {
+            assert(record[j] == 'a' + id);
+        }
+        int seq;
+        memcpy(&seq, record, sizeof(seq));
+        assert(seq == next[id]++);
+    }
+
+    /* Appends after a truncation start at the beginning of the file */
+    fd = tfs_open(fs, "/log", TFS_O_TRUNC | TFS_O_APPEND);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, "abc", 3) == 3);
+    assert(tfs_close(fs, fd) != -1);
+    fd = tfs_open(fs, "/log", 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == 3);
+    assert(memcmp(output, "abc", 3) == 0);
+    assert(tfs_close(fs, fd) != -1);
+
+    assert(tfs_destroy(fs) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define STABLE_FILES 8
+#define READERS 4
+#define LOOKUPS 2000
+#define CHURN_ROUNDS 200
+
+/**
+   This test looks files up and opens them from several threads while
+   another thread keeps creating and unlinking other files in the same
+   directory, checking that lookups (which do not lock the directory)
+   always find the files that stay, with their own i-node, and never
+   find a file that is not there.
+ */
+
+static tfs_ctx *fs;
+static int stable_inumbers[STABLE_FILES];
+
+static void stable_path(char *path, size_t size, int i) {
+    snprintf(path, size, "/stable%d", i);
+}
+
+static void *reader(void *arg) {
+    int id = *(int *)arg;
+    char path[MAX_FILE_NAME];
+    for (int n = 0; n < LOOKUPS; n++) {
+        int i = (n + id) % STABLE_FILES;
+        stable_path(path, sizeof(path), i);
+        assert(tfs_lookup(fs, path) == stable_inumbers[i]);
+        assert(tfs_lookup(fs, "/missing") == -1);
+        if (n % 16 == 0) {
+            int fd = tfs_open(fs, path, 0);
+            assert(fd != -1);
+            assert(tfs_close(fs, fd) != -1);
+        }
+    }
+    return NULL;
+}
+
+static void *churner(void *arg) {
+    (void)arg;
+    for (int n = 0; n < CHURN_ROUNDS; n++) {
+        int fd = tfs_open(fs, "/churn", TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_close(fs, fd) != -1);
+        assert(tfs_lookup(fs, "/churn") != -1);
+        assert(tfs_unlink(fs, "/churn") == 0);
+        assert(tfs_lookup(fs, "/churn") == -1);
+    }
+    return NULL;
+}
+
+int main() {
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    char path[MAX_FILE_NAME];
+    for (int i = 0; i < STABLE_FILES; i++) {
+        stable_path(path, sizeof(path), i);
+        int fd = tfs_open(fs, path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_close(fs, fd) != -1);
+        stable_inumbers[i] = tfs_lookup(fs, path);
+        assert(stable_inumbers[i] != -1);
+    }
+
+    pthread_t tid[READERS + 1];
+    int ids[READERS];
+    for (int i = 0; i < READERS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, reader, &ids[i]) == 0);
+    }
+    assert(pthread_create(&tid[READERS], NULL, churner, NULL) == 0);
+    for (int i = 0; i <= READERS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    /* Names are compared up to MAX_FILE_NAME characters, as before */
+    char long_name[MAX_FILE_NAME + 2];
+    long_name[0] = '/';
+    memset(long_name + 1, 'x', MAX_FILE_NAME);
+    long_name[MAX_FILE_NAME + 1] = '\0';
+    int fd = tfs_open(fs, long_name, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fs, fd) != -1);
+    long_name[MAX_FILE_NAME] = '\0';
+    assert(tfs_lookup(fs, long_name) != -1);
+
+    assert(tfs_destroy(fs) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_SIZE (200 * BLOCK_SIZE + 123)
+
+/**
+   This test copies files inside TecnicoFS, whole and in ranges that start
+   at different offsets within their blocks, to new, existing, cloned and
+   compressed files, and checks the copies' contents.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+static void write_file(char const *path, int flags, char const *data,
+                       size_t len) {
+    int fd = tfs_open(fs, path, TFS_O_CREAT | TFS_O_TRUNC | flags);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, data, len) == len);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+static void check_file(char const *path, char const *data, size_t len) {
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == len);
+    assert(memcmp(output, data, len) == 0);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)(i * 7 + i / BLOCK_SIZE);
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    write_file("/f1", 0, input, FILE_SIZE);
+
+    /* Whole file, to a new file and over a longer existing one */
+    assert(tfs_copy_file(fs, "/f1", "/f2") != -1);
+    check_file("/f2", input, FILE_SIZE);
+    write_file("/f3", 0, input, 100);
+    assert(tfs_copy_file(fs, "/f1", "/f3") != -1);
+    check_file("/f3", input, FILE_SIZE);
+    write_file("/f4", 0, input, 100);
+    assert(tfs_copy_file(fs, "/f4", "/f3") != -1);
+    check_file("/f3", input, 100);
+
+    /* A range, between offsets in the middle of blocks */
+    static char expected[FILE_SIZE];
+    memset(expected, 'x', 5000);
+    write_file("/f3", 0, expected, 5000);
+    memcpy(expected + 777, input + 100, 30000);
+    int source = tfs_open(fs, "/f1", 0);
+    int dest = tfs_open(fs, "/f3", 0);
+    assert(source != -1 && dest != -1);
+    assert(tfs_seek(fs, source, 100) == 0);
+    assert(tfs_seek(fs, dest, 777) == 0);
+    assert(tfs_copy_range(fs, source, dest, 30000) == 30000);
+    check_file("/f3", expected, 777 + 30000);
+
+    /* The copy stops at the end of the source */
+    assert(tfs_seek(fs, source, FILE_SIZE - 10) == 0);
+    assert(tfs_copy_range(fs, source, dest, 100) == 10);
+    assert(tfs_copy_range(fs, source, dest, 100) == 0);
+    memcpy(expected + 777 + 30000, input + FILE_SIZE - 10, 10);
+    check_file("/f3", expected, 777 + 30000 + 10);
+
+    /* A file cannot be copied onto itself */
+    assert(tfs_copy_range(fs, source, source, 100) == -1);
+    assert(tfs_copy_file(fs, "/f1", "/f1") == -1);
+    assert(tfs_close(fs, source) != -1);
+    assert(tfs_close(fs, dest) != -1);
+
+    /* Copying into a clone leaves the original untouched */
+    memcpy(expected, input, FILE_SIZE);
+    memset(expected, 'y', 100);
+    write_file("/f4", 0, expected, 100);
+    assert(tfs_clone(fs, "/f1", "/clone") != -1);
+    source = tfs_open(fs, "/f4", 0);
+    dest = tfs_open(fs, "/clone", 0);
+    assert(source != -1 && dest != -1);
+    assert(tfs_copy_range(fs, source, dest, 100) == 100);
+    assert(tfs_close(fs, source) != -1);
+    assert(tfs_close(fs, dest) != -1);
+    check_file("/f1", input, FILE_SIZE);
+    check_file("/clone", expected, FILE_SIZE);
+
+    /* Compressed files are copied too */
+    write_file("/compressed", TFS_O_COMPRESS, input, 10 * BLOCK_SIZE);
+    assert(tfs_copy_file(fs, "/compressed", "/f5") != -1);
+    check_file("/f5", input, 10 * BLOCK_SIZE);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
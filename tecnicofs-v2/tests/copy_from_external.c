@@ -0,0 +1,65 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+static tfs_ctx *fs;
+
+#define MAX_SIZE (MAX_FILE_BLOCKS * BLOCK_SIZE)
+
+/**
+   This test imports external files of several sizes (including ones large
+   enough to be split among threads and one that ends in a partial block)
+   and checks their contents, and that files too large, missing or
+   directories are rejected.
+ */
+
+static char const *external_path = "external_import.tmp";
+static char input[MAX_SIZE + 1];
+static char output[MAX_SIZE];
+
+static void write_external(size_t size) {
+    FILE *fp = fopen(external_path, "w");
+    assert(fp != NULL);
+    assert(fwrite(input, 1, size, fp) == size);
+    assert(fclose(fp) == 0);
+}
+
+static void import_and_check(size_t size) {
+    write_external(size);
+    assert(tfs_copy_from_external_fs(fs, external_path, "/f1") != -1);
+
+    int fd = tfs_open(fs, "/f1", 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, MAX_SIZE) == size);
+    assert(memcmp(input, output, size) == 0);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+int main() {
+    for (size_t i = 0; i < sizeof(input); i++) {
+        input[i] = (char)(i % 251);
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+    assert(tfs_set_verify_mode(fs, VERIFY_ALWAYS) != -1);
+
+    /* Each import overwrites the previous one (larger or smaller) */
+    import_and_check(100);
+    import_and_check(MAX_SIZE);
+    import_and_check(100 * BLOCK_SIZE + 7);
+    import_and_check(0);
+    import_and_check(BLOCK_SIZE);
+
+    write_external(MAX_SIZE + 1);
+    assert(tfs_copy_from_external_fs(fs, external_path, "/f2") == -1);
+    assert(tfs_lookup(fs, "/f2") == -1);
+
+    assert(unlink(external_path) == 0);
+    assert(tfs_copy_from_external_fs(fs, external_path, "/f2") == -1);
+    assert(tfs_copy_from_external_fs(fs, ".", "/f2") == -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
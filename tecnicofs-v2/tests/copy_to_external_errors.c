@@ -1,22 +1,25 @@
 #include "fs/operations.h"
 #include <assert.h>
 
+static tfs_ctx *fs;
+
 int main() {
     char *path1 = "/f1";
 
     /* Tests different scenarios where tfs_copy_to_external_fs is expected to fail */
 
-    assert(tfs_init() != -1);
+    assert((fs = tfs_init(NULL)) != NULL);
     
-    int f1 = tfs_open(path1, TFS_O_CREAT);
+    int f1 = tfs_open(fs, path1, TFS_O_CREAT);
     assert(f1 != -1);
-    assert(tfs_close(f1) != -1);
+    assert(tfs_close(fs, f1) != -1);
 
     /* Scenario 1: destination file is in directory that does not exist */
-    assert (tfs_copy_to_external_fs(path1, "./wrong_dir/unexpectedfile") == -1);
+    assert (tfs_copy_to_external_fs(fs, path1,
+                                    "./wrong_dir/unexpectedfile") == -1);
 
     /* Scenario 2: source file does not exist */
-    assert(tfs_copy_to_external_fs("/f2", "out") == -1);
+    assert(tfs_copy_to_external_fs(fs, "/f2", "out") == -1);
 
     printf("Successful test.\n");
 
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <unistd.h>
 
+static tfs_ctx *fs;
+
 int main() {
 
     char *str = "AAA! AAA! AAA! ";
@@ -10,16 +12,16 @@ int main() {
     char *path2 = "external_file.txt";
     char to_read[40];
 
-    assert(tfs_init() != -1);
+    assert((fs = tfs_init(NULL)) != NULL);
 
-    int file = tfs_open(path, TFS_O_CREAT);
+    int file = tfs_open(fs, path, TFS_O_CREAT);
     assert(file != -1);
 
-    assert(tfs_write(file, str, strlen(str)) != -1);
+    assert(tfs_write(fs, file, str, strlen(str)) != -1);
 
-    assert(tfs_close(file) != -1);
+    assert(tfs_close(fs, file) != -1);
 
-    assert(tfs_copy_to_external_fs(path, path2) != -1);
+    assert(tfs_copy_to_external_fs(fs, path, path2) != -1);
 
     FILE *fp = fopen(path2, "r");
 
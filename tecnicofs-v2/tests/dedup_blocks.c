@@ -0,0 +1,87 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_BLOCKS 20
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+
+/**
+   This test writes the same contents to two deduplicated files and checks
+   that the second one shares the blocks of the first. It then overwrites
+   and truncates the files, checking that the shared blocks are copied on
+   write and only freed once no file uses them.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+/* Counts the free data blocks by allocating all of them */
+static int count_free_blocks() {
+    static int blocks[DATA_BLOCKS];
+    int n = 0;
+    while ((blocks[n] = data_block_alloc(fs)) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        assert(data_block_free(fs, blocks[i]) == 0);
+    }
+    return n;
+}
+
+static int write_file(char const *path, char const *contents) {
+    int before = count_free_blocks();
+
+    int fd = tfs_open(fs, path, TFS_O_CREAT | TFS_O_DEDUP);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, contents, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+
+    return before - count_free_blocks();
+}
+
+static void check_file(char const *path, char const *contents) {
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(memcmp(contents, output, FILE_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + (i / BLOCK_SIZE + i) % 26);
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    /* Data blocks plus the indirect block */
+    assert(write_file("/f1", input) == FILE_BLOCKS + 1);
+    /* Only the indirect block */
+    assert(write_file("/f2", input) == 1);
+    check_file("/f1", input);
+    check_file("/f2", input);
+
+    /* Overwriting a shared block copies it */
+    char modified[FILE_SIZE];
+    memcpy(modified, input, FILE_SIZE);
+    memset(modified + 3 * BLOCK_SIZE + 10, 'X', 100);
+
+    int fd = tfs_open(fs, "/f2", 0);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, modified, 4 * BLOCK_SIZE) == 4 * BLOCK_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    check_file("/f1", input);
+    check_file("/f2", modified);
+
+    /* Truncating a file keeps the blocks still used by the other one */
+    fd = tfs_open(fs, "/f1", TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_close(fs, fd) != -1);
+    check_file("/f2", modified);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+static tfs_ctx *fs;
+
+#define FILES 4
+#define FILE_BLOCKS 40
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+
+/**
+   This test fragments files by writing them a block at a time in turns,
+   then defragments one while another thread keeps reading it, checking
+   that its blocks end up in a single run with the same contents (also
+   through a file handle opened before), that no block is leaked and that
+   a file sharing blocks with a clone is left alone. The background
+   defragmenter then takes care of the other files.
+ */
+
+static char inputs[FILES][FILE_SIZE];
+static char const *const paths[FILES] = {"/f0", "/f1", "/f2", "/f3"};
+static _Atomic bool stop;
+
+static void check_file(int f) {
+    static char output[FILE_SIZE];
+    int fd = tfs_open(fs, paths[f], 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(memcmp(inputs[f], output, FILE_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+static size_t extents(int f) {
+    fragmentation_t frag;
+    assert(tfs_fragmentation(fs, paths[f], &frag) == 0);
+    assert(frag.blocks == FILE_BLOCKS);
+    return frag.extents;
+}
+
+/* Counts the free data blocks by allocating all of them */
+static int count_free_blocks() {
+    static int blocks[DATA_BLOCKS];
+    int n = 0;
+    while ((blocks[n] = data_block_alloc(fs)) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        assert(data_block_free(fs, blocks[i]) == 0);
+    }
+    return n;
+}
+
+static void *reader(void *arg) {
+    (void)arg;
+    char output[BLOCK_SIZE];
+    int fd = tfs_open(fs, paths[0], 0);
+    assert(fd != -1);
+    while (!stop) {
+        assert(tfs_seek(fs, fd, 0) == 0);
+        for (size_t i = 0; i < FILE_BLOCKS; i++) {
+            assert(tfs_read(fs, fd, output, BLOCK_SIZE) == BLOCK_SIZE);
+            assert(memcmp(inputs[0] + i * BLOCK_SIZE, output, BLOCK_SIZE) ==
+                   0);
+        }
+    }
+    assert(tfs_close(fs, fd) != -1);
+    return NULL;
+}
+
+int main() {
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    int fds[FILES];
+    for (int f = 0; f < FILES; f++) {
+        for (size_t i = 0; i < FILE_SIZE; i++) {
+            inputs[f][i] = (char)('a' + (i + (size_t)f * 7) % 26);
+        }
+        fds[f] = tfs_open(fs, paths[f], TFS_O_CREAT);
+        assert(fds[f] != -1);
+    }
+    for (size_t i = 0; i < FILE_BLOCKS; i++) {
+        for (int f = 0; f < FILES; f++) {
+            assert(tfs_write(fs, fds[f], inputs[f] + i * BLOCK_SIZE,
+                             BLOCK_SIZE) == BLOCK_SIZE);
+        }
+    }
+    for (int f = 0; f < FILES; f++) {
+        assert(tfs_close(fs, fds[f]) != -1);
+        assert(extents(f) == FILE_BLOCKS);
+    }
+
+    /* Read through a handle opened before the blocks move */
+    int fd = tfs_open(fs, paths[0], 0);
+    assert(fd != -1);
+    char output[BLOCK_SIZE];
+    assert(tfs_read(fs, fd, output, BLOCK_SIZE) == BLOCK_SIZE);
+
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, reader, NULL) == 0);
+    nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+    fragmentation_t frag;
+    assert(tfs_fragmentation(fs, "/", &frag) == -1);
+    assert(tfs_defrag(fs, paths[0]) == FILE_BLOCKS);
+    stop = true;
+    assert(pthread_join(tid, NULL) == 0);
+
+    assert(extents(0) == 1);
+    assert(tfs_defrag(fs, paths[0]) == 0);
+    check_file(0);
+    assert(tfs_read(fs, fd, output, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(memcmp(inputs[0] + BLOCK_SIZE, output, BLOCK_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+
+    /* The blocks moved were freed: once the unlinked file is reclaimed (in
+     * the background, so this waits for up to 10 seconds), the whole
+     * volume can be filled, but for 3 files with an indirect block each
+     * and the root directory */
+    assert(tfs_unlink(fs, paths[0]) == 0);
+    int expected = DATA_BLOCKS - 3 * (FILE_BLOCKS + 1) - 1;
+    for (int i = 0; i < 1000 && count_free_blocks() != expected; i++) {
+        nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+    }
+    assert(count_free_blocks() == expected);
+
+    assert(tfs_clone(fs, paths[1], "/clone") == 0);
+    assert(tfs_defrag(fs, paths[1]) == 0);
+    assert(extents(1) == FILE_BLOCKS);
+    assert(tfs_unlink(fs, "/clone") == 0);
+
+    assert(tfs_defrag_start(fs, 1000) == 0);
+    assert(tfs_defrag_start(fs, 1000) == -1);
+    for (int i = 0; i < 500 && (extents(1) > 1 || extents(2) > 1 ||
+                                extents(3) > 1);
+         i++) {
+        nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+    }
+    assert(tfs_defrag_stop(fs) == 0);
+    assert(tfs_defrag_stop(fs) == -1);
+    for (int f = 1; f < FILES; f++) {
+        assert(extents(f) == 1);
+        check_file(f);
+    }
+
+    assert(tfs_destroy(fs) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_BLOCKS 50
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+
+/**
+   This test reserves the blocks of a file with tfs_fallocate after leaving
+   a small hole in the free blocks, checking that the reserved blocks are
+   consecutive, that the file's size is not changed and that writing the
+   file afterwards does not allocate any block.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+/* Counts the free data blocks by allocating all of them */
+static int count_free_blocks() {
+    static int blocks[DATA_BLOCKS];
+    int n = 0;
+    while ((blocks[n] = data_block_alloc(fs)) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        assert(data_block_free(fs, blocks[i]) == 0);
+    }
+    return n;
+}
+
+static void write_file(char const *path, size_t len) {
+    int fd = tfs_open(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input, len) == len);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+int main() {
+    memset(input, 'A', FILE_SIZE);
+
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    /* Leaves a hole of 3 free blocks before the blocks of /b */
+    write_file("/a", 3 * BLOCK_SIZE);
+    write_file("/b", 3 * BLOCK_SIZE);
+    int fd = tfs_open(fs, "/a", TFS_O_TRUNC);
+    assert(fd != -1);
+    assert(tfs_close(fs, fd) != -1);
+
+    fd = tfs_open(fs, "/f", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_fallocate(fs, fd, 0, 0) == -1);
+    assert(tfs_fallocate(fs, fd, 0, MAX_FILE_BLOCKS * BLOCK_SIZE + 1) == -1);
+    assert(tfs_fallocate(fs, -1, 0, FILE_SIZE) == -1);
+
+    int before = count_free_blocks();
+    assert(tfs_fallocate(fs, fd, 0, FILE_SIZE) == 0);
+    /* The data blocks and the indirect block */
+    assert(count_free_blocks() == before - FILE_BLOCKS - 1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == 0);
+
+    inode_t *inode = inode_get(fs, tfs_lookup(fs, "/f"));
+    assert(inode != NULL);
+    for (size_t i = 1; i < FILE_BLOCKS; i++) {
+        assert(inode_block_get(fs, inode, i, false) ==
+               inode_block_get(fs, inode, i - 1, false) + 1);
+    }
+
+    /* Writing the reserved range allocates nothing */
+    before = count_free_blocks();
+    assert(tfs_write(fs, fd, input, FILE_SIZE) == FILE_SIZE);
+    assert(count_free_blocks() == before);
+    assert(tfs_close(fs, fd) != -1);
+
+    fd = tfs_open(fs, "/f", 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(memcmp(input, output, FILE_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+
+    /* Not supported for compressed files */
+    fd = tfs_open(fs, "/c", TFS_O_CREAT | TFS_O_COMPRESS);
+    assert(fd != -1);
+    assert(tfs_fallocate(fs, fd, 0, FILE_SIZE) == -1);
+    assert(tfs_close(fs, fd) != -1);
+
+    assert(tfs_destroy(fs) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define MAX_FILE_SIZE (MAX_FILE_BLOCKS * BLOCK_SIZE)
+
+/**
+   This test fills the FS with maximum size files, checking that the last
+   one is cut short when the data blocks run out, and then truncates all of
+   them, checking that every block is freed.
+ */
+
+static char input[MAX_FILE_SIZE];
+
+/* Counts the free data blocks by allocating all of them */
+static int count_free_blocks() {
+    static int blocks[DATA_BLOCKS];
+    int n = 0;
+    while ((blocks[n] = data_block_alloc(fs)) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        assert(data_block_free(fs, blocks[i]) == 0);
+    }
+    return n;
+}
+
+int main() {
+    char *paths[] = {"/f1", "/f2", "/f3", "/f4"};
+
+    memset(input, 'A', MAX_FILE_SIZE);
+
+    assert((fs = tfs_init(NULL)) != NULL);
+    int free_blocks = count_free_blocks();
+
+    for (int i = 0; i < 4; i++) {
+        int fd = tfs_open(fs, paths[i], TFS_O_CREAT);
+        assert(fd != -1);
+        ssize_t written = tfs_write(fs, fd, input, MAX_FILE_SIZE + 1);
+        if (i < 3) {
+            assert(written == MAX_FILE_SIZE);
+        } else {
+            /* What is left, minus the indirect block */
+            int left = free_blocks - 3 * (int)(MAX_FILE_BLOCKS + 1) - 1;
+            assert(written == left * BLOCK_SIZE);
+        }
+        assert(tfs_close(fs, fd) != -1);
+    }
+    assert(count_free_blocks() == 0);
+
+    for (int i = 0; i < 4; i++) {
+        int fd = tfs_open(fs, paths[i], TFS_O_TRUNC);
+        assert(fd != -1);
+        assert(tfs_close(fs, fd) != -1);
+    }
+    assert(count_free_blocks() == free_blocks);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
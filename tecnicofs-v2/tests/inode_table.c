@@ -0,0 +1,91 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#define CAPACITY (3 * INODE_CHUNK_INODES + 10)
+#define MANY_INODES (20000)
+#define FILES 20
+
+/**
+   This test fills a small i-node table, checking that i-nodes are created
+   lowest number first, that numbers past the capacity are never handed out
+   and that freed numbers are reused; then it creates many i-nodes in an
+   instance of the default capacity, which only initializes the i-nodes
+   created. Last, it keeps filling a table with files that are unlinked,
+   which can only be created again once those are reclaimed.
+ */
+
+static int inumbers[MANY_INODES];
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 0;
+    assert(tfs_init(&params) == NULL);
+
+    params.max_inode_count = CAPACITY;
+    tfs_ctx *fs = tfs_init(&params);
+    assert(fs != NULL);
+    /* Only the root directory exists */
+    assert(inode_table_extent(fs) == 1);
+    assert(inode_get(fs, 1) == NULL);
+    for (int i = 1; i < CAPACITY; i++) {
+        assert(inode_create(fs, T_FILE) == i);
+    }
+    assert(inode_create(fs, T_FILE) == -1);
+    assert(inode_table_extent(fs) == CAPACITY);
+    assert(inode_get(fs, CAPACITY - 1) != NULL);
+    assert(inode_get(fs, CAPACITY) == NULL);
+    assert(inode_get(fs, -1) == NULL);
+
+    assert(inode_delete(fs, 700) == 0);
+    assert(inode_delete(fs, 700) == -1);
+    assert(inode_delete(fs, 5) == 0);
+    assert(inode_create(fs, T_FILE) == 5);
+    assert(inode_create(fs, T_FILE) == 700);
+    assert(inode_create(fs, T_FILE) == -1);
+    assert(tfs_destroy(fs) == 0);
+
+    assert((fs = tfs_init(NULL)) != NULL);
+    for (int i = 0; i < MANY_INODES; i++) {
+        inumbers[i] = inode_create(fs, T_FILE);
+        assert(inumbers[i] == i + 1);
+    }
+    assert(inode_table_extent(fs) == MANY_INODES + 1);
+    assert(inode_get(fs, MANY_INODES) != NULL);
+    assert(inode_get(fs, (int)inode_table_extent(fs)) == NULL);
+    for (int i = 0; i < MANY_INODES; i++) {
+        assert(inode_delete(fs, inumbers[i]) == 0);
+    }
+    assert(inode_create(fs, T_FILE) == 1);
+    assert(tfs_destroy(fs) == 0);
+
+    /* Files unlinked through the namespace are reclaimed in the background
+     * (in the order they were queued), making room for new ones */
+    params.max_inode_count = FILES + 1;
+    assert((fs = tfs_init(&params)) != NULL);
+    char path[16];
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < FILES; i++) {
+            snprintf(path, sizeof(path), "/f%d", i);
+            int fd = -1;
+            for (int tries = 0; fd == -1 && tries < 1000; tries++) {
+                if ((fd = tfs_open(fs, path, TFS_O_CREAT)) == -1) {
+                    nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+                }
+            }
+            assert(fd != -1);
+            assert(tfs_close(fs, fd) != -1);
+        }
+        assert(tfs_open(fs, "/extra", TFS_O_CREAT) == -1);
+        for (int i = 0; i < FILES; i++) {
+            snprintf(path, sizeof(path), "/f%d", i);
+            assert(tfs_unlink(fs, path) == 0);
+        }
+    }
+    assert(tfs_destroy(fs) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
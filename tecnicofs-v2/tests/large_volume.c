@@ -0,0 +1,60 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_COUNT 20
+#define MAX_FILE_SIZE (MAX_FILE_BLOCKS * BLOCK_SIZE)
+#define VOLUME_BLOCKS (16 * DATA_BLOCKS)
+
+/**
+   This test initializes the FS with a data region larger than the default
+   one and writes more data than the default one can hold, checking that it
+   is read back and that the part of the region that is never used is not
+   mapped.
+ */
+
+static char input[MAX_FILE_SIZE];
+static char output[MAX_FILE_SIZE];
+
+int main() {
+    char path[16];
+
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 0;
+    assert(tfs_init(&params) == NULL);
+
+    params.max_block_count = VOLUME_BLOCKS;
+    assert((fs = tfs_init(&params)) != NULL);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        memset(input, 'A' + i, MAX_FILE_SIZE);
+        snprintf(path, sizeof(path), "/f%d", i);
+        int fd = tfs_open(fs, path, TFS_O_CREAT);
+        assert(fd != -1);
+        assert(tfs_write(fs, fd, input, MAX_FILE_SIZE) == MAX_FILE_SIZE);
+        assert(tfs_close(fs, fd) != -1);
+    }
+    assert(FILE_COUNT * MAX_FILE_BLOCKS > DATA_BLOCKS);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        memset(input, 'A' + i, MAX_FILE_SIZE);
+        snprintf(path, sizeof(path), "/f%d", i);
+        int fd = tfs_open(fs, path, 0);
+        assert(fd != -1);
+        assert(tfs_read(fs, fd, output, MAX_FILE_SIZE) == MAX_FILE_SIZE);
+        assert(memcmp(input, output, MAX_FILE_SIZE) == 0);
+        assert(tfs_close(fs, fd) != -1);
+    }
+
+    /* The last chunk of the region was never allocated from */
+    assert(data_block_get(fs, VOLUME_BLOCKS - 1) == NULL);
+    assert(data_block_get(fs, VOLUME_BLOCKS) == NULL);
+
+    assert(tfs_destroy(fs) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#define INSTANCES 4
+#define FILE_SIZE (20 * BLOCK_SIZE)
+#define WRITE_SIZE 300
+
+/**
+   This test runs several independent instances at once, one per thread,
+   each writing different contents to the same path, and checks that every
+   instance only sees its own files and blocks.
+ */
+
+typedef struct {
+    tfs_ctx *fs;
+    char fill;
+} args_struct;
+
+static void *write_and_check(void *arg) {
+    args_struct *args = arg;
+    static char input[INSTANCES][FILE_SIZE];
+    static char output[INSTANCES][FILE_SIZE];
+    int i = args->fill - 'A';
+
+    memset(input[i], args->fill, FILE_SIZE);
+
+    int fd = tfs_open(args->fs, "/f1", TFS_O_CREAT);
+    assert(fd != -1);
+    for (size_t done = 0; done < FILE_SIZE; done += WRITE_SIZE) {
+        size_t len =
+            FILE_SIZE - done < WRITE_SIZE ? FILE_SIZE - done : WRITE_SIZE;
+        assert(tfs_write(args->fs, fd, input[i] + done, len) == len);
+    }
+    assert(tfs_close(args->fs, fd) != -1);
+
+    fd = tfs_open(args->fs, "/f1", 0);
+    assert(fd != -1);
+    assert(tfs_read(args->fs, fd, output[i], FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(args->fs, fd) != -1);
+    assert(memcmp(input[i], output[i], FILE_SIZE) == 0);
+
+    return NULL;
+}
+
+int main() {
+    args_struct args[INSTANCES];
+    pthread_t threads[INSTANCES];
+
+    for (int i = 0; i < INSTANCES; i++) {
+        assert((args[i].fs = tfs_init(NULL)) != NULL);
+        args[i].fill = (char)('A' + i);
+    }
+    for (int i = 0; i < INSTANCES; i++) {
+        assert(pthread_create(&threads[i], NULL, write_and_check, &args[i]) ==
+               0);
+    }
+    for (int i = 0; i < INSTANCES; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+
+    /* A file created in one instance is not visible in the others */
+    int fd = tfs_open(args[0].fs, "/only_in_0", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(args[0].fs, fd) != -1);
+    assert(tfs_lookup(args[0].fs, "/only_in_0") != -1);
+    assert(tfs_lookup(args[1].fs, "/only_in_0") == -1);
+
+    /* Filling one instance leaves the blocks of the others free */
+    while (data_block_alloc(args[0].fs) != -1) {
+    }
+    int block = data_block_alloc(args[1].fs);
+    assert(block != -1);
+    assert(data_block_free(args[1].fs, block) == 0);
+
+    /* Destroying an instance does not affect the others */
+    assert(tfs_destroy(args[0].fs) == 0);
+    char buffer[WRITE_SIZE];
+    fd = tfs_open(args[1].fs, "/f1", 0);
+    assert(fd != -1);
+    assert(tfs_read(args[1].fs, fd, buffer, WRITE_SIZE) == WRITE_SIZE);
+    assert(buffer[0] == 'B' && buffer[WRITE_SIZE - 1] == 'B');
+    assert(tfs_close(args[1].fs, fd) != -1);
+
+    for (int i = 1; i < INSTANCES; i++) {
+        assert(tfs_destroy(args[i].fs) == 0);
+    }
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+#define FILE_SIZE (MAX_FILE_BLOCKS * BLOCK_SIZE)
+#define THRESHOLD (4 * BLOCK_SIZE)
+#define READERS 4
+
+/**
+   This test enables the parallel copy mode and makes reads and writes
+   large enough to be split among threads: unaligned writes that allocate
+   blocks and that overwrite them, writes to a clone (whose blocks must be
+   copied first), appends and reads from several threads at once, each
+   compared with the contents expected. A large read stops before a
+   corrupted block, as a small one does.
+ */
+
+static tfs_ctx *fs;
+static char input[FILE_SIZE];
+static char output[READERS][FILE_SIZE];
+
+static void check_file(char const *path, char const *expected, size_t len,
+                       char *buffer) {
+    int fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, buffer, FILE_SIZE) == len);
+    assert(memcmp(expected, buffer, len) == 0);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+static void *reader(void *arg) {
+    int id = *(int *)arg;
+    for (int i = 0; i < 8; i++) {
+        check_file("/f", input, FILE_SIZE, output[id]);
+    }
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + i % 23);
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+    assert(tfs_set_parallel_copy(fs, THRESHOLD, COPY_POOL_THREADS + 1) == -1);
+    assert(tfs_set_parallel_copy(fs, THRESHOLD, 4) == 0);
+
+    /* Unaligned, allocating the blocks, then overwriting most of them */
+    int fd = tfs_open(fs, "/f", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input, 100) == 100);
+    assert(tfs_write(fs, fd, input + 100, FILE_SIZE - 100) ==
+           FILE_SIZE - 100);
+    assert(tfs_seek(fs, fd, 3 * BLOCK_SIZE + 7) == 0);
+    assert(tfs_write(fs, fd, input + 3 * BLOCK_SIZE + 7, 100 * BLOCK_SIZE) ==
+           100 * BLOCK_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    check_file("/f", input, FILE_SIZE, output[0]);
+
+    /* A clone's blocks are copied before it is written */
+    assert(tfs_clone(fs, "/f", "/clone") == 0);
+    fd = tfs_open(fs, "/clone", 0);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input + BLOCK_SIZE, 50 * BLOCK_SIZE) ==
+           50 * BLOCK_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    check_file("/f", input, FILE_SIZE, output[0]);
+    fd = tfs_open(fs, "/clone", 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output[0], 50 * BLOCK_SIZE) == 50 * BLOCK_SIZE);
+    assert(memcmp(input + BLOCK_SIZE, output[0], 50 * BLOCK_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+
+    /* Appends, in pieces above and below the threshold */
+    fd = tfs_open(fs, "/log", TFS_O_CREAT | TFS_O_APPEND);
+    assert(fd != -1);
+    size_t size = 0;
+    for (size_t len = 10 * BLOCK_SIZE + 300; size + len <= FILE_SIZE;
+         len = len == 10 * BLOCK_SIZE + 300 ? 500 : 10 * BLOCK_SIZE + 300) {
+        assert(tfs_write(fs, fd, input + size, len) == len);
+        size += len;
+    }
+    assert(tfs_close(fs, fd) != -1);
+    check_file("/log", input, size, output[0]);
+
+    pthread_t tid[READERS];
+    int ids[READERS];
+    for (int i = 0; i < READERS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, reader, &ids[i]) == 0);
+    }
+    for (int i = 0; i < READERS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+
+    /* Flip a byte of the 13th block */
+    assert(tfs_set_verify_mode(fs, VERIFY_ALWAYS) != -1);
+    inode_t *inode = inode_get(fs, tfs_lookup(fs, "/f"));
+    char *block = data_block_get(fs, inode_block_get(fs, inode, 12, false));
+    block[100] ^= 1;
+    fd = tfs_open(fs, "/f", 0);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output[0], FILE_SIZE) == 12 * BLOCK_SIZE);
+    assert(memcmp(input, output[0], 12 * BLOCK_SIZE) == 0);
+    assert(tfs_close(fs, fd) != -1);
+    assert(tfs_checksum_errors(fs) == 1);
+    block[100] ^= 1;
+
+    /* Disabled again, the same calls copy on the calling thread */
+    assert(tfs_set_parallel_copy(fs, 0, 0) == 0);
+    check_file("/f", input, FILE_SIZE, output[0]);
+
+    assert(tfs_destroy(fs) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILES 12
+#define NEW_FILES 10
+#define BATCH 5
+
+/**
+   This test lists the root directory in small batches while another
+   thread creates files, checking that every file that exists during the
+   whole listing is returned exactly once, and removed files are not.
+ */
+
+static void create_file(char const *prefix, int i) {
+    char path[MAX_FILE_NAME];
+    snprintf(path, sizeof(path), "/%s%d", prefix, i);
+    int fd = tfs_open(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+static void *create_files(void *arg) {
+    (void)arg;
+    for (int i = 0; i < NEW_FILES; i++) {
+        create_file("g", i);
+    }
+    return NULL;
+}
+
+/* Lists the root directory, counting how many times each file shows up */
+static void list_root(int *seen, int *new_seen) {
+    dir_entry_t entries[BATCH];
+    size_t cursor = 0;
+    ssize_t n;
+    while ((n = tfs_readdir(fs, "/", &cursor, entries, BATCH)) > 0) {
+        assert(n <= BATCH);
+        for (ssize_t i = 0; i < n; i++) {
+            char path[MAX_FILE_NAME + 1] = "/";
+            strcat(path, entries[i].d_name);
+            assert(tfs_lookup(fs, path) == entries[i].d_inumber);
+
+            int index = atoi(entries[i].d_name + 1);
+            if (entries[i].d_name[0] == 'f') {
+                seen[index]++;
+            } else {
+                assert(entries[i].d_name[0] == 'g');
+                new_seen[index]++;
+            }
+        }
+    }
+    assert(n == 0);
+    /* The end of the directory stays the end */
+    assert(tfs_readdir(fs, "/", &cursor, entries, BATCH) == 0);
+}
+
+int main() {
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    for (int i = 0; i < FILES; i++) {
+        create_file("f", i);
+    }
+    assert(tfs_unlink(fs, "/f3") != -1);
+
+    pthread_t creator;
+    assert(pthread_create(&creator, NULL, create_files, NULL) == 0);
+    bool done = false;
+    while (!done) {
+        int seen[FILES] = {0}, new_seen[NEW_FILES] = {0};
+        list_root(seen, new_seen);
+        done = true;
+        for (int i = 0; i < FILES; i++) {
+            assert(seen[i] == (i == 3 ? 0 : 1));
+        }
+        for (int i = 0; i < NEW_FILES; i++) {
+            assert(new_seen[i] <= 1);
+            done = done && new_seen[i] == 1;
+        }
+    }
+    assert(pthread_join(creator, NULL) == 0);
+
+    size_t cursor = 0;
+    dir_entry_t entry;
+    assert(tfs_readdir(fs, "/f1", &cursor, &entry, 1) == -1);
+
+    assert(tfs_destroy(fs) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
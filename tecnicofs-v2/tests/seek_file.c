@@ -0,0 +1,56 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+
+static tfs_ctx *fs;
+
+#define FILE_SIZE (15 * BLOCK_SIZE)
+
+/**
+   This test moves the offset of an open file back and forth, reading and
+   overwriting data at each position, and checks that the offset cannot go
+   past the end of the file.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + i % 26);
+    }
+
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    int fd = tfs_open(fs, "/f1", TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input, FILE_SIZE) == FILE_SIZE);
+
+    /* Read backwards, one block at a time (ending in the indirect blocks
+     * first) */
+    for (size_t i = FILE_SIZE / BLOCK_SIZE; i-- > 0;) {
+        assert(tfs_seek(fs, fd, i * BLOCK_SIZE) == 0);
+        assert(tfs_read(fs, fd, output, BLOCK_SIZE) == BLOCK_SIZE);
+        assert(memcmp(output, input + i * BLOCK_SIZE, BLOCK_SIZE) == 0);
+    }
+
+    /* Overwrite a range in the middle of the file */
+    memset(input + 3000, 'x', 5000);
+    assert(tfs_seek(fs, fd, 3000) == 0);
+    assert(tfs_write(fs, fd, input + 3000, 5000) == 5000);
+
+    /* The end of the file is a valid offset, past it is not */
+    assert(tfs_seek(fs, fd, FILE_SIZE) == 0);
+    assert(tfs_read(fs, fd, output, BLOCK_SIZE) == 0);
+    assert(tfs_seek(fs, fd, FILE_SIZE + 1) == -1);
+
+    assert(tfs_seek(fs, fd, 0) == 0);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(memcmp(output, input, FILE_SIZE) == 0);
+
+    assert(tfs_close(fs, fd) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
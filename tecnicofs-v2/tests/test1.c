@@ -2,35 +2,37 @@
 #include <assert.h>
 #include <string.h>
 
+static tfs_ctx *fs;
+
 int main() {
 
     char *str = "AAA!";
     char *path = "/f1";
     char buffer[40];
 
-    assert(tfs_init() != -1);
+    assert((fs = tfs_init(NULL)) != NULL);
 
     int f;
     ssize_t r;
 
-    f = tfs_open(path, TFS_O_CREAT);
+    f = tfs_open(fs, path, TFS_O_CREAT);
     assert(f != -1);
 
-    r = tfs_write(f, str, strlen(str));
+    r = tfs_write(fs, f, str, strlen(str));
     assert(r == strlen(str));
 
-    assert(tfs_close(f) != -1);
+    assert(tfs_close(fs, f) != -1);
 
-    f = tfs_open(path, 0);
+    f = tfs_open(fs, path, 0);
     assert(f != -1);
 
-    r = tfs_read(f, buffer, sizeof(buffer) - 1);
+    r = tfs_read(fs, f, buffer, sizeof(buffer) - 1);
     assert(r == strlen(str));
 
     buffer[r] = '\0';
     assert(strcmp(buffer, str) == 0);
 
-    assert(tfs_close(f) != -1);
+    assert(tfs_close(fs, f) != -1);
 
     printf("Successful test.\n");
 
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <unistd.h>
 
+static tfs_ctx *fs;
+
 #define COUNT 40
 #define DOUBLECOUNT 80
 #define SIZE 256
@@ -30,17 +32,17 @@ int main() {
     char *path4="/f2";
     //char to_read[40];
 
-    assert(tfs_init() != -1);
+    assert((fs = tfs_init(NULL)) != NULL);
 
-    int file1 = tfs_open(path1, TFS_O_CREAT);
+    int file1 = tfs_open(fs, path1, TFS_O_CREAT);
     assert(file1 != -1);
 
-    assert(tfs_write(file1, str, strlen(str)) != -1);
+    assert(tfs_write(fs, file1, str, strlen(str)) != -1);
 
-    int file2 = tfs_open(path4, TFS_O_CREAT);
+    int file2 = tfs_open(fs, path4, TFS_O_CREAT);
     assert(file2 != -1);
 
-    assert(tfs_write(file2, str, strlen(str)) != -1);
+    assert(tfs_write(fs, file2, str, strlen(str)) != -1);
 
     pthread_t cpy1, cpy2, cpy3, cpy4;
     args_struct args1,args2,args3,args4;
@@ -67,8 +69,8 @@ int main() {
     assert(pthread_join(cpy3, NULL) == 0);
     assert(pthread_join(cpy4, NULL) == 0);
 
-    assert(tfs_close(file1) != -1);
-    assert(tfs_close(file2) != -1);
+    assert(tfs_close(fs, file1) != -1);
+    assert(tfs_close(fs, file2) != -1);
 
 
     unlink(path2);
@@ -83,7 +85,7 @@ int main() {
 void* copy_to_external (void* args) {
     char to_read[40];
 
-    assert(tfs_copy_to_external_fs(((args_struct*) args)->path_o,((args_struct*) args)->path_d) != -1);
+    assert(tfs_copy_to_external_fs(fs, ((args_struct*) args)->path_o,((args_struct*) args)->path_d) != -1);
     FILE *fp = fopen(((args_struct*) args)->path_d, "r");
 
     assert(fp != NULL);
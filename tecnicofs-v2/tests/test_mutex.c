@@ -2,6 +2,8 @@
 #include <assert.h>
 #include <string.h>
 
+static tfs_ctx *fs;
+
 #define COUNT 40
 #define SIZE 256
 
@@ -24,7 +26,7 @@ int main() {
     args.path = "/f1";
     memset(args.input, 'A', SIZE);
 
-    assert(tfs_init() != -1);
+    assert((fs = tfs_init(NULL)) != NULL);
     pthread_t write1, write2, read1, read2;
 
     assert(pthread_create(&write1,NULL, &write, &args) == 0);
@@ -46,24 +48,24 @@ void* read (void* args) {
 
     char output [SIZE];
 
-    int fd = tfs_open(((args_struct*)args)->path, 0);
+    int fd = tfs_open(fs, ((args_struct*)args)->path, 0);
     assert(fd != -1 );
 
     for (int i = 0; i < COUNT; i++) {
-        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(tfs_read(fs, fd, output, SIZE) == SIZE);
         assert(memcmp(((args_struct*)args)->input, output, SIZE) == 0);
     }
 
-    assert(tfs_close(fd) != -1);
+    assert(tfs_close(fs, fd) != -1);
     return 0;
 }
 
 void* write (void* args) {
-    int fd = tfs_open(((args_struct*)args)->path, TFS_O_CREAT);
+    int fd = tfs_open(fs, ((args_struct*)args)->path, TFS_O_CREAT);
     assert(fd != -1);
     for (int i = 0; i < COUNT; i++) {
-        assert(tfs_write(fd, ((args_struct*)args)->input, SIZE) == SIZE);
+        assert(tfs_write(fs, fd, ((args_struct*)args)->input, SIZE) == SIZE);
     }
-    assert(tfs_close(fd) != -1);
+    assert(tfs_close(fs, fd) != -1);
     return 0;
 }
\ No newline at end of file
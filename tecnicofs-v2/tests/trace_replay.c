@@ -0,0 +1,142 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#define THREADS 4
+#define WRITES 20
+#define WRITE_SIZE 300
+#define RECORD_SIZE 50
+
+/**
+   This test records a trace of several threads writing and reading their
+   own files and appending to a file opened by the main thread, plus copies,
+   clones, an import, unlinks and a defragmentation, then replays it against
+   fresh volumes (as fast as possible and with the traced timing) and checks
+   that every call is replayed with the same result and that the files end
+   up the same size.
+ */
+
+static char const *trace_path = "trace_replay.tmp";
+static char const *external_path = "trace_import.tmp";
+static tfs_ctx *fs;
+static int log_fd;
+
+static void *worker(void *arg) {
+    int id = *(int *)arg;
+    char path[16], buffer[WRITE_SIZE];
+    snprintf(path, sizeof(path), "/f%d", id);
+    memset(buffer, 'a' + id, sizeof(buffer));
+
+    int fd = tfs_open(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    for (int i = 0; i < WRITES; i++) {
+        assert(tfs_write(fs, fd, buffer, WRITE_SIZE - (size_t)id) ==
+               WRITE_SIZE - id);
+        assert(tfs_write(fs, log_fd, buffer, RECORD_SIZE) == RECORD_SIZE);
+    }
+    assert(tfs_seek(fs, fd, WRITE_SIZE) == 0);
+    assert(tfs_read(fs, fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(tfs_close(fs, fd) != -1);
+    return NULL;
+}
+
+static ssize_t file_size(tfs_ctx *instance, char const *path) {
+    static char buffer[MAX_FILE_BLOCKS * BLOCK_SIZE];
+    int fd = tfs_open(instance, path, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t size = tfs_read(instance, fd, buffer, sizeof(buffer));
+    assert(tfs_close(instance, fd) != -1);
+    return size;
+}
+
+static char const *const paths[] = {"/f0",   "/f1",   "/f2",   "/log",
+                                    "/copy", "/clone", "/import"};
+#define PATHS (sizeof(paths) / sizeof(paths[0]))
+
+static void check_replay(bool timed, ssize_t const *sizes) {
+    tfs_ctx *replayed = tfs_init(NULL);
+    assert(replayed != NULL);
+
+    trace_replay_stats_t stats;
+    assert(tfs_trace_replay(replayed, trace_path, timed, &stats) == 0);
+    assert(stats.threads == THREADS + 1);
+    assert(stats.ops[TRACE_OPEN].calls == THREADS + 1);
+    assert(stats.ops[TRACE_WRITE].calls == THREADS * WRITES * 2);
+    assert(stats.ops[TRACE_COPY_FROM_EXTERNAL].calls == 1);
+    assert(stats.ops[TRACE_DEFRAG].calls == 1);
+    assert(stats.ops[TRACE_FRAGMENTATION].calls == 1);
+    for (size_t op = 0; op < TRACE_OPS; op++) {
+        assert(stats.ops[op].mismatches == 0);
+    }
+    /* Calls wait for their traced start times */
+    if (timed) {
+        assert(stats.replay_ns >= stats.trace_ns / 2);
+    }
+
+    for (size_t i = 0; i < PATHS; i++) {
+        assert(file_size(replayed, paths[i]) == sizes[i]);
+    }
+    assert(tfs_destroy(replayed) == 0);
+}
+
+int main() {
+    assert((fs = tfs_init(NULL)) != NULL);
+
+    FILE *fp = fopen(external_path, "w");
+    assert(fp != NULL);
+    assert(fprintf(fp, "external contents") > 0);
+    assert(fclose(fp) == 0);
+
+    assert(tfs_trace_start(fs, trace_path) == 0);
+    assert(tfs_trace_start(fs, trace_path) == -1);
+
+    log_fd = tfs_open(fs, "/log", TFS_O_CREAT | TFS_O_APPEND);
+    assert(log_fd != -1);
+    pthread_t tid[THREADS];
+    int ids[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ids[i] = i;
+        assert(pthread_create(&tid[i], NULL, worker, &ids[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(tid[i], NULL) == 0);
+    }
+    assert(tfs_close(fs, log_fd) != -1);
+
+    assert(tfs_copy_file(fs, "/f0", "/copy") == 0);
+    assert(tfs_clone(fs, "/f1", "/clone") == 0);
+    assert(tfs_copy_from_external_fs(fs, external_path, "/import") == 0);
+    assert(tfs_unlink(fs, "/f3") == 0);
+    /* A copy is written as a single run of blocks, so neither call depends
+     * on how the concurrent writes were interleaved */
+    fragmentation_t frag;
+    assert(tfs_fragmentation(fs, "/copy", &frag) == 0);
+    assert(tfs_defrag(fs, "/copy") == 0);
+    assert(tfs_lookup(fs, "/f3") == -1);
+    dir_entry_t entries[4];
+    size_t cursor = 0;
+    assert(tfs_readdir(fs, "/", &cursor, entries, 4) == 4);
+
+    assert(tfs_trace_stop(fs) == 0);
+    assert(tfs_trace_stop(fs) == -1);
+    assert(unlink(external_path) == 0);
+
+    ssize_t sizes[PATHS];
+    for (size_t i = 0; i < PATHS; i++) {
+        sizes[i] = file_size(fs, paths[i]);
+        assert(sizes[i] > 0);
+    }
+    assert(tfs_destroy(fs) == 0);
+
+    check_replay(false, sizes);
+    check_replay(true, sizes);
+
+    assert(unlink(trace_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
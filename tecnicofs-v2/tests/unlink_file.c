@@ -0,0 +1,84 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+static tfs_ctx *fs;
+
+#define FILE_SIZE (40 * BLOCK_SIZE)
+
+/**
+   This test unlinks a file while it is open, checking that it can still be
+   read through the open handle but no longer looked up, and that its blocks
+   are reclaimed once the handle is closed.
+ */
+
+static char input[FILE_SIZE];
+static char output[FILE_SIZE];
+
+/* Counts the free data blocks by allocating all of them */
+static int count_free_blocks() {
+    static int blocks[DATA_BLOCKS];
+    int n = 0;
+    while ((blocks[n] = data_block_alloc(fs)) != -1) {
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        assert(data_block_free(fs, blocks[i]) == 0);
+    }
+    return n;
+}
+
+/* Waits (for up to 10 seconds) until the reclaimer frees the blocks */
+static void wait_free_blocks(int expected) {
+    for (int i = 0; i < 1000 && count_free_blocks() != expected; i++) {
+        nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+    }
+    assert(count_free_blocks() == expected);
+}
+
+int main() {
+    char *path = "/f1";
+
+    memset(input, 'A', FILE_SIZE);
+
+    assert((fs = tfs_init(NULL)) != NULL);
+    int free_blocks = count_free_blocks();
+
+    int fd = tfs_open(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_write(fs, fd, input, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+
+    /* Unlinking an open file keeps its contents until it is closed */
+    fd = tfs_open(fs, path, 0);
+    assert(fd != -1);
+    assert(tfs_unlink(fs, path) == 0);
+    assert(tfs_lookup(fs, path) == -1);
+    assert(tfs_open(fs, path, 0) == -1);
+    assert(tfs_unlink(fs, path) == -1);
+
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == FILE_SIZE);
+    assert(memcmp(input, output, FILE_SIZE) == 0);
+    assert(count_free_blocks() < free_blocks);
+
+    assert(tfs_close(fs, fd) != -1);
+    wait_free_blocks(free_blocks);
+
+    /* The name can be reused for a new, empty file */
+    fd = tfs_open(fs, path, TFS_O_CREAT);
+    assert(fd != -1);
+    assert(tfs_read(fs, fd, output, FILE_SIZE) == 0);
+    assert(tfs_write(fs, fd, input, BLOCK_SIZE) == BLOCK_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+
+    /* A file that is not open is reclaimed right away */
+    assert(tfs_unlink(fs, path) == 0);
+    wait_free_blocks(free_blocks);
+
+    assert(tfs_destroy(fs) != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -2,6 +2,8 @@
 #include <assert.h>
 #include <string.h>
 
+static tfs_ctx *fs;
+
 #define COUNT 40
 #define SIZE 256
 
@@ -23,29 +25,29 @@ int main() {
 
     char output [SIZE];
 
-    assert(tfs_init() != -1);
+    assert((fs = tfs_init(NULL)) != NULL);
 
     /* Write input COUNT times into a new file */
-    int fd = tfs_open(path, TFS_O_CREAT);
+    int fd = tfs_open(fs, path, TFS_O_CREAT);
     //printf("abriu\n");
     assert(fd != -1);
     for (int i = 0; i < COUNT; i++) {
-        assert(tfs_write(fd, input, SIZE) == SIZE);
+        assert(tfs_write(fs, fd, input, SIZE) == SIZE);
          //printf("escreveu %d\n", i);
     }
-    assert(tfs_close(fd) != -1);
+    assert(tfs_close(fs, fd) != -1);
 
     /* Open again to check if contents are as expected */
-    fd = tfs_open(path, 0);
+    fd = tfs_open(fs, path, 0);
     assert(fd != -1 );
 
     for (int i = 0; i < COUNT; i++) {
-        assert(tfs_read(fd, output, SIZE) == SIZE);
+        assert(tfs_read(fs, fd, output, SIZE) == SIZE);
         //printf("leu %d\n", i);
         assert (memcmp(input, output, SIZE) == 0);
     }
 
-    assert(tfs_close(fd) != -1);
+    assert(tfs_close(fs, fd) != -1);
     //printf("fechou\n");
 
     printf("Sucessful test\n");
@@ -0,0 +1,160 @@
+#include "../fs/operations.h"
+#include <assert.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_BLOCKS 20
+#define FILE_SIZE (FILE_BLOCKS * BLOCK_SIZE)
+
+/**
+   This test reads files without copying: the buffers returned must hold
+   the file's contents and keep holding them, until released, while the
+   file is overwritten, truncated, unlinked or defragmented, and evicting
+   the blocks from memory is refused meanwhile. It also reads while
+   another thread keeps overwriting the file, and checks the reads of a
+   corrupted block, of a compressed file and past the end of a file.
+ */
+
+static char const *device_path = "zero_copy_read.tmp";
+static tfs_ctx *fs;
+static char input[FILE_SIZE];
+static char other[FILE_SIZE];
+
+static void write_file(char const *path, int flags, char const *data,
+                       size_t offset, size_t len) {
+    int fd = tfs_open(fs, path, TFS_O_CREAT | flags);
+    assert(fd != -1);
+    assert(tfs_seek(fs, fd, offset) == 0);
+    assert(tfs_write(fs, fd, data + offset, len) == len);
+    assert(tfs_close(fs, fd) != -1);
+}
+
+/* Checks that buffers hold len bytes of expected, in order */
+static void check_iov(struct iovec const *iov, size_t iovcnt,
+                      char const *expected, size_t len) {
+    size_t offset = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        assert(offset + iov[i].iov_len <= len);
+        assert(memcmp(iov[i].iov_base, expected + offset, iov[i].iov_len) ==
+               0);
+        offset += iov[i].iov_len;
+    }
+    assert(offset == len);
+}
+
+static void *overwriter(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 50; i++) {
+        write_file("/shared", 0, i % 2 ? other : input, 0, FILE_SIZE);
+    }
+    return NULL;
+}
+
+int main() {
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        input[i] = (char)('a' + i % 23);
+        other[i] = (char)('A' + i % 19);
+    }
+
+    tfs_params params = tfs_default_params();
+    params.device = BLOCKDEV_FILE;
+    params.device_path = device_path;
+    assert((fs = tfs_init(&params)) != NULL);
+
+    /* Two files written a block at a time each, so that their blocks are
+     * interleaved (and the files fragmented) */
+    for (size_t i = 0; i < FILE_BLOCKS; i++) {
+        write_file("/f", 0, input, i * BLOCK_SIZE, BLOCK_SIZE);
+        write_file("/g", 0, input, i * BLOCK_SIZE, BLOCK_SIZE);
+    }
+
+    /* Unaligned, in two reads; the first buffers stay valid after the
+     * second read */
+    int fd = tfs_open(fs, "/f", 0);
+    assert(fd != -1);
+    assert(tfs_seek(fs, fd, 100) == 0);
+    struct iovec *iov, *iov2;
+    size_t iovcnt, iovcnt2;
+    assert(tfs_read_zc(fs, fd, 5 * BLOCK_SIZE, &iov, &iovcnt) ==
+           5 * BLOCK_SIZE);
+    check_iov(iov, iovcnt, input + 100, 5 * BLOCK_SIZE);
+    assert(tfs_read_zc(fs, fd, FILE_SIZE, &iov2, &iovcnt2) ==
+           FILE_SIZE - 5 * BLOCK_SIZE - 100);
+    check_iov(iov2, iovcnt2, input + 5 * BLOCK_SIZE + 100,
+              FILE_SIZE - 5 * BLOCK_SIZE - 100);
+    assert(tfs_read_zc_release(fs, iov2) == 0);
+
+    /* At the end of the file */
+    assert(tfs_read_zc(fs, fd, FILE_SIZE, &iov2, &iovcnt2) == 0);
+    assert(iov2 == NULL && iovcnt2 == 0);
+    assert(tfs_read_zc_release(fs, iov2) == -1);
+
+    /* The pinned blocks are neither moved nor evicted */
+    assert(tfs_defrag(fs, "/f") == 0);
+    assert(tfs_drop_caches(fs) == -1);
+
+    /* Nor modified or freed */
+    write_file("/f", 0, other, 0, FILE_SIZE);
+    check_iov(iov, iovcnt, input + 100, 5 * BLOCK_SIZE);
+    write_file("/f", TFS_O_TRUNC, other, 0, BLOCK_SIZE);
+    write_file("/g", 0, other, 0, FILE_SIZE);
+    check_iov(iov, iovcnt, input + 100, 5 * BLOCK_SIZE);
+    assert(tfs_close(fs, fd) != -1);
+    assert(tfs_unlink(fs, "/f") == 0);
+    write_file("/h", 0, other, 0, FILE_SIZE);
+    check_iov(iov, iovcnt, input + 100, 5 * BLOCK_SIZE);
+    assert(tfs_read_zc_release(fs, iov) == 0);
+
+    /* Released, the blocks can be evicted and files moved again */
+    assert(tfs_drop_caches(fs) == 0);
+    assert(tfs_defrag(fs, "/g") == FILE_BLOCKS);
+
+    /* Each read sees a single version of the file */
+    write_file("/shared", 0, input, 0, FILE_SIZE);
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, overwriter, NULL) == 0);
+    fd = tfs_open(fs, "/shared", 0);
+    assert(fd != -1);
+    for (int i = 0; i < 50; i++) {
+        assert(tfs_seek(fs, fd, 0) == 0);
+        assert(tfs_read_zc(fs, fd, FILE_SIZE, &iov, &iovcnt) == FILE_SIZE);
+        sched_yield();
+        char const *expected =
+            *(char *)iov[0].iov_base == input[0] ? input : other;
+        check_iov(iov, iovcnt, expected, FILE_SIZE);
+        assert(tfs_read_zc_release(fs, iov) == 0);
+    }
+    assert(pthread_join(tid, NULL) == 0);
+    assert(tfs_close(fs, fd) != -1);
+
+    /* Stops before a corrupted block; the blocks read, consecutive since
+     * the file was defragmented, come in a single buffer */
+    assert(tfs_set_verify_mode(fs, VERIFY_ALWAYS) != -1);
+    inode_t *inode = inode_get(fs, tfs_lookup(fs, "/g"));
+    char *block = data_block_get(fs, inode_block_get(fs, inode, 7, false));
+    block[100] ^= 1;
+    fd = tfs_open(fs, "/g", 0);
+    assert(fd != -1);
+    assert(tfs_read_zc(fs, fd, FILE_SIZE, &iov, &iovcnt) == 7 * BLOCK_SIZE);
+    assert(iovcnt == 1);
+    check_iov(iov, iovcnt, other, 7 * BLOCK_SIZE);
+    assert(tfs_read_zc_release(fs, iov) == 0);
+    assert(tfs_read_zc(fs, fd, FILE_SIZE, &iov, &iovcnt) == -1);
+    assert(tfs_close(fs, fd) != -1);
+    block[100] ^= 1;
+
+    /* Compressed files are not supported */
+    write_file("/compressed", TFS_O_COMPRESS, input, 0, FILE_SIZE);
+    fd = tfs_open(fs, "/compressed", 0);
+    assert(fd != -1);
+    assert(tfs_read_zc(fs, fd, FILE_SIZE, &iov, &iovcnt) == -1);
+    assert(tfs_close(fs, fd) != -1);
+
+    assert(tfs_destroy(fs) == 0);
+    assert(unlink(device_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
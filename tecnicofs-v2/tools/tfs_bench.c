@@ -0,0 +1,141 @@
+/*
+ * Copy throughput benchmark: measures the throughput of reads and writes
+ * of a file, for a range of request sizes, with the parallel copy mode
+ * (see tfs_set_parallel_copy) disabled and enabled, and that of zero-copy
+ * reads (see tfs_read_zc). As with the other reads, the data read is not
+ * accessed: the buffers of zero-copy reads are released right away.
+ *
+ * Usage: tools/tfs_bench [--threads=N] [--threshold=BYTES] [--mb=N]
+ *  - --threads=N: threads of the parallel copy mode (by default, one per
+ *    CPU)
+ *  - --threshold=BYTES: smallest request copied in parallel (by default,
+ *    16 blocks)
+ *  - --mb=N: amount of data read and written for each request size, in
+ *    MiB (by default, 64)
+ */
+#include "operations.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FILE_SIZE (MAX_FILE_BLOCKS * BLOCK_SIZE)
+
+static size_t const request_sizes[] = {
+    BLOCK_SIZE,      4 * BLOCK_SIZE,  16 * BLOCK_SIZE,
+    64 * BLOCK_SIZE, 128 * BLOCK_SIZE, MAX_FILE_BLOCKS * BLOCK_SIZE};
+
+static char buffer[FILE_SIZE];
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Writes (or reads) total bytes through the file, in requests of the given
+ * size, going back to its start whenever a request would not fit
+ * Returns the throughput, in MiB/s (-1 if a request fails)
+ */
+static double run(tfs_ctx *fs, int fd, size_t request, size_t total,
+                  bool write) {
+    size_t offset = FILE_SIZE;
+    double start = now_s();
+    for (size_t done = 0; done < total; done += request) {
+        if (offset + request > FILE_SIZE) {
+            offset = 0;
+            if (tfs_seek(fs, fd, 0) == -1) {
+                return -1;
+            }
+        }
+        ssize_t n = write ? tfs_write(fs, fd, buffer, request)
+                          : tfs_read(fs, fd, buffer, request);
+        if (n != (ssize_t)request) {
+            return -1;
+        }
+        offset += request;
+    }
+    return (double)total / (1024.0 * 1024.0) / (now_s() - start);
+}
+
+/*
+ * Reads total bytes of the file with tfs_read_zc, like run
+ * Returns the throughput, in MiB/s (-1 if a request fails)
+ */
+static double run_zc(tfs_ctx *fs, int fd, size_t request, size_t total) {
+    size_t offset = FILE_SIZE;
+    double start = now_s();
+    for (size_t done = 0; done < total; done += request) {
+        if (offset + request > FILE_SIZE) {
+            offset = 0;
+            if (tfs_seek(fs, fd, 0) == -1) {
+                return -1;
+            }
+        }
+        struct iovec *iov;
+        size_t iovcnt;
+        if (tfs_read_zc(fs, fd, request, &iov, &iovcnt) != (ssize_t)request ||
+            tfs_read_zc_release(fs, iov) == -1) {
+            return -1;
+        }
+        offset += request;
+    }
+    return (double)total / (1024.0 * 1024.0) / (now_s() - start);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int threads = 0;
+    size_t threshold = 16 * BLOCK_SIZE;
+    size_t total = 64;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = (unsigned int)strtoul(argv[i] + 10, NULL, 10);
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = strtoul(argv[i] + 12, NULL, 10);
+        } else if (strncmp(argv[i], "--mb=", 5) == 0) {
+            total = strtoul(argv[i] + 5, NULL, 10);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--threads=N] [--threshold=BYTES] [--mb=N]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    total *= 1024 * 1024;
+    memset(buffer, 'x', sizeof(buffer));
+
+    tfs_ctx *fs = tfs_init(NULL);
+    int fd = fs == NULL ? -1 : tfs_open(fs, "/f", TFS_O_CREAT);
+    if (fd == -1 || tfs_write(fs, fd, buffer, FILE_SIZE) != FILE_SIZE ||
+        tfs_set_verify_mode(fs, VERIFY_OFF) == -1) {
+        fprintf(stderr, "tfs_bench: failed to set up the volume\n");
+        return 1;
+    }
+
+    printf("%-14s %14s %14s %14s %14s %14s\n", "request (B)",
+           "write (MiB/s)", "parallel", "read (MiB/s)", "parallel",
+           "zero-copy");
+    for (size_t i = 0; i < sizeof(request_sizes) / sizeof(*request_sizes);
+         i++) {
+        size_t request = request_sizes[i];
+        double results[5];
+        for (int parallel = 0; parallel < 2; parallel++) {
+            if (tfs_set_parallel_copy(fs, parallel ? threshold : 0,
+                                      threads) == -1) {
+                fprintf(stderr, "tfs_bench: invalid parallel copy mode\n");
+                return 1;
+            }
+            results[parallel] = run(fs, fd, request, total, true);
+            results[2 + parallel] = run(fs, fd, request, total, false);
+        }
+        results[4] = run_zc(fs, fd, request, total);
+        printf("%-14zu %14.1f %14.1f %14.1f %14.1f %14.1f\n", request,
+               results[0], results[1], results[2], results[3], results[4]);
+    }
+
+    tfs_close(fs, fd);
+    tfs_destroy(fs);
+    return 0;
+}
@@ -0,0 +1,291 @@
+/*
+ * FUSE front-end: mounts a TecnicoFS volume, so that standard tools and
+ * benchmarks (fio, filebench, ...) can run on it.
+ *
+ * Usage: tools/tfs_fuse [--blocks=N] [--trace=FILE] <mountpoint> [FUSE options]
+ *  - --blocks=N: capacity of the data region, in blocks
+ *  - --trace=FILE: records a trace of the calls (see tools/tfs_replay)
+ *  - -f runs in the foreground, -s disables the multithreaded loop
+ *
+ * The volume lives in memory and is lost when it is unmounted. Requests
+ * are served by FUSE's multithreaded loop, so requests to different open
+ * files run in parallel, as they do through the tfs_* API.
+ */
+#define FUSE_USE_VERSION 31
+
+#include "operations.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <linux/falloc.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest request FUSE sends us; the kernel may lower it */
+#define MAX_IO_SIZE (1024 * 1024)
+
+/* Number of directory entries listed per call to tfs_readdir */
+#define READDIR_BATCH (32)
+
+/* A file opened through FUSE */
+typedef struct {
+    /* Serializes the seek and the read/write of a request, as FUSE gives
+     * each request its own offset */
+    pthread_mutex_t mutex;
+    int fhandle;
+} fuse_file_t;
+
+static struct options {
+    unsigned long blocks;
+    char *trace;
+} options;
+
+static struct fuse_opt const option_spec[] = {
+    {"--blocks=%lu", offsetof(struct options, blocks), 1},
+    {"--trace=%s", offsetof(struct options, trace), 1},
+    FUSE_OPT_END,
+};
+
+static tfs_ctx *get_fs() { return fuse_get_context()->private_data; }
+
+static void *tfs_fuse_init(struct fuse_conn_info *conn,
+                           struct fuse_config *cfg) {
+    /* Send every request to TecnicoFS instead of the kernel's page cache,
+     * so that benchmarks measure the filesystem itself */
+    cfg->direct_io = 1;
+    cfg->use_ino = 1;
+    /* Allow large requests (libfuse also raises the read size to match) */
+    conn->max_write = MAX_IO_SIZE;
+    conn->max_readahead = MAX_IO_SIZE;
+    return get_fs();
+}
+
+static void tfs_fuse_destroy(void *private_data) { tfs_destroy(private_data); }
+
+static int tfs_fuse_getattr(char const *path, struct stat *st,
+                            struct fuse_file_info *fi) {
+    (void)fi;
+    memset(st, 0, sizeof(*st));
+    st->st_blksize = BLOCK_SIZE;
+    if (strcmp(path, "/") == 0) {
+        st->st_ino = ROOT_DIR_INUM;
+        st->st_mode = S_IFDIR | 0755;
+        st->st_nlink = 2;
+        return 0;
+    }
+
+    tfs_ctx *fs = get_fs();
+    int inumber = tfs_lookup(fs, path);
+    inode_t *inode = inumber == -1 ? NULL : inode_get(fs, inumber);
+    if (inode == NULL) {
+        return -ENOENT;
+    }
+    pthread_rwlock_rdlock(&inode->rwlock);
+    size_t size = inode->i_size;
+    pthread_rwlock_unlock(&inode->rwlock);
+
+    st->st_ino = (ino_t)inumber;
+    st->st_mode = S_IFREG | 0644;
+    st->st_nlink = 1;
+    st->st_size = (off_t)size;
+    st->st_blocks = (blkcnt_t)((size + 511) / 512);
+    return 0;
+}
+
+static int tfs_fuse_readdir(char const *path, void *buf,
+                            fuse_fill_dir_t filler, off_t offset,
+                            struct fuse_file_info *fi,
+                            enum fuse_readdir_flags flags) {
+    (void)offset;
+    (void)fi;
+    (void)flags;
+    if (strcmp(path, "/") != 0) {
+        return -ENOENT;
+    }
+    filler(buf, ".", NULL, 0, 0);
+    filler(buf, "..", NULL, 0, 0);
+
+    dir_entry_t entries[READDIR_BATCH];
+    size_t cursor = 0;
+    ssize_t n;
+    while ((n = tfs_readdir(get_fs(), path, &cursor, entries,
+                            READDIR_BATCH)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            filler(buf, entries[i].d_name, NULL, 0, 0);
+        }
+    }
+    return n == 0 ? 0 : -EIO;
+}
+
+/*
+ * Opens a file with the given TecnicoFS flags and keeps its handle in fi
+ */
+static int open_file(char const *path, int flags, struct fuse_file_info *fi) {
+    fuse_file_t *file = malloc(sizeof(fuse_file_t));
+    if (file == NULL) {
+        return -ENOMEM;
+    }
+    if ((fi->flags & O_TRUNC) != 0) {
+        flags |= TFS_O_TRUNC;
+    }
+    if ((fi->flags & O_APPEND) != 0) {
+        flags |= TFS_O_APPEND;
+    }
+
+    file->fhandle = tfs_open(get_fs(), path, flags);
+    if (file->fhandle == -1) {
+        free(file);
+        return (flags & TFS_O_CREAT) != 0 ? -ENOSPC : -ENOENT;
+    }
+    pthread_mutex_init(&file->mutex, NULL);
+    fi->fh = (uint64_t)(uintptr_t)file;
+    return 0;
+}
+
+static int tfs_fuse_open(char const *path, struct fuse_file_info *fi) {
+    return open_file(path, 0, fi);
+}
+
+static int tfs_fuse_create(char const *path, mode_t mode,
+                           struct fuse_file_info *fi) {
+    (void)mode;
+    return open_file(path, TFS_O_CREAT, fi);
+}
+
+static int tfs_fuse_release(char const *path, struct fuse_file_info *fi) {
+    (void)path;
+    fuse_file_t *file = (fuse_file_t *)(uintptr_t)fi->fh;
+    int result = tfs_close(get_fs(), file->fhandle);
+    pthread_mutex_destroy(&file->mutex);
+    free(file);
+    return result == 0 ? 0 : -EIO;
+}
+
+static int tfs_fuse_read(char const *path, char *buf, size_t size,
+                         off_t offset, struct fuse_file_info *fi) {
+    (void)path;
+    fuse_file_t *file = (fuse_file_t *)(uintptr_t)fi->fh;
+    tfs_ctx *fs = get_fs();
+
+    pthread_mutex_lock(&file->mutex);
+    ssize_t result = 0;
+    /* Reading past the end of the file returns nothing */
+    if (tfs_seek(fs, file->fhandle, (size_t)offset) == 0) {
+        result = tfs_read(fs, file->fhandle, buf, size);
+    }
+    pthread_mutex_unlock(&file->mutex);
+    return result == -1 ? -EIO : (int)result;
+}
+
+static int tfs_fuse_write(char const *path, char const *buf, size_t size,
+                          off_t offset, struct fuse_file_info *fi) {
+    (void)path;
+    fuse_file_t *file = (fuse_file_t *)(uintptr_t)fi->fh;
+    tfs_ctx *fs = get_fs();
+
+    pthread_mutex_lock(&file->mutex);
+    ssize_t result = -1;
+    /* Files cannot have holes (appends ignore the offset) */
+    if ((fi->flags & O_APPEND) != 0 ||
+        tfs_seek(fs, file->fhandle, (size_t)offset) == 0) {
+        result = tfs_write(fs, file->fhandle, buf, size);
+    }
+    pthread_mutex_unlock(&file->mutex);
+    if (result == -1) {
+        return -EINVAL;
+    }
+    return result == 0 && size > 0 ? -EFBIG : (int)result;
+}
+
+static int tfs_fuse_truncate(char const *path, off_t size,
+                             struct fuse_file_info *fi) {
+    (void)fi;
+    /* Files can only be truncated to zero */
+    if (size != 0) {
+        return -EOPNOTSUPP;
+    }
+    tfs_ctx *fs = get_fs();
+    int fhandle = tfs_open(fs, path, TFS_O_TRUNC);
+    if (fhandle == -1) {
+        return -ENOENT;
+    }
+    return tfs_close(fs, fhandle) == 0 ? 0 : -EIO;
+}
+
+static int tfs_fuse_fallocate(char const *path, int mode, off_t offset,
+                              off_t len, struct fuse_file_info *fi) {
+    (void)path;
+    /* The file's size is never changed */
+    if (mode != FALLOC_FL_KEEP_SIZE) {
+        return -EOPNOTSUPP;
+    }
+    fuse_file_t *file = (fuse_file_t *)(uintptr_t)fi->fh;
+    return tfs_fallocate(get_fs(), file->fhandle, (size_t)offset,
+                         (size_t)len) == 0
+               ? 0
+               : -ENOSPC;
+}
+
+static int tfs_fuse_unlink(char const *path) {
+    return tfs_unlink(get_fs(), path) == 0 ? 0 : -ENOENT;
+}
+
+static int tfs_fuse_utimens(char const *path, struct timespec const tv[2],
+                            struct fuse_file_info *fi) {
+    (void)tv;
+    (void)fi;
+    /* Files have no times; only check that the file exists */
+    return strcmp(path, "/") == 0 || tfs_lookup(get_fs(), path) != -1
+               ? 0
+               : -ENOENT;
+}
+
+static struct fuse_operations const tfs_fuse_operations = {
+    .init = tfs_fuse_init,
+    .destroy = tfs_fuse_destroy,
+    .getattr = tfs_fuse_getattr,
+    .readdir = tfs_fuse_readdir,
+    .open = tfs_fuse_open,
+    .create = tfs_fuse_create,
+    .release = tfs_fuse_release,
+    .read = tfs_fuse_read,
+    .write = tfs_fuse_write,
+    .truncate = tfs_fuse_truncate,
+    .fallocate = tfs_fuse_fallocate,
+    .unlink = tfs_fuse_unlink,
+    .utimens = tfs_fuse_utimens,
+};
+
+int main(int argc, char *argv[]) {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if (fuse_opt_parse(&args, &options, option_spec, NULL) == -1) {
+        return 1;
+    }
+
+    tfs_params params = tfs_default_params();
+    if (options.blocks > 0) {
+        params.max_block_count = options.blocks;
+    }
+    tfs_ctx *fs = tfs_init(&params);
+    if (fs == NULL) {
+        fprintf(stderr, "tfs_fuse: failed to initialize the volume\n");
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+    /* The trace is stopped when the volume is destroyed */
+    if (options.trace != NULL && tfs_trace_start(fs, options.trace) == -1) {
+        fprintf(stderr, "tfs_fuse: failed to create the trace %s\n",
+                options.trace);
+        tfs_destroy(fs);
+        fuse_opt_free_args(&args);
+        return 1;
+    }
+
+    /* fs is destroyed by tfs_fuse_destroy, when the volume is unmounted */
+    int result = fuse_main(args.argc, args.argv, &tfs_fuse_operations, fs);
+    fuse_opt_free_args(&args);
+    return result;
+}
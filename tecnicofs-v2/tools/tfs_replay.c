@@ -0,0 +1,70 @@
+/*
+ * Trace replay: re-executes a trace recorded with tfs_trace_start against a
+ * fresh volume, and compares the latencies of its calls with the traced
+ * ones.
+ *
+ * Usage: tools/tfs_replay [--timed] [--blocks=N] <trace>
+ *  - --timed: calls start at the same times as in the trace (by default,
+ *    they are replayed as fast as possible, still in the same order)
+ *  - --blocks=N: capacity of the data region, in blocks
+ */
+#include "operations.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double mean_us(uint64_t total_ns, size_t calls) {
+    return calls == 0 ? 0 : (double)total_ns / (double)calls / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    bool timed = false;
+    tfs_params params = tfs_default_params();
+    char const *trace = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--timed") == 0) {
+            timed = true;
+        } else if (strncmp(argv[i], "--blocks=", 9) == 0) {
+            params.max_block_count = strtoul(argv[i] + 9, NULL, 10);
+        } else if (trace == NULL) {
+            trace = argv[i];
+        } else {
+            trace = NULL;
+            break;
+        }
+    }
+    if (trace == NULL) {
+        fprintf(stderr, "usage: %s [--timed] [--blocks=N] <trace>\n",
+                argv[0]);
+        return 1;
+    }
+
+    tfs_ctx *fs = tfs_init(&params);
+    if (fs == NULL) {
+        fprintf(stderr, "tfs_replay: failed to initialize the volume\n");
+        return 1;
+    }
+    trace_replay_stats_t stats;
+    int result = tfs_trace_replay(fs, trace, timed, &stats);
+    tfs_destroy(fs);
+    if (result == -1) {
+        fprintf(stderr, "tfs_replay: failed to replay %s\n", trace);
+        return 1;
+    }
+
+    printf("%-20s %10s %10s %14s %14s\n", "operation", "calls",
+           "mismatches", "traced (us)", "replayed (us)");
+    for (size_t op = 0; op < TRACE_OPS; op++) {
+        trace_op_stats_t const *s = &stats.ops[op];
+        if (s->calls > 0) {
+            printf("%-20s %10zu %10zu %14.1f %14.1f\n", trace_op_names[op],
+                   s->calls, s->mismatches, mean_us(s->trace_ns, s->calls),
+                   mean_us(s->replay_ns, s->calls));
+        }
+    }
+    printf("%zu threads: traced in %.3f s, replayed in %.3f s\n",
+           stats.threads, (double)stats.trace_ns / 1e9,
+           (double)stats.replay_ns / 1e9);
+    return 0;
+}